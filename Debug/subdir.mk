@@ -5,32 +5,74 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
 ../RaPIDaffin.cpp \
+../calibration.cpp \
+../candidate_store.cpp \
+../checkpoint.cpp \
 ../classifier.cpp \
 ../dumpable.cpp \
+../families.cpp \
+../gzip_member_writer.cpp \
+../kinship_matrix.cpp \
 ../mapper.cpp \
+../metrics.cpp \
 ../ordering.cpp \
+../output_writer.cpp \
+../pair_store.cpp \
+../pair_totals.cpp \
 ../parser.cpp \
-../proceed.cpp 
+../proceed.cpp \
+../relatedness_graph.cpp \
+../segment_export.cpp \
+../segment_source.cpp \
+../serve.cpp 
 
 OBJS += \
 ./RaPIDaffin.o \
+./calibration.o \
+./candidate_store.o \
+./checkpoint.o \
 ./classifier.o \
 ./dumpable.o \
+./families.o \
+./gzip_member_writer.o \
+./kinship_matrix.o \
 ./mapper.o \
+./metrics.o \
 ./ordering.o \
+./output_writer.o \
+./pair_store.o \
+./pair_totals.o \
 ./parser.o \
-./proceed.o 
+./proceed.o \
+./relatedness_graph.o \
+./segment_export.o \
+./segment_source.o \
+./serve.o 
 
 CPP_DEPS += \
 ./RaPIDaffin.d \
+./calibration.d \
+./candidate_store.d \
+./checkpoint.d \
 ./classifier.d \
 ./dumpable.d \
+./families.d \
+./gzip_member_writer.d \
+./kinship_matrix.d \
 ./mapper.d \
+./metrics.d \
 ./ordering.d \
+./output_writer.d \
+./pair_store.d \
+./pair_totals.d \
 ./parser.d \
-./proceed.d 
+./proceed.d \
+./relatedness_graph.d \
+./segment_export.d \
+./segment_source.d \
+./serve.d 
 
-CXXFLAGS := -pipe -std=c++14  -Wall  -g
+CXXFLAGS := -pipe -std=c++17  -Wall  -g
 
 # Each subdirectory must supply rules for building sources it contributes
 %.o: ../%.cpp
@@ -19,18 +19,28 @@
 #include <cmath>
 #include <unordered_set>
 #include <vector>
+#include <future>
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <sys/wait.h>
 #include "mapper.hpp"
 #include "parser.hpp"
 #include "classifier.hpp"
+#include "serve.hpp"
+#include "families.hpp"
+#include "calibration.hpp"
 #include <sstream>
 using namespace std;
 
 #define NUM_REQUIRED_OPTIONS 3
 
 static bool parse_parameters(int args, char** argv, struct parameter &parameters);
+static bool parse_chromosome_list(const std::string &list, std::vector<int> &chromosomes);
 static void print_usage(std::ostream &out);
+static bool parse_reclassify_parameters(int args, char** argv, struct parameter &parameters);
+static bool parse_serve_parameters(int args, char** argv, struct parameter &parameters);
+static bool parse_families_parameters(int args, char** argv, struct parameter &parameters);
+static bool parse_shard(const std::string &shard, int &index, int &count);
 
 struct parameter {
 	std::string input_folder_vcf_path;
@@ -44,6 +54,38 @@ struct parameter {
 	int rapid_out_put_set = 0;
 	int max_degree = 4;
 	unsigned int num_threads = 22;
+	double checkpoint_interval = 60;
+	bool resume = false;
+	std::string pair_store_path;
+	std::vector<struct chromosome_region> chromosomes;
+	// Chromosomes given to --map and --update-chromosomes, resolved once all
+	// chromosomes are known
+	std::string map_list;
+	bool map_all = false;
+	std::vector<int> map_chromosomes;
+	bool reduce = false;
+	int shard = 0;
+	int num_shards = 0;
+	bool merge = false;
+	OutputFormat output_format = OutputFormat::TSV;
+	bool pair_totals = false;
+	double pair_totals_floor = -1;
+	std::string metrics_path;
+	int progress_interval = 0;
+	double min_segment_length = 0;
+	int calibration_ids = 0;
+	double segment_kinship = -1;
+	bool kinship_matrix = false;
+	SegmentFormat segment_format = SegmentFormat::RAPID;
+	std::string pair_totals_path;
+	std::string calibration = "saved";
+	std::string results_path;
+	std::string socket_path = "raffi.sock";
+	int num_clients = 8;
+	std::string samples_path;
+	std::string temporary_path;
+	CandidateCodec temporary_codec = CandidateCodec::GZIP;
+	double candidate_memory = 1024;
 };
 
 
@@ -61,10 +103,51 @@ static std::string exec(const char* cmd) {
 	return result;
 }
 
+/**
+ * Estimate the RaPID window size for one chromosome by running estimate_params.py
+ * on the VCF file and genetic map of that chromosome.
+ *
+ * @param params parsed command line parameters.
+ * @param chromosome_number
+ *
+ * @return estimated window size.
+ */
+static int
+estimate_window_size(const struct parameter &params, int chromosome_number)
+{
+	const std::string &name = get_chromosome(chromosome_number).name;
+	stringstream command_line;
+	command_line << params.python_path << " " << "../bin/estimate_params.py ";
+	command_line << params.input_folder_vcf_path << "//" << params.vcf_prefix << name << ".vcf.gz ";
+	command_line << params.gen_map_path << "/" << "chr" << name << ".rMap";
+
+	return stoi(exec(command_line.str().c_str()));
+}
+
 int main(int args, char** argv)
 {
 	struct parameter params;
-	if (!parse_parameters(args, argv, params)) {
+	if (args > 1 && std::string(argv[1]) == "serve") {
+		if (!parse_serve_parameters(args - 1, argv + 1, params)) {
+			print_usage(std::cerr);
+			return -1;
+		}
+		serve(params.results_path, params.samples_path, params.socket_path, params.num_clients);
+		return 0;
+	}
+	if (args > 1 && std::string(argv[1]) == "families") {
+		if (!parse_families_parameters(args - 1, argv + 1, params)) {
+			print_usage(std::cerr);
+			return -1;
+		}
+		write_families(params.results_path, params.samples_path, params.output_path, params.max_degree);
+		return 0;
+	}
+
+	bool reclassifying = args > 1 && std::string(argv[1]) == "reclassify";
+	if (reclassifying ?
+		!parse_reclassify_parameters(args - 1, argv + 1, params) :
+		!parse_parameters(args, argv, params)) {
 		print_usage(std::cerr);
 		return -1;
 	}
@@ -78,41 +161,103 @@ int main(int args, char** argv)
 		}
 	}
 
+	if (reclassifying) {
+	struct master_options options;
+	options.max_degree = params.max_degree;
+	options.num_threads = params.num_threads;
+	options.output_path = params.output_path;
+	options.output_format = params.output_format;
+	reclassify(params.pair_totals_path, params.calibration, options);
+	return 0;
+	}
+
 	stringstream input_vcf_file_example;
-	input_vcf_file_example << params.input_folder_vcf_path + "//" + params.vcf_prefix  << 22 <<".vcf.gz";
+	input_vcf_file_example << params.input_folder_vcf_path + "//" + params.vcf_prefix  << get_chromosome(get_num_chromosomes()).name <<".vcf.gz";
 	string iv = input_vcf_file_example.str();
 	params.vcf_example = iv.c_str();
 
 	//cout << params.vcf_example << "\n";
-	if (params.rapid_out_put_set == 0){
+	if (!params.map_chromosomes.empty() && (params.pair_store_path.empty() || params.rapid_out_put_set == 0)) {
+		std::cerr << "--map, --map-reduce and --update-chromosomes require --pair-store and -O!" << std::endl;
+		return -1;
+	}
+	if (params.reduce && params.pair_store_path.empty()) {
+		std::cerr << "--reduce requires --pair-store!" << std::endl;
+		return -1;
+	}
 
-	//Run RaPID
-	stringstream command_line;
-	command_line  <<params.python_path<< " " << "../bin/estimate_params.py ";
-	command_line << params.vcf_example << " " << params.gen_map_path << "/" << "chr22.rMap";
+	if (params.num_shards > 0 && params.pair_totals) {
+		std::cerr << "--pair-totals cannot be used with --shard or --merge-shards!" << std::endl;
+		return -1;
+	}
+	if (params.num_shards > 0 && (!params.pair_store_path.empty() || !params.map_chromosomes.empty() || params.reduce)) {
+		std::cerr << "--shard and --merge-shards cannot be used with --pair-store!" << std::endl;
+		return -1;
+	}
+	if (params.calibration_ids > 0 && (params.num_shards > 0 || !params.map_chromosomes.empty() || params.reduce)) {
+		std::cerr << "--calibrate cannot be used with --shard, --map or --reduce!" << std::endl;
+		return -1;
+	}
+	if (params.segment_kinship >= 0 && (params.resume || params.num_shards > 0 || !params.map_chromosomes.empty() || params.reduce)) {
+		std::cerr << "--export-segments cannot be used with --resume, --shard, --map or --reduce!" << std::endl;
+		return -1;
+	}
+	if (params.kinship_matrix && params.resume) {
+		std::cerr << "--kinship-matrix cannot be used with --resume!" << std::endl;
+		return -1;
+	}
+	if (params.segment_format != SegmentFormat::RAPID && params.rapid_out_put_set == 0) {
+		std::cerr << "--ibd-format requires -O!" << std::endl;
+		return -1;
+	}
+	if (params.shard > 0 && params.rapid_out_put_set == 0) {
+		std::cerr << "--shard requires -O!" << std::endl;
+		return -1;
+	}
+
+	if (params.merge || (params.reduce && params.map_chromosomes.empty())) {
+		// Shards or chromosomes have finished, only their outputs are combined
+	} else if (params.rapid_out_put_set == 0 && params.resume) {
+		// RaPID has finished before the checkpoint was taken
+		params.rapid_output_path = params.output_path;
+	} else if (params.rapid_out_put_set == 0){
 
-	//cout << command_line.str() <<"\n";
-	int window_size = stoi(exec(command_line.str().c_str()));
+	//Run RaPID
+	// Estimate the window size of each chromosome, at most num_threads estimations at a time
+	int num_concurrent = max(params.num_threads, 1u);
+	int num_chromosomes = get_num_chromosomes();
+	vector<int> window_sizes(num_chromosomes + 1);
+	for (int first = 1; first <= num_chromosomes; first += num_concurrent) {
+		int last = min(first + num_concurrent - 1, num_chromosomes);
+		vector<future<int>> estimations;
+		for (int chrom = first; chrom <= last; chrom++) {
+			estimations.push_back(async(launch::async, estimate_window_size, cref(params), chrom));
+		}
+		for (int chrom = first; chrom <= last; chrom++) {
+			window_sizes[chrom] = estimations[chrom - first].get();
+			cout << "Window size for chromosome " << get_chromosome(chrom).name << ": " << window_sizes[chrom] << "\n";
+		}
+	}
 
-	int chr_per_thread = 22 / params.num_threads;
+	int chr_per_thread = num_chromosomes / params.num_threads;
 	if (chr_per_thread < 1) chr_per_thread = 1;
 	stringstream rapid_params;
 	rapid_params << "../bin/RaPID_v.1.7 -r 3 -s 1 -d 5 ";
-	rapid_params << " -w " << window_size;
 	int chr_counter = 1;
-	vector<pid_t> pids(params.num_threads);
 
 	vector<string> clines;//(params.num_threads);
 
-	while (chr_counter <= 22){
+	while (chr_counter <= num_chromosomes){
 	stringstream rapid_command_line;
 
 		for (int j = 0; j < chr_per_thread ; j++){
-			if (chr_counter == 23) break;
+			if (chr_counter == num_chromosomes + 1) break;
 
-			rapid_command_line << rapid_params.str() << " -i " << params.input_folder_vcf_path <<"/" <<params.vcf_prefix << chr_counter << ".vcf.gz ";
-			rapid_command_line << " -o " << params.output_path << "/" << chr_counter;
-			rapid_command_line << " -g " << params.gen_map_path << "/" << "chr" << chr_counter<<".rMap";
+			const std::string &name = get_chromosome(chr_counter).name;
+			rapid_command_line << rapid_params.str() << " -w " << window_sizes[chr_counter];
+			rapid_command_line << " -i " << params.input_folder_vcf_path <<"/" <<params.vcf_prefix << name << ".vcf.gz ";
+			rapid_command_line << " -o " << params.output_path << "/" << name;
+			rapid_command_line << " -g " << params.gen_map_path << "/" << "chr" << name <<".rMap";
 
 			if (j < chr_per_thread -1 )
 				rapid_command_line << ";";
@@ -123,7 +268,8 @@ int main(int args, char** argv)
 	}
 
 
-	for(unsigned int i=0;i<params.num_threads;i++) // loop will run n times (n=5)
+	// One process per group of chromosomes
+	for(unsigned int i=0;i<clines.size();i++)
 	    {		        	//cout << clines[i].c_str() <<"\n";
 
 
@@ -134,20 +280,49 @@ int main(int args, char** argv)
 	        	exit(0);
 	        }
 	    }
-	    for(unsigned int i=0;i<params.num_threads;i++)
+	    for(unsigned int i=0;i<clines.size();i++)
 	    wait(NULL);
 	    params.rapid_output_path = params.output_path;
 
 	}
 
-	std::ofstream out(params.output_path + "predictions.txt", std::ios::out | std::ios::trunc);
-	out << std::fixed << std::setprecision(4);
-
-
-	{
+	struct master_options options;
+	options.max_degree = params.max_degree;
+	options.num_threads = params.num_threads;
+	options.output_path = params.output_path;
+	options.checkpoint_interval = std::lround(params.checkpoint_interval * 60);
+	options.resume = params.resume;
+	options.pair_store_path = params.pair_store_path;
+	options.map_chromosomes = params.map_chromosomes;
+	options.reduce = params.reduce;
+	options.shard = params.shard;
+	options.num_shards = params.num_shards;
+	options.output_format = params.output_format;
+	options.temporary_path = params.temporary_path;
+	options.temporary_codec = params.temporary_codec;
+	options.candidate_memory = std::llround(params.candidate_memory * 1024 * 1024);
+	options.pair_totals = params.pair_totals;
+	options.pair_totals_floor = params.pair_totals_floor;
+	options.metrics_path = params.metrics_path;
+	options.progress_interval = params.progress_interval;
+	options.min_segment_length = params.min_segment_length;
+	options.calibration_ids = params.calibration_ids;
+	options.segment_kinship = params.segment_kinship;
+	options.kinship_matrix = params.kinship_matrix;
+	options.segment_format = params.segment_format;
+	options.vcf_prefix = params.input_folder_vcf_path + "/" + params.vcf_prefix;
+
+	if (params.merge) {
+	merge_shards(params.vcf_example, params.gen_map_path, options);
+	} else if (!options.map_chromosomes.empty() || options.reduce) {
+	map_reduce(
+			params.vcf_example, params.rapid_output_path, params.gen_map_path,
+			options
+	);
+	} else {
 	master(
 			params.vcf_example, params.rapid_output_path, params.gen_map_path,
-			params.max_degree, params.num_threads, out
+			options
 	);
 	}
 
@@ -198,18 +373,108 @@ print_usage(std::ostream &out)
 			<< "Optional parameters:" << std::endl
 			<< "-O {output directory of RaPID results}" << std::endl
 			<< "\tUsing this tag, RaPID will not be run and the provided outputs will be used directly for relatedness inference." << std::endl
+			<< "--ibd-format {rapid|hap-ibd|ilash}" << std::endl
+			<< "\tIBD caller whose segments -O holds: rapid reads {name}/results.max.gz, hap-ibd reads chr{name}.ibd.gz" << std::endl
+			<< "\tand ilash reads gzipped chr{name}.match.gz. hap-IBD and iLASH segments are located with the positions of the VCF sites" << std::endl
+			<< "\tand must be sorted by the first individual of each pair in VCF order. Default is rapid." << std::endl
 			<< "-o {output directory}" << std::endl
 			<< "\tOutput will be written to {output directory}/predictions.txt." << std::endl
 			<< "\tDefault is current direcotry." << std::endl
+			<< "--output-format {tsv|tsv.gz|binary}" << std::endl
+			<< "\ttsv writes predictions.txt, tsv.gz writes gzipped predictions.txt.gz." << std::endl
+			<< "\tbinary writes block-columnar predictions.bin with sample indices." << std::endl
+			<< "\tAll formats also write predictions.samples.txt listing the samples in VCF order." << std::endl
+			<< "\tDefault is tsv." << std::endl
+			<< "--tmp-dir {scratch directory}" << std::endl
+			<< "\tDirectory for the temporary file of candidate pairs, which gets a unique name." << std::endl
+			<< "\tDefault is the output directory." << std::endl
+			<< "--tmp-codec {none|fast|gzip}" << std::endl
+			<< "\tCompression of the temporary file. fast is gzip at its fastest level." << std::endl
+			<< "\tDefault is gzip." << std::endl
+			<< "--candidate-memory {megabytes}" << std::endl
+			<< "\tCandidate pairs are kept in memory up to this size and only written to the temporary file beyond it." << std::endl
+			<< "\t0 always writes them to the temporary file. Default is 1024." << std::endl
+			<< "--pair-totals" << std::endl
+			<< "\tAlso write the totals of every pair and the calibration to {output directory}/pairs.totals." << std::endl
+			<< "\tUse \"reclassify\" to regenerate predictions from it." << std::endl
+			<< "--pair-totals-floor {kinship coefficient}" << std::endl
+			<< "\tPairs below this kinship coefficient are left out of pairs.totals." << std::endl
+			<< "\tDefault is what 4th degree needs." << std::endl
+			<< "--metrics {metrics file}" << std::endl
+			<< "\tTime the stages of the run and write them with counts of lines, segments and pairs per chromosome" << std::endl
+			<< "\tand per thread as JSON at the end, or at the next synchronization after kill -USR1 {pid}." << std::endl
+			<< "--progress {seconds}" << std::endl
+			<< "\tPrint progress, live memory, throughput and ETA of every chromosome to stderr this often." << std::endl
+			<< "\tThe same snapshot is printed at the next synchronization after kill -USR1 {pid}." << std::endl
 			<< "-d {max degree}" << std::endl
 			<< "\tMaximum target degree (4 is largest supported degree)." << std::endl
 			<< "\tDefault is 4." << std::endl
 			<< "-t {number of threads}" << std::endl
 			<< "\tOptimal number of threads is the number of chromosomes." << std::endl
 			<< "\tDefault is 22." << std::endl
+			<< "--min-segment-cm {cM|auto}" << std::endl
+			<< "\tSegments shorter than this are dropped as soon as they are parsed. auto picks 10 for -d 1, 7 for -d 2," << std::endl
+			<< "\t5 for -d 3 and 0 for -d 4. Default is 0, which keeps all segments." << std::endl
+			<< "--kinship-matrix" << std::endl
+			<< "\tAlso write the kinship coefficients of all output pairs as a sparse symmetric matrix in the order of the VCF:" << std::endl
+			<< "\t{output directory}/kinship.csr in compressed sparse row format, and kinship.grm.sp and kinship.grm.id for GCTA." << std::endl
+			<< "--export-segments {min kinship}" << std::endl
+			<< "\tWrite the merged IBD and IBD2 intervals of pairs with at least this kinship coefficient to {output directory}/segments.bin." << std::endl
+			<< "\tNo checkpoints are taken while segments are exported." << std::endl
+			<< "--calibrate {number of individuals}" << std::endl
+			<< "\tCalibrate the inference boundaries on the segments of this many individuals on the " << CALIBRATION_NUM_CHROMOSOMES << " longest chromosomes" << std::endl
+			<< "\tbefore parsing, so that pairs are written straight to the final output. 0 disables the pre-pass." << std::endl
+			<< "\tDefault is 0." << std::endl
+			<< "--chromosomes {chromosomes}" << std::endl
+			<< "\tComma-separated chromosomes to analyse (e.g. 1-22,X or 20-22 for a pilot), named as in their files." << std::endl
+			<< "\tname:first-last only analyses these sites of a chromosome, e.g. 20:0-40000 or 21:5000-." << std::endl
+			<< "\tKinship is estimated from the analysed length. Default is 1-22." << std::endl
 		    << "-p {Python version}" << std::endl
 		    << "\tPython path" << std::endl
-			<< "\tDefault is python3.6" << std::endl;
+			<< "\tDefault is python3.6" << std::endl
+			<< "--checkpoint-interval {minutes}" << std::endl
+			<< "\tMinutes between two checkpoints written to {output directory}/raffi.checkpoint. 0 disables checkpoints." << std::endl
+			<< "\tDefault is 60." << std::endl
+			<< "--resume" << std::endl
+			<< "\tContinue from the last checkpoint in the output directory instead of starting over." << std::endl
+			<< "--pair-store {pair store directory}" << std::endl
+			<< "\tSave the total IBD1 and IBD2 of every pair on chromosome i to {pair store directory}/chr{i}.pairs.gz." << std::endl
+			<< "--update-chromosomes {chromosomes}" << std::endl
+			<< "\tComma-separated chromosomes (e.g. 5,7 or 1-3) whose RaPID outputs have changed." << std::endl
+			<< "\tOnly these chromosomes are reprocessed into the pair store, then all pairs are reclassified from it." << std::endl
+			<< "\tSame as --map {chromosomes} --reduce." << std::endl
+			<< "--map {chromosomes}" << std::endl
+			<< "\tProcess each of these chromosomes on its own into the pair store, without classifying pairs." << std::endl
+			<< "--reduce" << std::endl
+			<< "\tMerge the pair stores of all chromosomes, classify all pairs and write {output directory}/predictions.txt." << std::endl
+			<< "--map-reduce" << std::endl
+			<< "\tSame as --map with all chromosomes and --reduce. Chromosomes do not progress together and memory is bounded by a single chromosome per thread." << std::endl
+			<< "--shard {k}/{N}" << std::endl
+			<< "\tOnly process pairs whose first individual is in the k-th of N equal slices of the VCF samples." << std::endl
+			<< "\tCandidates are written to {output directory}/shard.{k}.of.{N}.candidates. Requires -O." << std::endl
+			<< "--merge-shards {N}" << std::endl
+			<< "\tInfer the candidates of all N shards in {output directory} and write {output directory}/predictions.txt." << std::endl
+			<< std::endl
+			<< "Usage: ./RAFFI_v.0.1 reclassify -s {pairs.totals} [-o {output directory}] [-d {max degree}]" << std::endl
+			<< "\t[--output-format {tsv|tsv.gz|binary}] [--calibration {saved|recompute|none}]" << std::endl
+			<< "\tRegenerate predictions from a pair-totals sidecar. --calibration saved (default) uses the thresholds" << std::endl
+			<< "\tat the end of the original run, recompute recalibrates from the stored full-siblings, none uses" << std::endl
+			<< "\tunadjusted thresholds." << std::endl
+			<< std::endl
+			<< "Usage: ./RAFFI_v.0.1 serve -r {predictions.txt|predictions.txt.gz|predictions.bin} [-s {sample IDs}]" << std::endl
+			<< "\t[-S {socket path}] [-c {max clients}]" << std::endl
+			<< "\tLoad finished results and answer queries on a Unix domain socket (default raffi.sock):" << std::endl
+			<< "\tRELATIVES {id} [{max degree}], KINSHIP {id1} {id2} and QUIT, one per line." << std::endl
+			<< "\tText results are indexed in the order of the sample IDs, one per line or a .vcf.gz. Default is" << std::endl
+			<< "\tpredictions.samples.txt next to the results. Up to max clients (default 8) are served at once." << std::endl
+			<< "\tSIGINT or SIGTERM disconnects the clients and removes the socket." << std::endl
+			<< std::endl
+			<< "Usage: ./RAFFI_v.0.1 families -r {predictions.txt|predictions.txt.gz|predictions.bin} [-s {sample IDs}]" << std::endl
+			<< "\t[-o {output directory}] [-d {max degree}]" << std::endl
+			<< "\tWrite the families (connected components) of relatives up to the max degree to {output directory}/families.txt" << std::endl
+			<< "\tand a maximal set of individuals unrelated up to it to {output directory}/unrelated.txt, in VCF order." << std::endl
+			<< "\tText results are indexed in the order of the sample IDs, one per line or a .vcf.gz." << std::endl
+			<< "\tDefault is predictions.samples.txt next to the results." << std::endl;
 }
 
 /**
@@ -301,11 +566,359 @@ parse_parameters(int args, char** argv, struct parameter &parameters)
 			}
 			detected_options.insert(option);
 			parameters.python_path = argv[i];
+		} else if (option == "--output-format") {
+			i++;
+			if (i >= args || !parse_output_format(argv[i], parameters.output_format)) {
+				std::cerr << "Output format must be tsv, tsv.gz or binary!" << std::endl << std::endl;
+				failed = true;
+				break;
+			}
+		} else if (option == "--tmp-dir") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.temporary_path = argv[i];
+		} else if (option == "--tmp-codec") {
+			i++;
+			if (i >= args || !parse_candidate_codec(argv[i], parameters.temporary_codec)) {
+				std::cerr << "Temporary codec must be none, fast or gzip!" << std::endl << std::endl;
+				failed = true;
+				break;
+			}
+		} else if (option == "--candidate-memory") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.candidate_memory = std::stod(argv[i]);
+			if (parameters.candidate_memory < 0) {
+				std::cerr << "Candidate memory cannot be negative!" << std::endl << std::endl;
+				failed = true;
+				break;
+			}
+		} else if (option == "--pair-totals") {
+			parameters.pair_totals = true;
+		} else if (option == "--pair-totals-floor") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.pair_totals_floor = std::stod(argv[i]);
+		} else if (option == "--metrics") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.metrics_path = argv[i];
+		} else if (option == "--min-segment-cm") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			// auto derives the length from the max degree
+			parameters.min_segment_length = std::string(argv[i]) == "auto" ? -1 : std::stod(argv[i]);
+			if (parameters.min_segment_length < 0 && std::string(argv[i]) != "auto") {
+				std::cerr << "Minimum segment length must be auto or at least 0!" << std::endl << std::endl;
+				failed = true;
+				break;
+			}
+		} else if (option == "--ibd-format") {
+			i++;
+			if (i >= args || !parse_segment_format(argv[i], parameters.segment_format)) {
+				std::cerr << "IBD format must be rapid, hap-ibd or ilash!" << std::endl << std::endl;
+				failed = true;
+				break;
+			}
+		} else if (option == "--kinship-matrix") {
+			parameters.kinship_matrix = true;
+		} else if (option == "--export-segments") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.segment_kinship = std::stod(argv[i]);
+		} else if (option == "--calibrate") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.calibration_ids = std::stoi(argv[i]);
+		} else if (option == "--progress") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.progress_interval = std::stoi(argv[i]);
+		} else if (option == "--checkpoint-interval") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.checkpoint_interval = std::stod(argv[i]);
+		} else if (option == "--resume") {
+			parameters.resume = true;
+		} else if (option == "--pair-store") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.pair_store_path = argv[i];
+			parameters.pair_store_path += "/";
+		} else if (option == "--update-chromosomes") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.map_list += parameters.map_list.empty() ? argv[i] : "," + std::string(argv[i]);
+			parameters.reduce = true;
+		} else if (option == "--map") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.map_list += parameters.map_list.empty() ? argv[i] : "," + std::string(argv[i]);
+		} else if (option == "--reduce") {
+			parameters.reduce = true;
+		} else if (option == "--map-reduce") {
+			parameters.map_all = true;
+			parameters.reduce = true;
+		} else if (option == "--chromosomes") {
+			i++;
+			if (i >= args || !parse_chromosome_regions(argv[i], parameters.chromosomes)) {
+				std::cerr << "Invalid chromosomes!" << std::endl << std::endl;
+				failed = true;
+				break;
+			}
+		} else if (option == "--shard") {
+			i++;
+			if (i >= args || !parse_shard(argv[i], parameters.shard, parameters.num_shards)) {
+				failed = true;
+				break;
+			}
+		} else if (option == "--merge-shards") {
+			i++;
+			if (i >= args) {
+				failed = true;
+				break;
+			}
+			parameters.merge = true;
+			parameters.num_shards = std::stoi(argv[i]);
+			if (parameters.num_shards < 1) {
+				std::cerr << "Number of shards must be positive!" << std::endl << std::endl;
+				failed = true;
+				break;
+			}
 		}
 		i++;
 	}
 	if (detected_options.size() < NUM_REQUIRED_OPTIONS) {
 		failed = true;
 	}
+
+	// All chromosomes are known, chromosomes to map can be resolved
+	if (!failed && !parameters.chromosomes.empty()) {
+		set_chromosomes(parameters.chromosomes);
+	}
+	if (!failed && parameters.map_all) {
+		for (int chrom = 1; chrom <= get_num_chromosomes(); chrom++) {
+			parameters.map_chromosomes.push_back(chrom);
+		}
+	} else if (!failed && !parameters.map_list.empty()) {
+		failed = !parse_chromosome_list(parameters.map_list, parameters.map_chromosomes);
+	}
 	return !failed;
 }
+
+/**
+ * Parse a comma-separated list of chromosomes or ranges of chromosomes,
+ * e.g. "5,7", "1-3,22" or "X".
+ *
+ * @param list the list to parse.
+ * @param chromosomes filled with the numbers of the chromosomes.
+ *
+ * @return whether all chromosomes are among the chromosomes analysed.
+ */
+static bool
+parse_chromosome_list(const std::string &list, std::vector<int> &chromosomes)
+{
+	std::vector<struct chromosome_region> regions;
+	if (!parse_chromosome_regions(list, regions)) {
+		std::cerr << "Invalid chromosomes: " << list << std::endl << std::endl;
+		return false;
+	}
+	for (const struct chromosome_region &region : regions) {
+		int chrom = get_chromosome_number(region.name);
+		if (chrom == 0) {
+			std::cerr << "Chromosome " << region.name << " is not analysed" << std::endl << std::endl;
+			return false;
+		}
+		chromosomes.push_back(chrom);
+	}
+	return !chromosomes.empty();
+}
+
+
+/**
+ * Parse a shard of the form "k/N".
+ *
+ * @param shard the shard to parse.
+ * @param index filled with k.
+ * @param count filled with N.
+ *
+ * @return whether 1 <= k <= N.
+ */
+static bool
+parse_shard(const std::string &shard, int &index, int &count)
+{
+	size_t slash = shard.find('/');
+	if (slash != std::string::npos) {
+		index = std::atoi(shard.substr(0, slash).c_str());
+		count = std::atoi(shard.substr(slash + 1).c_str());
+	}
+	if (slash == std::string::npos || index < 1 || index > count) {
+		std::cerr << "Invalid shard: " << shard << std::endl << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+/**
+ * Parse the command line arguments of the reclassify subcommand.
+ *
+ * @param args number of command line arguments, starting with "reclassify".
+ * @param array of command line arguments.
+ * @param parameters a struct parameter that will be filled.
+ *
+ * @return whether the arguments are valid and the sidecar is given.
+ */
+static bool
+parse_reclassify_parameters(int args, char** argv, struct parameter &parameters)
+{
+	for (int i = 1; i < args; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= args) {
+			return false;
+		}
+		std::string value = argv[++i];
+		if (option == "-s") {
+			parameters.pair_totals_path = value;
+		} else if (option == "-o") {
+			parameters.output_path = value + "/";
+		} else if (option == "-d") {
+			parameters.max_degree = std::stoi(value);
+			if (parameters.max_degree > 4 || parameters.max_degree <= 0) {
+				std::cerr << "Degrees less than 1 or beyond 4 are not supported!" << std::endl << std::endl;
+				return false;
+			}
+		} else if (option == "-t") {
+			parameters.num_threads = std::stoul(value, nullptr);
+		} else if (option == "--output-format") {
+			if (!parse_output_format(value, parameters.output_format)) {
+				std::cerr << "Output format must be tsv, tsv.gz or binary!" << std::endl << std::endl;
+				return false;
+			}
+		} else if (option == "--calibration") {
+			if (value != "saved" && value != "recompute" && value != "none") {
+				std::cerr << "Calibration must be saved, recompute or none!" << std::endl << std::endl;
+				return false;
+			}
+			parameters.calibration = value;
+		} else {
+			std::cerr << "Unknown option of reclassify: " << option << std::endl << std::endl;
+			return false;
+		}
+	}
+	return !parameters.pair_totals_path.empty();
+}
+
+
+/**
+ * Parse the command line arguments of the families subcommand.
+ *
+ * @param args number of command line arguments, starting with "families".
+ * @param array of command line arguments.
+ * @param parameters a struct parameter that will be filled.
+ *
+ * @return whether the arguments are valid and the results are given.
+ */
+static bool
+parse_families_parameters(int args, char** argv, struct parameter &parameters)
+{
+	for (int i = 1; i < args; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= args) {
+			return false;
+		}
+		std::string value = argv[++i];
+		if (option == "-r") {
+			parameters.results_path = value;
+		} else if (option == "-s") {
+			parameters.samples_path = value;
+		} else if (option == "-o") {
+			parameters.output_path = value + "/";
+		} else if (option == "-d") {
+			parameters.max_degree = std::stoi(value);
+			if (parameters.max_degree > 4 || parameters.max_degree <= 0) {
+				std::cerr << "Degrees less than 1 or beyond 4 are not supported!" << std::endl << std::endl;
+				return false;
+			}
+		} else {
+			std::cerr << "Unknown option of families: " << option << std::endl << std::endl;
+			return false;
+		}
+	}
+	return !parameters.results_path.empty();
+}
+
+
+/**
+ * Parse the command line arguments of the serve subcommand.
+ *
+ * @param args number of command line arguments, starting with "serve".
+ * @param array of command line arguments.
+ * @param parameters a struct parameter that will be filled.
+ *
+ * @return whether the arguments are valid and the results are given.
+ */
+static bool
+parse_serve_parameters(int args, char** argv, struct parameter &parameters)
+{
+	for (int i = 1; i < args; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= args) {
+			return false;
+		}
+		std::string value = argv[++i];
+		if (option == "-r") {
+			parameters.results_path = value;
+		} else if (option == "-s") {
+			parameters.samples_path = value;
+		} else if (option == "-S") {
+			parameters.socket_path = value;
+		} else if (option == "-c") {
+			parameters.num_clients = std::stoi(value);
+			if (parameters.num_clients <= 0) {
+				std::cerr << "At least one client must be served at a time!" << std::endl << std::endl;
+				return false;
+			}
+		} else {
+			std::cerr << "Unknown option of serve: " << option << std::endl << std::endl;
+			return false;
+		}
+	}
+	return !parameters.results_path.empty();
+}
@@ -8,7 +8,8 @@
 #ifndef WRAPPER_HPP
 #define WRAPPER_HPP
 
-#define NUM_CHROMOSOMES 22
+// Chromosomes analysed unless configured otherwise are 1 to NUM_AUTOSOMES
+#define NUM_AUTOSOMES 22
 #define MIN_POWER 0.3
 
 #endif
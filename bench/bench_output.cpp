@@ -0,0 +1,134 @@
+/**
+ * Benchmarks of writing output: the aggregation in dump_range and write_pair of
+ * every output format.
+ *
+ */
+
+#include <random>
+#include <streambuf>
+
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+
+#include "../classifier.hpp"
+#include "../dumpable.hpp"
+#include "../ordering.hpp"
+#include "../output_writer.hpp"
+#include "../RaPIDaffin.hpp"
+#include "synthetic.hpp"
+
+// Individuals whose pairs are aggregated
+#define NUM_IDS 2000
+// Relatives of every individual across all chromosomes
+#define NUM_RELATIVES 200
+
+// Output that discards everything written to it
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+
+static void
+BM_dump_range(benchmark::State &state)
+{
+    init_synthetic_maps();
+
+    std::vector<std::string> ids;
+    for (int i = 0; i < NUM_IDS; ++i) {
+        ids.push_back("s" + std::to_string(i));
+    }
+    Ordering order(ids);
+    std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> generated =
+        generate_matrices(NUM_IDS, NUM_RELATIVES, state.range(0), 1);
+
+    // Enough full-siblings have been recorded for pairs to go to final output
+    struct classifier_state saved = get_classifier_state();
+    add_full_siblings(MIN_NUM_FS, MIN_NUM_FS * 0.25);
+
+    std::string candidates_path = (boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("raffi-bench-%%%%-%%%%.temporary")).string();
+    CandidateStore candidates(candidates_path, CandidateCodec::NONE, 1 << 30);
+    candidates.open(0);
+    NullBuffer buffer;
+    std::ostream out(&buffer);
+    TsvWriter writer(out, order);
+    PairAccumulator accumulator;
+
+    uint64_t num_pairs = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> matrices = generated;
+        state.ResumeTiming();
+
+        dump_range(
+            4, FOURTH_START * MIN_POWER, order, {0, NUM_IDS - 1}, matrices, accumulator,
+            false, candidates, writer, nullptr, nullptr, num_pairs);
+    }
+    state.SetItemsProcessed(num_pairs);
+
+    writer.flush();
+    candidates.remove();
+    set_classifier_state(saved);
+}
+// Pairs aggregated from the matrices of 1, 4 and 22 worker threads
+BENCHMARK(BM_dump_range)->Arg(1)->Arg(4)->Arg(22);
+
+
+static void
+BM_write_pair(benchmark::State &state, OutputFormat format)
+{
+    std::vector<std::string> ids;
+    for (int i = 0; i < NUM_IDS; ++i) {
+        ids.push_back("s" + std::to_string(i));
+    }
+    Ordering order(ids);
+
+    // Rows with random IDs and probabilities
+    struct row {
+        int id1_index;
+        int id2_index;
+        double kinship_coefficient;
+        double probability_ibd0;
+        double probability_ibd1;
+        double probability_ibd2;
+        int encoding;
+    };
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> id(0, NUM_IDS - 1);
+    std::uniform_real_distribution<double> probability(0, 1);
+    std::uniform_int_distribution<int> encoding(0, NUM_TYPES - 2);
+    std::vector<struct row> rows(1 << 16);
+    for (struct row &row : rows) {
+        double probability_ibd1 = probability(random);
+        double probability_ibd2 = probability(random) * (1 - probability_ibd1);
+        row = {
+            id(random), id(random),
+            compute_kinship_coefficient_from(probability_ibd1, probability_ibd2),
+            1 - probability_ibd1 - probability_ibd2, probability_ibd1, probability_ibd2,
+            encoding(random)
+        };
+    }
+
+    NullBuffer buffer;
+    std::ostream out(&buffer);
+    std::unique_ptr<OutputWriter> writer = make_output_writer(format, out, order, 1);
+    writer->write_header();
+
+    for (auto _ : state) {
+        for (const struct row &row : rows) {
+            writer->write_pair(
+                row.id1_index, row.id2_index,
+                row.kinship_coefficient, row.probability_ibd0,
+                row.probability_ibd1, row.probability_ibd2,
+                row.encoding);
+        }
+    }
+    writer->flush();
+    state.SetItemsProcessed(state.iterations() * rows.size());
+}
+// Gzip members are compressed on other threads, so wall-clock time is what counts
+BENCHMARK_CAPTURE(BM_write_pair, tsv, OutputFormat::TSV)->UseRealTime();
+BENCHMARK_CAPTURE(BM_write_pair, tsv_gz, OutputFormat::TSV_GZ)->UseRealTime();
+BENCHMARK_CAPTURE(BM_write_pair, binary, OutputFormat::BINARY)->UseRealTime();
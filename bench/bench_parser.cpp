@@ -0,0 +1,169 @@
+/**
+ * Benchmarks of parsing RaPID output: parse_line, merging segments and totalling
+ * IBD1, the IBD2 scan in process_segment, and get_genetic_length one interval at a time and in batches.
+ *
+ */
+
+#include <array>
+#include <map>
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "../mapper.hpp"
+#include "../ordering.hpp"
+#include "../pair_store.hpp"
+#include "../segment_export.hpp"
+#include "../RaPIDaffin.hpp"
+#include "synthetic.hpp"
+
+// Individuals of the synthetic chromosome
+#define NUM_IDS 2000
+
+/**
+ * @param sibling_percent percentage of individuals with a full-sibling.
+ *
+ * @return the synthetic chromosome, generated on first use.
+ */
+static const struct synthetic_chromosome&
+get_synthetic_chromosome(int sibling_percent)
+{
+    static std::map<int, struct synthetic_chromosome> chromosomes;
+    auto it = chromosomes.find(sibling_percent);
+    if (it == chromosomes.end()) {
+        it = chromosomes.emplace(sibling_percent, generate_chromosome(NUM_IDS, sibling_percent / 100.0, 1)).first;
+    }
+    return it->second;
+}
+
+
+static void
+BM_parse_line(benchmark::State &state)
+{
+    const struct synthetic_chromosome &chromosome = get_synthetic_chromosome(10);
+    std::vector<std::string> lines = chromosome.lines;
+    Ordering order(chromosome.ids);
+    std::pair<int, int> id1_range {0, order.size()};
+
+    for (auto _ : state) {
+        for (std::string &line : lines) {
+            struct line_info info;
+            benchmark::DoNotOptimize(parse_line(line, info, order, id1_range));
+            benchmark::DoNotOptimize(info);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * lines.size());
+}
+BENCHMARK(BM_parse_line);
+
+
+static void
+BM_merge_and_compute_total_ibd1(benchmark::State &state)
+{
+    init_synthetic_maps();
+    const struct synthetic_chromosome &chromosome = get_synthetic_chromosome(state.range(0));
+
+    // Segments of every pair on each haplotype combination, as process_segment stores them
+    std::map<std::pair<int, int>, std::array<std::vector<std::pair<int, int>>, 4>> pairs;
+    for (const struct line_info &info : chromosome.segments) {
+        pairs[{info.id1_index, info.id2_index}][info.hap1 + info.hap2 * 2].emplace_back(
+            info.starting_site, info.ending_site);
+    }
+    std::vector<std::array<std::vector<std::pair<int, int>>, 4>> haps_to_segments;
+    for (auto &pair : pairs) {
+        haps_to_segments.push_back(pair.second);
+    }
+
+    for (auto _ : state) {
+        double total = 0;
+        for (auto &segments : haps_to_segments) {
+            total += compute_total_ibd1(
+                *merge_four_segment_vectors(segments[0], segments[1], segments[2], segments[3]), 1);
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * haps_to_segments.size());
+}
+BENCHMARK(BM_merge_and_compute_total_ibd1)->Arg(0)->Arg(50);
+
+
+static void
+BM_process_segment(benchmark::State &state)
+{
+    init_synthetic_maps();
+    const struct synthetic_chromosome &chromosome = get_synthetic_chromosome(state.range(0));
+    std::vector<struct line_info> segments = chromosome.segments;
+    StageTimer timer(false);
+
+    for (auto _ : state) {
+        struct chromosome_state chromosome_state;
+        std::unordered_map<int, std::unordered_map<int, struct pair_stats>> matrix;
+        for (struct line_info &info : segments) {
+            process_segment(info, 1, chromosome_state, matrix, timer);
+        }
+        update_total_ibd1(1, chromosome_state.prev_id, chromosome_state.id_to_haps_to_segment, matrix);
+        benchmark::DoNotOptimize(matrix);
+    }
+    state.SetItemsProcessed(state.iterations() * segments.size());
+}
+// Without full-siblings there is little IBD2 to scan. With half of the individuals
+// having one, their long maternal and paternal tracts are scanned for overlaps.
+BENCHMARK(BM_process_segment)->Arg(0)->Arg(50);
+
+
+static void
+BM_get_genetic_length(benchmark::State &state)
+{
+    init_synthetic_maps();
+
+    // Random segments on random chromosomes
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> site(0, SYNTHETIC_NUM_SITES - 1);
+    std::uniform_int_distribution<int> chromosome(1, get_num_chromosomes());
+    std::vector<std::array<int, 3>> segments(1 << 16);
+    for (auto &segment : segments) {
+        int start = site(random);
+        int end = site(random);
+        segment = {std::min(start, end), std::max(start, end), chromosome(random)};
+    }
+
+    for (auto _ : state) {
+        double total = 0;
+        for (const auto &segment : segments) {
+            total += get_genetic_length(segment[0], segment[1], segment[2]);
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * segments.size());
+}
+BENCHMARK(BM_get_genetic_length);
+
+
+static void
+BM_get_genetic_lengths(benchmark::State &state)
+{
+    init_synthetic_maps();
+
+    // Random segments on one chromosome, summed in batches as IBD1 and IBD2 are
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> site(0, SYNTHETIC_NUM_SITES - 1);
+    std::vector<int> starting_sites(1 << 16);
+    std::vector<int> ending_sites(1 << 16);
+    for (size_t i = 0; i < starting_sites.size(); ++i) {
+        int start = site(random);
+        int end = site(random);
+        starting_sites[i] = std::min(start, end);
+        ending_sites[i] = std::max(start, end);
+    }
+
+    for (auto _ : state) {
+        double total = 0;
+        for (size_t i = 0; i < starting_sites.size(); i += GENETIC_LENGTH_BATCH) {
+            total = get_genetic_lengths(&starting_sites[i], &ending_sites[i], GENETIC_LENGTH_BATCH, 1, nullptr, total);
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * starting_sites.size());
+    state.SetLabel(get_genetic_length_kernel());
+}
+BENCHMARK(BM_get_genetic_lengths);
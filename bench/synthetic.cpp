@@ -0,0 +1,239 @@
+/**
+ * This file is responsible for generating synthetic inputs for the benchmarks:
+ * genetic maps, RaPID output of one chromosome and totals of pairs.
+ *
+ * Segments follow what RaPID reports for a population sample: most pairs are
+ * distant relatives sharing one or two short segments on any haplotypes, and a
+ * fraction of individuals have a full-sibling sharing long maternal (0-0) and
+ * paternal (1-1) tracts, which overlap as IBD2.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "../mapper.hpp"
+#include "../RaPIDaffin.hpp"
+#include "synthetic.hpp"
+
+// Mean distance between two sites in cM
+#define MEAN_SITE_DISTANCE 0.0025
+// Mean number of distant relatives of an individual on one chromosome
+#define MEAN_NUM_DISTANT_RELATIVES 8
+// Shortest segment and mean extra length of a distant relative's segment, in sites
+#define MIN_DISTANT_SEGMENT 800
+#define MEAN_DISTANT_SEGMENT 1500
+// Mean length of a tract and of the gap between two tracts shared by full-siblings, in sites
+#define MEAN_SIBLING_TRACT 20000
+
+static void add_segment(
+    struct synthetic_chromosome &chromosome,
+    int id1_index, int id2_index,
+    int hap1, int hap2,
+    int starting_site, int ending_site);
+
+/**
+ * Write synthetic genetic maps of all chromosomes to a temporary directory and
+ * load them with init_maps. Only done once.
+ */
+void
+init_synthetic_maps()
+{
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+    std::string map_path = (boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("raffi-bench-%%%%-%%%%")).string() + "/";
+    boost::filesystem::create_directories(map_path);
+
+    std::mt19937 random(1);
+    std::exponential_distribution<double> site_distance(1 / MEAN_SITE_DISTANCE);
+    for (int chrom = 1; chrom <= get_num_chromosomes(); ++chrom) {
+        std::ofstream out(map_path + "chr" + get_chromosome(chrom).name + ".rMap");
+        double distance = 0;
+        for (int site = 0; site < SYNTHETIC_NUM_SITES; ++site) {
+            out << site << "\t" << distance << "\n";
+            distance += site_distance(random);
+        }
+        if (!out) {
+            throw std::runtime_error {"Failed to write synthetic map to " + map_path};
+        }
+    }
+
+    init_maps(map_path);
+    boost::filesystem::remove_all(map_path);
+}
+
+
+/**
+ * Generate the RaPID output of one chromosome.
+ *
+ * @param num_ids number of individuals.
+ * @param sibling_fraction fraction of individuals with a full-sibling, the next
+ *     individual in the ordering.
+ * @param seed seed of the generator.
+ *
+ * @return lines of RaPID output grouped by id1, and the same lines parsed.
+ */
+struct synthetic_chromosome
+generate_chromosome(int num_ids, double sibling_fraction, unsigned int seed)
+{
+    struct synthetic_chromosome chromosome;
+    for (int i = 0; i < num_ids; ++i) {
+        chromosome.ids.push_back("s" + std::to_string(i));
+    }
+
+    std::mt19937 random(seed);
+    std::poisson_distribution<int> num_distant_relatives(MEAN_NUM_DISTANT_RELATIVES);
+    std::exponential_distribution<double> distant_length(1.0 / MEAN_DISTANT_SEGMENT);
+    std::exponential_distribution<double> sibling_length(1.0 / MEAN_SIBLING_TRACT);
+    std::bernoulli_distribution has_sibling(sibling_fraction);
+    std::bernoulli_distribution has_second_segment(0.2);
+    std::uniform_int_distribution<int> hap(0, 1);
+
+    for (int id1_index = 0; id1_index + 1 < num_ids; ++id1_index) {
+        // Segments of id1, ordered by id2 and then by starting site
+        std::vector<std::pair<int, struct line_info>> segments;
+
+        if (has_sibling(random)) {
+            // Maternal and paternal tracts
+            for (int parent = 0; parent < 2; ++parent) {
+                int site = (int) sibling_length(random);
+                while (site < SYNTHETIC_NUM_SITES) {
+                    int end = std::min(site + 1 + (int) sibling_length(random), SYNTHETIC_NUM_SITES - 1);
+                    struct line_info info;
+                    info.id2_index = id1_index + 1;
+                    info.hap1 = parent;
+                    info.hap2 = parent;
+                    info.starting_site = site;
+                    info.ending_site = end;
+                    segments.push_back({info.starting_site, info});
+                    site = end + 1 + (int) sibling_length(random);
+                }
+            }
+        }
+
+        std::uniform_int_distribution<int> relative(id1_index + 1, num_ids - 1);
+        int num_relatives = num_distant_relatives(random);
+        for (int i = 0; i < num_relatives; ++i) {
+            int id2_index = relative(random);
+            int num_segments = has_second_segment(random) ? 2 : 1;
+            for (int j = 0; j < num_segments; ++j) {
+                int length = MIN_DISTANT_SEGMENT + (int) distant_length(random);
+                std::uniform_int_distribution<int> start(0, SYNTHETIC_NUM_SITES - 1 - length);
+                struct line_info info;
+                info.id2_index = id2_index;
+                info.hap1 = hap(random);
+                info.hap2 = hap(random);
+                info.starting_site = start(random);
+                info.ending_site = info.starting_site + length;
+                segments.push_back({info.starting_site, info});
+            }
+        }
+
+        std::sort(segments.begin(), segments.end(),
+            [](const std::pair<int, struct line_info> &a, const std::pair<int, struct line_info> &b) {
+                return a.second.id2_index < b.second.id2_index ||
+                    (a.second.id2_index == b.second.id2_index && a.first < b.first);
+            });
+        for (const auto &segment : segments) {
+            const struct line_info &info = segment.second;
+            add_segment(
+                chromosome, id1_index, info.id2_index,
+                info.hap1, info.hap2, info.starting_site, info.ending_site);
+        }
+    }
+
+    return chromosome;
+}
+
+
+/**
+ * Generate the totals of pairs across chromosomes as dump_range receives them,
+ * split across the matrices of several worker threads.
+ *
+ * @param num_ids number of individuals.
+ * @param num_relatives number of relatives of every individual.
+ * @param num_matrices number of matrices, one for each worker thread.
+ * @param seed seed of the generator.
+ *
+ * @return one matrix for each worker thread. Each pair appears in a random subset
+ *     of them.
+ */
+std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>>
+generate_matrices(int num_ids, int num_relatives, int num_matrices, unsigned int seed)
+{
+    std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> matrices(num_matrices);
+
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> relative(0, num_ids - 1);
+    std::uniform_int_distribution<int> matrix(0, num_matrices - 1);
+    // Mostly distant relatives sharing a few cM, some up to 3rd degree
+    std::exponential_distribution<double> distant_ibd1(1.0 / 10);
+    std::uniform_real_distribution<double> close_ibd1(100, 1500);
+    std::bernoulli_distribution is_close(0.05);
+
+    for (int id1_index = 0; id1_index < num_ids; ++id1_index) {
+        for (int i = 0; i < num_relatives; ++i) {
+            int id2_index = relative(random);
+            if (id2_index == id1_index) {
+                continue;
+            }
+            double total_ibd1 = is_close(random) ? close_ibd1(random) : distant_ibd1(random);
+
+            // Chromosomes of the pair are handled by up to three threads
+            int num_parts = 1 + relative(random) % std::min(num_matrices, 3);
+            for (int part = 0; part < num_parts; ++part) {
+                struct pair_stats &stats = matrices[matrix(random)][id1_index][id2_index];
+                stats.total_ibd1 += total_ibd1 / num_parts;
+            }
+        }
+    }
+
+    return matrices;
+}
+
+
+/**
+ * Add a segment to the RaPID output.
+ *
+ * @param chromosome the RaPID output.
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param hap1 haplotype of id1.
+ * @param hap2 haplotype of id2.
+ * @param starting_site first site of the segment.
+ * @param ending_site last site of the segment.
+ */
+static void
+add_segment(
+    struct synthetic_chromosome &chromosome,
+    int id1_index, int id2_index,
+    int hap1, int hap2,
+    int starting_site, int ending_site)
+{
+    std::ostringstream line;
+    line << 1 << "\t" << chromosome.ids[id1_index] << "\t" << chromosome.ids[id2_index] << "\t"
+        << hap1 << "\t" << hap2 << "\t"
+        << starting_site * 100 << "\t" << ending_site * 100 << "\t"
+        << (ending_site - starting_site) * MEAN_SITE_DISTANCE << "\t"
+        << starting_site << "\t" << ending_site;
+    chromosome.lines.push_back(line.str());
+
+    struct line_info info;
+    info.id1_index = id1_index;
+    info.id2_index = id2_index;
+    info.hap1 = hap1;
+    info.hap2 = hap2;
+    info.starting_site = starting_site;
+    info.ending_site = ending_site;
+    chromosome.segments.push_back(info);
+}
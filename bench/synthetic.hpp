@@ -0,0 +1,39 @@
+/**
+ * This file is responsible for generating synthetic inputs for the benchmarks:
+ * genetic maps, RaPID output of one chromosome and totals of pairs.
+ *
+ */
+
+#ifndef SYNTHETIC_HPP
+#define SYNTHETIC_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../parser_kernels.hpp"
+
+// Number of sites of every synthetic chromosome
+#define SYNTHETIC_NUM_SITES 100000
+
+// RaPID output of one synthetic chromosome
+struct synthetic_chromosome {
+    // IDs of the individuals, in the order of the VCF
+    std::vector<std::string> ids;
+    // Lines of RaPID output, grouped by id1
+    std::vector<std::string> lines;
+    // The same lines as parsed by parse_line
+    std::vector<struct line_info> segments;
+};
+
+void init_synthetic_maps();
+
+struct synthetic_chromosome generate_chromosome(int num_ids, double sibling_fraction, unsigned int seed);
+
+std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> generate_matrices(
+    int num_ids,
+    int num_relatives,
+    int num_matrices,
+    unsigned int seed);
+
+#endif
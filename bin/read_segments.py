@@ -0,0 +1,123 @@
+"""
+Read the merged IBD segments RAFFI exports with --export-segments, and print
+them as tab-separated ID1, ID2, chromosome, IBD or IBD2, first site and last
+site. Sites are rows of the genetic map of the chromosome.
+
+Usage:
+    python3 read_segments.py {output directory}/segments.bin [--pair {ID1} {ID2}]
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"RAFFISG1"
+INDEX_ENTRY = struct.Struct("<iiQ")
+
+
+class SegmentFile:
+    """
+    Random access to the pairs of segments.bin through its index.
+    """
+
+    def __init__(self, path):
+        self.file = open(path, "rb")
+        data = self.file
+
+        if data.read(len(MAGIC)) != MAGIC:
+            raise ValueError("Not an exported segment file: " + path)
+        self.ids = self._read_strings()
+        self.chromosomes = self._read_strings()
+        self.index_of_id = {id: index for index, id in enumerate(self.ids)}
+
+        data.seek(-(16 + len(MAGIC)), 2)
+        index_offset, num_pairs = struct.unpack("<QQ", data.read(16))
+        if data.read(len(MAGIC)) != MAGIC:
+            raise ValueError("Truncated exported segment file: " + path)
+        data.seek(index_offset)
+        raw = data.read(num_pairs * INDEX_ENTRY.size)
+        self.index = {}
+        for id1, id2, offset in INDEX_ENTRY.iter_unpack(raw):
+            self.index[(id1, id2)] = offset
+
+    def _read_strings(self):
+        count, = struct.unpack("<i", self.file.read(4))
+        strings = []
+        for _ in range(count):
+            length, = struct.unpack("<i", self.file.read(4))
+            strings.append(self.file.read(length).decode())
+        return strings
+
+    def _read_varint(self):
+        value = 0
+        shift = 0
+        while True:
+            byte = self.file.read(1)[0]
+            value |= (byte & 0x7F) << shift
+            if not byte & 0x80:
+                return value
+            shift += 7
+
+    def _read_intervals(self):
+        intervals = []
+        prev_end = 0
+        for _ in range(self._read_varint()):
+            start = prev_end + self._read_varint()
+            end = start + self._read_varint()
+            intervals.append((start, end))
+            prev_end = end
+        return intervals
+
+    def pairs(self):
+        """
+        Indices of the exported pairs, sorted.
+        """
+        return sorted(self.index)
+
+    def segments(self, id1, id2):
+        """
+        Segments of a pair as a list of (chromosome, IBD intervals, IBD2 intervals),
+        or None if the pair was not exported. The pair is given by indices.
+        """
+        offset = self.index.get((id1, id2))
+        if offset is None:
+            return None
+        self.file.seek(offset)
+        result = []
+        for _ in range(self._read_varint()):
+            chromosome = self.chromosomes[self._read_varint() - 1]
+            ibd = self._read_intervals()
+            ibd2 = self._read_intervals()
+            result.append((chromosome, ibd, ibd2))
+        return result
+
+
+def print_pair(segment_file, id1, id2, out):
+    for chromosome, ibd, ibd2 in segment_file.segments(id1, id2):
+        for kind, intervals in (("IBD", ibd), ("IBD2", ibd2)):
+            for start, end in intervals:
+                out.write("%s\t%s\t%s\t%s\t%d\t%d\n" % (
+                    segment_file.ids[id1], segment_file.ids[id2], chromosome, kind, start, end))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("path", help="segments.bin written by RAFFI")
+    parser.add_argument("--pair", nargs=2, metavar=("ID1", "ID2"), help="only print this pair, in either order")
+    args = parser.parse_args()
+
+    segment_file = SegmentFile(args.path)
+    if args.pair:
+        id1, id2 = (segment_file.index_of_id.get(id) for id in args.pair)
+        if (id1, id2) not in segment_file.index:
+            id1, id2 = id2, id1
+        if (id1, id2) not in segment_file.index:
+            sys.exit("Pair was not exported")
+        print_pair(segment_file, id1, id2, sys.stdout)
+    else:
+        for id1, id2 in segment_file.pairs():
+            print_pair(segment_file, id1, id2, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,166 @@
+"""
+Run RAFFI end to end on a cohort written by tools/simulate_cohort at several
+numbers of threads, and report throughput, scaling efficiency, peak RSS and
+accuracy against the planted relationships.
+
+Usage:
+    python3 scaling_harness.py --raffi ../Debug/RAFFI_v.0.1 --data {cohort} \
+        --threads 1,2,4,8 [--output {directory}] [--repeat 1] [-- {extra RAFFI options}]
+"""
+
+import argparse
+import gzip
+import json
+import os
+import subprocess
+import sys
+import time
+
+# Degree of every type of relationship
+DEGREES = {"MZ": 0, "PO": 1, "FS": 1, "2nd": 2, "3rd": 3, "4th": 4}
+
+
+def run_raffi(raffi, data, threads, output, extra):
+    """
+    Run RAFFI once on the RaPID output of the cohort.
+
+    Returns wall-clock seconds, peak RSS in MB and the metrics RAFFI reported.
+    """
+    os.makedirs(output, exist_ok=True)
+    metrics_path = os.path.join(output, "metrics.json")
+    command = [
+        raffi,
+        "-i", os.path.join(data, "vcf"), "-v", "chr",
+        "-g", os.path.join(data, "maps"),
+        "-O", os.path.join(data, "rapid"),
+        "-t", str(threads),
+        "-o", output,
+        "--metrics", metrics_path,
+    ] + extra
+
+    start = time.monotonic()
+    with open(os.path.join(output, "raffi.log"), "w") as log:
+        process = subprocess.Popen(command, stdout=log, stderr=subprocess.STDOUT)
+        _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.monotonic() - start
+    if status != 0:
+        sys.exit("RAFFI failed with -t %d, see %s" % (threads, os.path.join(output, "raffi.log")))
+
+    with open(metrics_path) as f:
+        metrics = json.load(f)
+    # ru_maxrss is in kB on Linux
+    return elapsed, usage.ru_maxrss / 1024, metrics
+
+
+def read_pairs(path, id_column1, id_column2, type_column):
+    """
+    Read pairs with their types from predictions or truth. The IDs of a pair are
+    put in a canonical order.
+    """
+    opener = gzip.open if path.endswith(".gz") else open
+    pairs = {}
+    with opener(path, "rt") as f:
+        next(f)
+        for line in f:
+            fields = line.split()
+            pair = tuple(sorted((fields[id_column1], fields[id_column2])))
+            pairs[pair] = fields[type_column]
+    return pairs
+
+
+def score(predictions, truth):
+    """
+    Compare predictions with the planted relationships.
+
+    Returns the fraction of planted pairs of every type that were found with the
+    right type, the fraction within one degree, and the number of predicted pairs
+    that were not planted.
+    """
+    by_type = {}
+    for pair, expected in truth.items():
+        found = predictions.get(pair)
+        counts = by_type.setdefault(expected, {"planted": 0, "exact": 0, "within_one_degree": 0})
+        counts["planted"] += 1
+        if found == expected:
+            counts["exact"] += 1
+        if found in DEGREES and abs(DEGREES[found] - DEGREES[expected]) <= 1:
+            counts["within_one_degree"] += 1
+
+    planted = sum(c["planted"] for c in by_type.values())
+    return {
+        "by_type": by_type,
+        "exact": sum(c["exact"] for c in by_type.values()) / max(planted, 1),
+        "within_one_degree": sum(c["within_one_degree"] for c in by_type.values()) / max(planted, 1),
+        "false_positives": sum(1 for pair, found in predictions.items()
+                               if pair not in truth and found in DEGREES),
+    }
+
+
+def main():
+    arguments = sys.argv[1:]
+    extra = []
+    if "--" in arguments:
+        extra = arguments[arguments.index("--") + 1:]
+        arguments = arguments[:arguments.index("--")]
+
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--raffi", required=True, help="RAFFI executable")
+    parser.add_argument("--data", required=True, help="cohort written by simulate_cohort")
+    parser.add_argument("--threads", default="1,2,4,8", help="comma-separated numbers of threads")
+    parser.add_argument("--output", default="scaling", help="directory for outputs and the report")
+    parser.add_argument("--repeat", type=int, default=1, help="runs per number of threads, the fastest is kept")
+    options = parser.parse_args(arguments)
+
+    truth = read_pairs(os.path.join(options.data, "truth.txt"), 0, 1, 3)
+    runs = []
+    for threads in [int(t) for t in options.threads.split(",")]:
+        output = os.path.join(options.output, "t%d" % threads)
+        best = None
+        for _ in range(options.repeat):
+            result = run_raffi(options.raffi, options.data, threads, output, extra)
+            if best is None or result[0] < best[0]:
+                best = result
+        elapsed, peak_rss, metrics = best
+
+        predictions = read_pairs(os.path.join(output, "predictions.txt"), 0, 1, 6)
+        runs.append({
+            "threads": threads,
+            "seconds": elapsed,
+            "peak_rss_mb": peak_rss,
+            "individuals_per_second": metrics["individuals_processed"] / elapsed,
+            "segments_per_second": metrics["total"]["segments"] / elapsed,
+            "accuracy": score(predictions, truth),
+        })
+
+    # Speedup and efficiency relative to the first number of threads
+    base = runs[0]
+    for run in runs:
+        speedup = base["seconds"] / run["seconds"]
+        run["speedup"] = speedup
+        run["efficiency"] = speedup * base["threads"] / run["threads"]
+
+    print("%7s %9s %8s %7s %10s %12s %14s %7s %9s %5s" % (
+        "threads", "seconds", "speedup", "effic.", "RSS (MB)", "ids/s", "segments/s",
+        "exact", "within 1", "FP"))
+    for run in runs:
+        accuracy = run["accuracy"]
+        print("%7d %9.2f %8.2f %7.2f %10.1f %12.0f %14.0f %7.3f %9.3f %5d" % (
+            run["threads"], run["seconds"], run["speedup"], run["efficiency"], run["peak_rss_mb"],
+            run["individuals_per_second"], run["segments_per_second"],
+            accuracy["exact"], accuracy["within_one_degree"], accuracy["false_positives"]))
+
+    print()
+    print("%-5s %8s %8s %9s" % ("type", "planted", "exact", "within 1"))
+    for expected, counts in sorted(runs[-1]["accuracy"]["by_type"].items(), key=lambda t: DEGREES[t[0]]):
+        print("%-5s %8d %8.3f %9.3f" % (
+            expected, counts["planted"], counts["exact"] / counts["planted"],
+            counts["within_one_degree"] / counts["planted"]))
+
+    report_path = os.path.join(options.output, "scaling.json")
+    with open(report_path, "w") as f:
+        json.dump(runs, f, indent=2)
+    print("\nReport written to " + report_path)
+
+
+if __name__ == "__main__":
+    main()
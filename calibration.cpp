@@ -0,0 +1,238 @@
+/**
+ * This file is responsible for calibrating the inference boundaries on a sample
+ * of the RaPID output before it is parsed in full.
+ *
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <future>
+#include <unordered_map>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+#include "calibration.hpp"
+#include "mapper.hpp"
+#include "parser.hpp"
+#include "parser_kernels.hpp"
+#include "pair_store.hpp"
+#include "segment_export.hpp"
+#include "classifier.hpp"
+
+static std::vector<int> get_calibration_chromosomes();
+template <typename Source>
+static void parse_chromosome_prefix(
+    std::string &rapid_output_path,
+    Ordering &order,
+    int chrom,
+    const std::pair<int, int> &id1_range,
+    double min_segment_length,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix);
+
+
+/**
+ * Find full siblings among a sample of the individuals and adjust the inference
+ * boundaries to them, so that pairs can be classified as soon as they are dumped.
+ *
+ * The segments of the first num_ids individuals, as id1, are read from the
+ * CALIBRATION_NUM_CHROMOSOMES longest analysed chromosomes. Lines are sorted by
+ * id1, so only the start of each RaPID output is decompressed. Full siblings are
+ * recognized as they are in dump_pair, with the IBD of each pair scaled to the
+ * sampled length, and are recorded in VCF order with add_calibrated_full_sibling.
+ * The boundaries are shifted if MIN_NUM_FS pairs of full siblings are found.
+ * Otherwise the pairs found still count towards MIN_NUM_FS during the main pass.
+ * Either way, the main pass replaces the sampled kinship of these pairs with the
+ * genome-wide one as they are written.
+ *
+ * Genetic maps must have been initialized.
+ *
+ * @param rapid_output_path folder that stores the outputs of RaPID.
+ * @param format format of the IBD segments in rapid_output_path.
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param num_ids number of individuals whose segments are read.
+ * @param min_segment_length segments shorter than this in cM are dropped, as
+ *     they are in the main pass.
+ *
+ * @return number of pairs of full siblings found.
+ */
+int
+calibrate(
+    std::string &rapid_output_path,
+    SegmentFormat format,
+    Ordering &order,
+    int num_ids,
+    double min_segment_length)
+{
+    std::vector<int> sampled = get_calibration_chromosomes();
+    std::pair<int, int> id1_range {0, std::min(num_ids, order.size())};
+
+    auto parse = parse_chromosome_prefix<RapidSource>;
+    if (format == SegmentFormat::HAP_IBD) {
+        parse = parse_chromosome_prefix<HapIbdSource>;
+    } else if (format == SegmentFormat::ILASH) {
+        parse = parse_chromosome_prefix<IlashSource>;
+    }
+
+    // One chromosome per thread
+    std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> matrices(sampled.size());
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < sampled.size(); ++i) {
+        futures.push_back(std::async(
+            std::launch::async,
+            parse,
+            std::ref(rapid_output_path),
+            std::ref(order),
+            sampled[i],
+            std::cref(id1_range),
+            min_segment_length,
+            std::ref(matrices[i])
+        ));
+    }
+    for (std::future<void> &f : futures) {
+        f.get();
+    }
+
+    // Kinship is estimated from the sampled length only
+    double total_length = TOTAL_LENGTH;
+    TOTAL_LENGTH = 0;
+    for (int chrom : sampled) {
+        const struct chromosome_region &region = get_chromosome(chrom);
+        TOTAL_LENGTH += get_genetic_length(region.starting_site, region.ending_site, chrom);
+    }
+
+    // Combine the chromosomes the same way dump_range does
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &totals = matrices[0];
+    for (size_t i = 1; i < matrices.size(); ++i) {
+        for (const auto &id1_to_stats : matrices[i]) {
+            for (const auto &id2_to_stats : id1_to_stats.second) {
+                struct pair_stats &stats = totals[id1_to_stats.first][id2_to_stats.first];
+                stats.total_ibd1 += id2_to_stats.second.total_ibd1;
+                stats.total_ibd2 += id2_to_stats.second.total_ibd2;
+            }
+        }
+        matrices[i].clear();
+    }
+
+    // Pairs and their kinship coefficients
+    std::vector<std::pair<std::pair<int, int>, double>> full_siblings;
+    for (const auto &id1_to_stats : totals) {
+        for (const auto &id2_to_stats : id1_to_stats.second) {
+            double total_ibd2 = id2_to_stats.second.total_ibd2;
+            double total_ibd1 = id2_to_stats.second.total_ibd1 - total_ibd2;
+            if (compute_probability_ibd2(total_ibd2) >= FS_START) {
+                full_siblings.push_back({
+                    {id1_to_stats.first, id2_to_stats.first},
+                    compute_kinship_coefficient(total_ibd1, total_ibd2)
+                });
+            }
+        }
+    }
+
+    TOTAL_LENGTH = total_length;
+
+    // Recorded in VCF order, as the main pass writes individuals, so that the
+    // first pairs are kept when there are more than MAX_NUM_FS
+    std::sort(full_siblings.begin(), full_siblings.end());
+    for (const auto &full_sibling : full_siblings) {
+        add_calibrated_full_sibling(full_sibling.first.first, full_sibling.first.second, full_sibling.second);
+    }
+    set_num_calibrated_ids(id1_range.second);
+    int num_full_siblings = full_siblings.size();
+
+    std::cout << "Calibration found " << num_full_siblings << " pairs of full siblings among "
+        << id1_range.second << " individuals on " << sampled.size() << " chromosomes" << std::endl;
+    if (get_num_full_siblings() >= MIN_NUM_FS) {
+        shift_boundary();
+    } else {
+        std::cout << "Fewer than " << MIN_NUM_FS << " pairs of full siblings. "
+            << "Candidate pairs are inferred after parsing." << std::endl;
+    }
+
+    return num_full_siblings;
+}
+
+
+/**
+ * @return numbers of the CALIBRATION_NUM_CHROMOSOMES analysed chromosomes with
+ *     the longest analysed regions.
+ */
+static std::vector<int>
+get_calibration_chromosomes()
+{
+    std::vector<std::pair<double, int>> lengths;
+    for (int chrom = 1; chrom <= get_num_chromosomes(); ++chrom) {
+        const struct chromosome_region &region = get_chromosome(chrom);
+        lengths.emplace_back(get_genetic_length(region.starting_site, region.ending_site, chrom), chrom);
+    }
+    std::sort(lengths.rbegin(), lengths.rend());
+
+    std::vector<int> sampled;
+    for (size_t i = 0; i < lengths.size() && i < CALIBRATION_NUM_CHROMOSOMES; ++i) {
+        sampled.push_back(lengths[i].second);
+    }
+    return sampled;
+}
+
+
+/**
+ * Parse the IBD segments of one chromosome until the segments of individuals in
+ * id1_range have been exausted.
+ *
+ * @param rapid_output_path folder that stores the outputs of RaPID.
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param chrom chromosome number.
+ * @param id1_range half-open range of indices of id1 to parse.
+ * @param min_segment_length segments shorter than this in cM are dropped.
+ * @param matrix a 2D unordered map where M[i][j] is a struct pair_stats that
+ *     records the total IBD1 and IBD2 between individual with index i and
+ *     individual with index j on this chromosome.
+ */
+template <typename Source>
+static void
+parse_chromosome_prefix(
+    std::string &rapid_output_path,
+    Ordering &order,
+    int chrom,
+    const std::pair<int, int> &id1_range,
+    double min_segment_length,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix)
+{
+    std::string file_path = get_segment_file(Source::format, rapid_output_path, get_chromosome(chrom).name);
+    std::ifstream file(file_path, std::ios_base::in | std::ios_base::binary);
+    if (!file) {
+        throw std::runtime_error {"Failed to open IBD segments " + file_path};
+    }
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> buffer;
+    buffer.push(boost::iostreams::gzip_decompressor());
+    buffer.push(file);
+    std::istream in(&buffer);
+
+    struct chromosome_state state;
+    StageTimer timer(false);
+    std::string line;
+    while (std::getline(in, line)) {
+        struct line_info info;
+        if (!Source::parse(line, info, order, id1_range, chrom)) {
+            if (info.id1_index >= id1_range.second) {
+                // Lines are sorted by id1. The remaining lines are not sampled.
+                break;
+            }
+            continue;
+        }
+        if (info.id1_index == info.id2_index ||
+            !clip_to_region(chrom, info.starting_site, info.ending_site) ||
+            (min_segment_length > 0 &&
+             get_genetic_length(info.starting_site, info.ending_site, chrom) < min_segment_length)) {
+            continue;
+        }
+        process_segment(info, chrom, state, matrix, timer);
+    }
+
+    // Segments of the last individual
+    update_total_ibd1(chrom, state.prev_id, state.id_to_haps_to_segment, matrix);
+}
@@ -0,0 +1,25 @@
+/**
+ * This file is responsible for calibrating the inference boundaries on a sample
+ * of the RaPID output before it is parsed in full.
+ *
+ */
+
+#ifndef CALIBRATION_HPP
+#define CALIBRATION_HPP
+
+#include <string>
+
+#include "ordering.hpp"
+#include "segment_source.hpp"
+
+// Number of chromosomes, the longest analysed ones, the calibration pre-pass reads
+#define CALIBRATION_NUM_CHROMOSOMES 3
+
+int calibrate(
+    std::string &rapid_output_path,
+    SegmentFormat format,
+    Ordering &order,
+    int num_ids,
+    double min_segment_length);
+
+#endif
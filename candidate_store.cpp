@@ -0,0 +1,297 @@
+/**
+ * This file is responsible for the temporary output of candidate pairs that
+ * cannot be inferred until enough full-siblings have been recorded.
+ *
+ * Unless the codec is NONE, the file is a sequence of gzip members written by a
+ * GzipMemberWriter, so that it can be synced at a checkpoint. Candidates are
+ * collected into batches of CANDIDATE_BATCH_SIZE bytes before they are
+ * compressed and written.
+ *
+ * With a memory budget, a new store keeps candidates in memory and creates the
+ * file only once they outgrow the budget or have to be on disk (a kept shard).
+ * A checkpoint saves candidates kept in memory itself. Candidates that never
+ * left memory are read back directly.
+ *
+ */
+
+#include <cstdio>
+#include <stdexcept>
+
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/filesystem.hpp>
+
+#include "candidate_store.hpp"
+
+// Bytes of candidates collected before they are written
+#define CANDIDATE_BATCH_SIZE (4 << 20)
+
+/**
+ * @param name name of a codec: none, fast or gzip.
+ * @param codec filled with the codec.
+ *
+ * @return whether name is a known codec.
+ */
+bool
+parse_candidate_codec(const std::string &name, CandidateCodec &codec)
+{
+    if (name == "none") {
+        codec = CandidateCodec::NONE;
+    } else if (name == "fast") {
+        codec = CandidateCodec::FAST;
+    } else if (name == "gzip") {
+        codec = CandidateCodec::GZIP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Constructor of CandidateStore.
+ *
+ * @param path path of the temporary file.
+ * @param codec how the temporary file is compressed.
+ * @param memory_budget bytes of candidates kept in memory before the file is
+ *     created. 0 always writes to the file.
+ */
+CandidateStore::CandidateStore(const std::string &path, CandidateCodec codec, uint64_t memory_budget) :
+    path(path),
+    codec(codec),
+    memory_budget(memory_budget),
+    on_disk(true),
+    writer(path, codec != CandidateCodec::NONE,
+        codec == CandidateCodec::FAST ? boost::iostreams::gzip::best_speed : boost::iostreams::gzip::default_compression) {}
+
+
+/**
+ * @return path of the temporary file.
+ */
+const std::string&
+CandidateStore::get_path()
+{
+    return path;
+}
+
+
+/**
+ * @return bytes of candidates held in memory.
+ */
+uint64_t
+CandidateStore::get_memory_size()
+{
+    return batch.capacity();
+}
+
+
+/**
+ * @return bytes of the temporary file, 0 if it has not been created. Candidates
+ *     still in the compressor are not counted.
+ */
+uint64_t
+CandidateStore::get_disk_size()
+{
+    if (!on_disk) {
+        return 0;
+    }
+    boost::system::error_code error;
+    uint64_t size = boost::filesystem::file_size(path, error);
+    return error ? 0 : size;
+}
+
+
+/**
+ * Open the temporary file for writing. Anything after offset is discarded.
+ *
+ * @param offset size of the file to keep. 0 starts a new file, which is kept in
+ *     memory for as long as it fits the memory budget.
+ */
+void
+CandidateStore::open(uint64_t offset)
+{
+    if (offset == 0 && memory_budget > 0) {
+        on_disk = false;
+        return;
+    }
+
+    on_disk = true;
+    writer.open(offset);
+}
+
+
+/**
+ * Start a new store from candidates kept in memory at a checkpoint. They are
+ * moved to the file if they do not fit the memory budget.
+ *
+ * @param candidates candidates returned by CandidateStore::get_candidates.
+ */
+void
+CandidateStore::open(std::vector<char> &&candidates)
+{
+    open(0);
+    if (on_disk) {
+        write(candidates.data(), candidates.size());
+        return;
+    }
+
+    batch = std::move(candidates);
+    if (batch.size() > memory_budget) {
+        spill();
+    }
+}
+
+
+/**
+ * Add candidates to the current batch. The batch is written once it is full.
+ *
+ * @param data
+ * @param length
+ */
+void
+CandidateStore::write(const char *data, size_t length)
+{
+    batch.insert(batch.end(), data, data + length);
+    if (!on_disk) {
+        if (batch.size() > memory_budget) {
+            spill();
+        }
+    } else if (batch.size() >= CANDIDATE_BATCH_SIZE) {
+        write_batch();
+    }
+}
+
+
+/**
+ * Close the current gzip member so that everything written so far is on disk,
+ * and start a new one. Without compression, only the batch is written out.
+ * Candidates kept in memory stay there, to be saved with the checkpoint.
+ *
+ * @return size of the file, 0 if candidates are kept in memory.
+ */
+uint64_t
+CandidateStore::sync()
+{
+    if (!on_disk) {
+        return 0;
+    }
+    write_batch();
+    return writer.sync();
+}
+
+
+/**
+ * Finish writing. The file is kept.
+ */
+void
+CandidateStore::close()
+{
+    spill();
+    close_file();
+}
+
+
+/**
+ * @return whether all candidates are still kept in memory, so that they are read
+ *     with CandidateStore::get_candidates instead of CandidateStore::input.
+ */
+bool
+CandidateStore::is_in_memory()
+{
+    return !on_disk;
+}
+
+
+/**
+ * @return candidates kept in memory, as written.
+ */
+const std::vector<char>&
+CandidateStore::get_candidates()
+{
+    return batch;
+}
+
+
+/**
+ * Finish writing and open the temporary file for reading. Candidates kept in
+ * memory are not read through it.
+ *
+ * @return stream that candidate pairs are read from.
+ */
+std::istream&
+CandidateStore::input()
+{
+    if (!on_disk) {
+        throw std::runtime_error {"Candidates are kept in memory"};
+    }
+    close_file();
+
+    file_in = std::make_unique<std::ifstream>(path, std::ios_base::in | std::ios_base::binary);
+    buffer_in = std::make_unique<boost::iostreams::filtering_streambuf<boost::iostreams::input>>();
+    if (codec != CandidateCodec::NONE) {
+        buffer_in->push(boost::iostreams::gzip_decompressor());
+    }
+    buffer_in->push(*file_in);
+    in = std::make_unique<std::istream>(buffer_in.get());
+
+    return *in;
+}
+
+
+/**
+ * Close and remove the temporary file, or release the candidates kept in memory.
+ */
+void
+CandidateStore::remove()
+{
+    close_file();
+    in.reset();
+    buffer_in.reset();
+    file_in.reset();
+    std::vector<char>().swap(batch);
+
+    if (on_disk && std::remove(path.c_str())) {
+        throw std::runtime_error {"Failed to remove temporary file"};
+    }
+}
+
+
+/**
+ * Move candidates kept in memory to a new temporary file. No-op if the file has
+ * been created already.
+ */
+void
+CandidateStore::spill()
+{
+    if (on_disk) {
+        return;
+    }
+
+    on_disk = true;
+    writer.open(0);
+    write_batch();
+    std::vector<char>().swap(batch);
+}
+
+
+void
+CandidateStore::close_file()
+{
+    if (!writer.is_open()) {
+        return;
+    }
+    write_batch();
+    writer.close();
+}
+
+
+void
+CandidateStore::write_batch()
+{
+    if (batch.empty()) {
+        return;
+    }
+    if (!writer.stream().write(batch.data(), batch.size())) {
+        throw std::runtime_error {"Failed to write to temporary file"};
+    }
+    batch.clear();
+}
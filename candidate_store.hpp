@@ -0,0 +1,80 @@
+/**
+ * This file is responsible for the temporary output of candidate pairs that
+ * cannot be inferred until enough full-siblings have been recorded.
+ *
+ */
+
+#ifndef CANDIDATE_STORE_HPP
+#define CANDIDATE_STORE_HPP
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+
+#include "gzip_member_writer.hpp"
+
+enum class CandidateCodec {
+    // Written as is
+    NONE,
+    // Gzip members at the fastest compression level
+    FAST,
+    // Gzip members at the default compression level
+    GZIP
+};
+
+bool parse_candidate_codec(const std::string &name, CandidateCodec &codec);
+
+class CandidateStore {
+public:
+    CandidateStore(
+        const std::string &path,
+        CandidateCodec codec = CandidateCodec::GZIP,
+        uint64_t memory_budget = 0);
+
+    const std::string &get_path();
+
+    uint64_t get_memory_size();
+
+    uint64_t get_disk_size();
+
+    void open(uint64_t offset);
+
+    void open(std::vector<char> &&candidates);
+
+    void write(const char *data, size_t length);
+
+    uint64_t sync();
+
+    void close();
+
+    bool is_in_memory();
+
+    const std::vector<char> &get_candidates();
+
+    std::istream &input();
+
+    void remove();
+
+private:
+    std::string path;
+    CandidateCodec codec;
+    uint64_t memory_budget;
+    // Whether the temporary file has been created
+    bool on_disk;
+    // Candidates not yet handed to the compressor, or all candidates if not on_disk
+    std::vector<char> batch;
+    GzipMemberWriter writer;
+    std::unique_ptr<std::ifstream> file_in;
+    std::unique_ptr<boost::iostreams::filtering_streambuf<boost::iostreams::input>> buffer_in;
+    std::unique_ptr<std::istream> in;
+
+    void close_file();
+    void write_batch();
+    void spill();
+};
+
+#endif
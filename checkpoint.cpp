@@ -0,0 +1,283 @@
+/**
+ * This file is responsible for saving and restoring the state of a run at a
+ * synchronization point so that it can be resumed after being killed.
+ *
+ * A checkpoint contains the candidates kept in memory, the full-sibling
+ * calibration state, including the pairs of the calibration pre-pass that have
+ * not been written yet, the Dumpable
+ * watermarks, the offset, pair store size and in-flight segments of each
+ * chromosome, and every pair that has not been written yet. It is written to a
+ * separate file which then replaces the previous checkpoint, so a run killed
+ * while checkpointing can still resume from the previous one.
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "checkpoint.hpp"
+#include "classifier.hpp"
+#include "mapper.hpp"
+
+#define CHECKPOINT_MAGIC "RAFFICK8"
+#define CHECKPOINT_MAGIC_LENGTH 8
+
+template<typename T>
+static inline void
+write_value(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+static inline T
+read_value(std::istream &in)
+{
+    T value;
+    if (!in.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+        throw std::runtime_error {"Truncated checkpoint"};
+    }
+    return value;
+}
+
+static inline void
+write_string(std::ostream &out, const std::string &value)
+{
+    write_value<uint64_t>(out, value.size());
+    out.write(value.data(), value.size());
+}
+
+static inline std::string
+read_string(std::istream &in)
+{
+    std::string value(read_value<uint64_t>(in), '\0');
+    if (!in.read(&value[0], value.size())) {
+        throw std::runtime_error {"Truncated checkpoint"};
+    }
+    return value;
+}
+
+
+/**
+ * Save the state of a run. Must be called while all worker threads are blocked.
+ *
+ * @param path path of the checkpoint.
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param progress progress of the master thread.
+ * @param candidates temporary output. Candidates kept in memory are saved.
+ * @param dumpable a Dumpable that determines ranges of indices of individuals
+ *     that can be written to output.
+ * @param chromosomes parsing progress of every chromosome.
+ * @param matrices pairs that have not been written yet, one matrix per thread.
+ */
+void
+save_checkpoint(
+    const std::string &path,
+    Ordering &order,
+    const struct checkpoint_progress &progress,
+    CandidateStore &candidates,
+    Dumpable &dumpable,
+    const std::vector<struct chromosome_state> &chromosomes,
+    const std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> &matrices)
+{
+    std::string temp_path = path + ".partial";
+    {
+        std::ofstream out(temp_path, std::ios::out | std::ios::trunc | std::ios::binary);
+        out.write(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH);
+        write_value<int>(out, order.size());
+        write_value<int>(out, get_num_chromosomes());
+        for (int chrom = 1; chrom <= get_num_chromosomes(); ++chrom) {
+            const struct chromosome_region &region = get_chromosome(chrom);
+            write_string(out, region.name);
+            write_value(out, region.starting_site);
+            write_value(out, region.ending_site);
+        }
+        write_value(out, progress.max_degree);
+        write_value(out, progress.min_segment_length);
+        write_value(out, progress.num_calibrated_ids);
+        write_value(out, progress.num_processed);
+        write_value(out, progress.num_dumped);
+        write_string(out, progress.temp_path);
+        write_value(out, progress.temp_codec);
+        write_value(out, progress.temp_offset);
+        write_value<char>(out, progress.temp_in_memory);
+        if (progress.temp_in_memory) {
+            const std::vector<char> &batch = candidates.get_candidates();
+            write_value<uint64_t>(out, batch.size());
+            out.write(batch.data(), batch.size());
+        }
+        write_value(out, progress.output_offset);
+        write_value(out, progress.totals_offset);
+        write_value(out, get_classifier_state());
+        write_value<uint64_t>(out, get_calibrated_full_siblings().size());
+        for (const auto &full_sibling : get_calibrated_full_siblings()) {
+            write_value(out, full_sibling.first.first);
+            write_value(out, full_sibling.first.second);
+            write_value(out, full_sibling.second);
+        }
+
+        write_value<int>(out, dumpable.get_previous_last_dumpable_index());
+        for (int index : dumpable.get_last_dumpable_indices()) {
+            write_value(out, index);
+        }
+
+        for (const struct chromosome_state &state : chromosomes) {
+            write_value(out, state.offset);
+            write_value(out, state.store_offset);
+            write_value(out, state.prev_id);
+            write_value<char>(out, state.finished);
+            write_value<uint64_t>(out, state.id_to_haps_to_segment.size());
+            for (const auto &id2_to_haps : state.id_to_haps_to_segment) {
+                write_value(out, id2_to_haps.first);
+                write_value<uint64_t>(out, id2_to_haps.second.size());
+                for (const auto &haps_to_segments : id2_to_haps.second) {
+                    write_value(out, haps_to_segments.first);
+                    write_value<uint64_t>(out, haps_to_segments.second.size());
+                    for (const auto &segment : haps_to_segments.second) {
+                        write_value(out, segment.first);
+                        write_value(out, segment.second);
+                    }
+                }
+            }
+        }
+
+        uint64_t num_pairs = 0;
+        for (const auto &matrix : matrices) {
+            for (const auto &id1_to_stats : matrix) {
+                num_pairs += id1_to_stats.second.size();
+            }
+        }
+        write_value(out, num_pairs);
+        for (const auto &matrix : matrices) {
+            for (const auto &id1_to_stats : matrix) {
+                for (const auto &id2_to_stats : id1_to_stats.second) {
+                    write_value(out, id1_to_stats.first);
+                    write_value(out, id2_to_stats.first);
+                    write_value(out, id2_to_stats.second);
+                }
+            }
+        }
+
+        out.flush();
+        if (!out) {
+            throw std::runtime_error {"Failed to write checkpoint"};
+        }
+    }
+
+    if (std::rename(temp_path.c_str(), path.c_str())) {
+        throw std::runtime_error {"Failed to replace checkpoint"};
+    }
+}
+
+
+/**
+ * Restore the state of a run saved by save_checkpoint.
+ *
+ * @param path path of the checkpoint.
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param progress progress of the master thread to be filled.
+ * @param candidates filled with the candidates kept in memory, if
+ *     progress.temp_in_memory.
+ * @param dumpable a Dumpable to be restored.
+ * @param chromosomes parsing progress of every chromosome to be restored.
+ *     Input streams are not opened.
+ * @param matrix receives all pairs that have not been written yet. Pairs saved
+ *     from different threads are summed, which dump_range does anyway.
+ */
+void
+load_checkpoint(
+    const std::string &path,
+    Ordering &order,
+    struct checkpoint_progress &progress,
+    std::vector<char> &candidates,
+    Dumpable &dumpable,
+    std::vector<struct chromosome_state> &chromosomes,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix)
+{
+    std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+    if (!in) {
+        throw std::runtime_error {"Failed to open checkpoint " + path};
+    }
+
+    char magic[CHECKPOINT_MAGIC_LENGTH];
+    if (!in.read(magic, CHECKPOINT_MAGIC_LENGTH) || std::memcmp(magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH)) {
+        throw std::runtime_error {"Not a checkpoint: " + path};
+    }
+    if (read_value<int>(in) != order.size() || read_value<int>(in) != get_num_chromosomes()) {
+        throw std::runtime_error {"Checkpoint was taken on different input"};
+    }
+    for (int chrom = 1; chrom <= get_num_chromosomes(); ++chrom) {
+        const struct chromosome_region &region = get_chromosome(chrom);
+        if (read_string(in) != region.name || read_value<int>(in) != region.starting_site ||
+            read_value<int>(in) != region.ending_site) {
+            throw std::runtime_error {"Checkpoint was taken on different chromosomes"};
+        }
+    }
+    progress.max_degree = read_value<int>(in);
+    progress.min_segment_length = read_value<double>(in);
+    progress.num_calibrated_ids = read_value<int>(in);
+    progress.num_processed = read_value<int>(in);
+    progress.num_dumped = read_value<uint64_t>(in);
+    progress.temp_path = read_string(in);
+    progress.temp_codec = read_value<CandidateCodec>(in);
+    progress.temp_offset = read_value<uint64_t>(in);
+    progress.temp_in_memory = read_value<char>(in);
+    if (progress.temp_in_memory) {
+        candidates.resize(read_value<uint64_t>(in));
+        if (!in.read(candidates.data(), candidates.size())) {
+            throw std::runtime_error {"Truncated checkpoint"};
+        }
+    }
+    progress.output_offset = read_value<uint64_t>(in);
+    progress.totals_offset = read_value<uint64_t>(in);
+    set_classifier_state(read_value<struct classifier_state>(in));
+    calibrated_full_siblings full_siblings;
+    uint64_t num_full_siblings = read_value<uint64_t>(in);
+    for (uint64_t i = 0; i < num_full_siblings; ++i) {
+        int id1_index = read_value<int>(in);
+        int id2_index = read_value<int>(in);
+        full_siblings[{id1_index, id2_index}] = read_value<double>(in);
+    }
+    set_calibrated_full_siblings(full_siblings);
+
+    int previous_index = read_value<int>(in);
+    std::vector<int> indices(get_num_chromosomes());
+    for (int &index : indices) {
+        index = read_value<int>(in);
+    }
+    dumpable.restore(previous_index, indices);
+
+    for (struct chromosome_state &state : chromosomes) {
+        state.offset = read_value<uint64_t>(in);
+        state.store_offset = read_value<uint64_t>(in);
+        state.prev_id = read_value<int>(in);
+        state.finished = read_value<char>(in);
+        uint64_t num_id2 = read_value<uint64_t>(in);
+        for (uint64_t i = 0; i < num_id2; ++i) {
+            std::unordered_map<int, std::vector<std::pair<int, int>>> &haps_to_segments = state.id_to_haps_to_segment[read_value<int>(in)];
+            uint64_t num_haps = read_value<uint64_t>(in);
+            for (uint64_t j = 0; j < num_haps; ++j) {
+                std::vector<std::pair<int, int>> &segments = haps_to_segments[read_value<int>(in)];
+                uint64_t num_segments = read_value<uint64_t>(in);
+                segments.reserve(num_segments);
+                for (uint64_t k = 0; k < num_segments; ++k) {
+                    int start = read_value<int>(in);
+                    int end = read_value<int>(in);
+                    segments.emplace_back(start, end);
+                }
+            }
+        }
+    }
+
+    uint64_t num_pairs = read_value<uint64_t>(in);
+    for (uint64_t i = 0; i < num_pairs; ++i) {
+        int id1_index = read_value<int>(in);
+        int id2_index = read_value<int>(in);
+        struct pair_stats sub_stats = read_value<struct pair_stats>(in);
+        struct pair_stats &stats = matrix[id1_index][id2_index];
+        stats.total_ibd1 += sub_stats.total_ibd1;
+        stats.total_ibd2 += sub_stats.total_ibd2;
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * This file is responsible for saving and restoring the state of a run at a
+ * synchronization point so that it can be resumed after being killed.
+ *
+ */
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "parser.hpp"
+#include "dumpable.hpp"
+#include "candidate_store.hpp"
+
+// Progress of the master thread at a synchronization point
+struct checkpoint_progress {
+    int max_degree = 0;
+    // Segments shorter than this in cM were dropped
+    double min_segment_length = 0;
+    // Individuals whose full-siblings the calibration pre-pass recorded
+    int num_calibrated_ids = 0;
+    // Number of individuals written so far
+    int num_processed = 0;
+    // Number of pairs written to temporary output
+    uint64_t num_dumped = 0;
+    // Path and codec of the temporary output
+    std::string temp_path;
+    CandidateCodec temp_codec = CandidateCodec::GZIP;
+    // Size of the temporary output
+    uint64_t temp_offset = 0;
+    // Whether candidates were kept in memory, and saved in the checkpoint instead
+    bool temp_in_memory = false;
+    // Size of the final output
+    uint64_t output_offset = 0;
+    // Size of the partial pair-totals sidecar
+    uint64_t totals_offset = 0;
+};
+
+void save_checkpoint(
+    const std::string &path,
+    Ordering &order,
+    const struct checkpoint_progress &progress,
+    CandidateStore &candidates,
+    Dumpable &dumpable,
+    const std::vector<struct chromosome_state> &chromosomes,
+    const std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> &matrices);
+
+void load_checkpoint(
+    const std::string &path,
+    Ordering &order,
+    struct checkpoint_progress &progress,
+    std::vector<char> &candidates,
+    Dumpable &dumpable,
+    std::vector<struct chromosome_state> &chromosomes,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix);
+
+#endif
@@ -43,6 +43,11 @@ static double FS_TOTAL_KINSHIP_COEFFICIENTS = 0;
 static int NUM_FS = 0;
 // Number of pairs of full-siblings recorded at last adjustment 
 static int PREV_ADJUSTED_NUM_FS = 0;
+// Full-siblings of the individuals with smaller indices have been recorded by
+// the calibration pre-pass
+static int NUM_CALIBRATED_IDS = 0;
+// Pairs recorded by the calibration pre-pass that have not been written yet
+static calibrated_full_siblings CALIBRATED_FS;
 
 // Mininum number of pairs of full-siblings needed to be recorded between two
 // consecutive adjustment.
@@ -77,6 +82,128 @@ add_full_sibling(const struct pair_stats &stats)
     );
 }
 
+/**
+ * Record full-sibling pairs identified elsewhere, e.g. by the shards of a sharded
+ * run. At most MAX_NUM_FS pairs of full-siblings are recorded in total; if there
+ * are more, the recorded pairs keep the mean kinship coefficient of the input.
+ * Unlike add_full_sibling, which records up to MAX_NUM_FS + 1 pairs and thereby
+ * stops shift_boundary, this leaves room for one more adjustment.
+ *
+ * @param num_full_siblings number of pairs of full-siblings.
+ * @param total_kinship_coefficients sum of their kinship coefficients.
+ */
+void
+add_full_siblings(int num_full_siblings, double total_kinship_coefficients)
+{
+    int num_recorded = std::min(num_full_siblings, MAX_NUM_FS - NUM_FS);
+    if (num_recorded <= 0) {
+        return;
+    }
+
+    NUM_FS += num_recorded;
+    FS_TOTAL_KINSHIP_COEFFICIENTS += total_kinship_coefficients / num_full_siblings * num_recorded;
+}
+
+/**
+ * Record a full-sibling pair found by the calibration pre-pass, with its kinship
+ * coefficient on the sampled chromosomes. At most MAX_NUM_FS pairs of
+ * full-siblings are recorded in total, leaving room for one more adjustment.
+ *
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param kinship_coefficient kinship coefficient on the sampled chromosomes.
+ */
+void
+add_calibrated_full_sibling(int id1_index, int id2_index, double kinship_coefficient)
+{
+    if (NUM_FS >= MAX_NUM_FS) {
+        return;
+    }
+
+    ++NUM_FS;
+    FS_TOTAL_KINSHIP_COEFFICIENTS += kinship_coefficient;
+    CALIBRATED_FS[{id1_index, id2_index}] = kinship_coefficient;
+}
+
+/**
+ * Replace what the calibration pre-pass recorded for a pair with its genome-wide
+ * totals, once they are known. The sampled kinship coefficient of the pair, if it
+ * was recorded, no longer counts, neither towards the recorded full-siblings nor
+ * towards those the last adjustment used, and the pair is recorded again with
+ * add_full_sibling if it is a full-sibling genome-wide. Every replacement thus
+ * counts towards the next adjustment, and the boundaries converge to those of a
+ * run without the pre-pass.
+ *
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param stats a struct pair_stats that contains total IBD1 and total IBD2
+ *     of the pair across all chromosomes.
+ * @param is_full_sibling whether the pair is a full-sibling genome-wide.
+ */
+void
+update_calibrated_full_sibling(
+    int id1_index, int id2_index, const struct pair_stats &stats, bool is_full_sibling)
+{
+    auto it = CALIBRATED_FS.find({id1_index, id2_index});
+    if (it != CALIBRATED_FS.end()) {
+        --NUM_FS;
+        FS_TOTAL_KINSHIP_COEFFICIENTS -= it->second;
+        if (PREV_ADJUSTED_NUM_FS > 0) {
+            --PREV_ADJUSTED_NUM_FS;
+        }
+        CALIBRATED_FS.erase(it);
+    }
+
+    if (is_full_sibling) {
+        add_full_sibling(stats);
+    }
+}
+
+/**
+ * @return pairs recorded by the calibration pre-pass that have not been written
+ *     yet, e.g. to save them to a checkpoint.
+ */
+const calibrated_full_siblings &
+get_calibrated_full_siblings()
+{
+    return CALIBRATED_FS;
+}
+
+/**
+ * Restore the pairs recorded by the calibration pre-pass, e.g. from a
+ * checkpoint. They already count towards the restored classifier state.
+ *
+ * @param full_siblings pairs returned by get_calibrated_full_siblings.
+ */
+void
+set_calibrated_full_siblings(const calibrated_full_siblings &full_siblings)
+{
+    CALIBRATED_FS = full_siblings;
+}
+
+/**
+ * Record that the full-siblings of the first num_ids individuals, as the first
+ * individual of a pair, have been recorded by the calibration pre-pass, so that
+ * their pairs are passed to update_calibrated_full_sibling when written.
+ *
+ * @param num_ids number of individuals the calibration pre-pass covered.
+ */
+void
+set_num_calibrated_ids(int num_ids)
+{
+    NUM_CALIBRATED_IDS = num_ids;
+}
+
+/**
+ * @return number of individuals whose full-siblings the calibration pre-pass
+ *     recorded, see set_num_calibrated_ids.
+ */
+int
+get_num_calibrated_ids()
+{
+    return NUM_CALIBRATED_IDS;
+}
+
 /**
  *
  * @return number of pairs of full-siblings that have been recorded.
@@ -132,3 +259,42 @@ shift_boundary()
 }
 
 
+
+
+/**
+ * @return current full-sibling calibration state and thresholds.
+ */
+struct classifier_state
+get_classifier_state()
+{
+    struct classifier_state state;
+    state.num_fs = NUM_FS;
+    state.prev_adjusted_num_fs = PREV_ADJUSTED_NUM_FS;
+    state.fs_total_kinship_coefficients = FS_TOTAL_KINSHIP_COEFFICIENTS;
+    state.fourth_start = FOURTH_START;
+    state.third_start = THIRD_START;
+    state.second_start = SECOND_START;
+    state.po_fs_start = PO_FS_START;
+    state.mz_start = MZ_START;
+    state.fs_start = FS_START;
+    return state;
+}
+
+/**
+ * Restore full-sibling calibration state and thresholds, e.g. from a checkpoint.
+ *
+ * @param state a struct classifier_state returned by get_classifier_state.
+ */
+void
+set_classifier_state(const struct classifier_state &state)
+{
+    NUM_FS = state.num_fs;
+    PREV_ADJUSTED_NUM_FS = state.prev_adjusted_num_fs;
+    FS_TOTAL_KINSHIP_COEFFICIENTS = state.fs_total_kinship_coefficients;
+    FOURTH_START = state.fourth_start;
+    THIRD_START = state.third_start;
+    SECOND_START = state.second_start;
+    PO_FS_START = state.po_fs_start;
+    MZ_START = state.mz_start;
+    FS_START = state.fs_start;
+}
@@ -12,6 +12,8 @@
 #include <string>
 #include <unordered_map>
 
+#include <boost/functional/hash.hpp>
+
 #include "mapper.hpp"
 
 const extern int NUM_TYPES;
@@ -26,9 +28,36 @@ extern double FS_START;
 
 #define MIN_NUM_FS 200
 
+// Full-sibling calibration state and the thresholds derived from it
+struct classifier_state {
+   int num_fs;
+   int prev_adjusted_num_fs;
+   double fs_total_kinship_coefficients;
+   double fourth_start;
+   double third_start;
+   double second_start;
+   double po_fs_start;
+   double mz_start;
+   double fs_start;
+};
+
+// Kinship coefficients, on the sampled chromosomes, of the full-siblings
+// recorded by the calibration pre-pass, by indices of the pair
+typedef std::unordered_map<std::pair<int, int>, double, boost::hash<std::pair<int, int>>> calibrated_full_siblings;
+
 void add_full_sibling(const struct pair_stats &stats);
+void add_full_siblings(int num_full_siblings, double total_kinship_coefficients);
 void shift_boundary();
 int get_num_full_siblings();
+void add_calibrated_full_sibling(int id1_index, int id2_index, double kinship_coefficient);
+void update_calibrated_full_sibling(
+   int id1_index, int id2_index, const struct pair_stats &stats, bool is_full_sibling);
+const calibrated_full_siblings &get_calibrated_full_siblings();
+void set_calibrated_full_siblings(const calibrated_full_siblings &full_siblings);
+void set_num_calibrated_ids(int num_ids);
+int get_num_calibrated_ids();
+struct classifier_state get_classifier_state();
+void set_classifier_state(const struct classifier_state &state);
 
 
 inline int
@@ -7,27 +7,30 @@
  */
 
 #include <algorithm>
+#include <cstring>
 #include <unordered_map>
 
 #include <boost/iostreams/filtering_streambuf.hpp>
 
 #include "parser.hpp"
 #include "dumpable.hpp"
-#include "RaPIDaffin.hpp"
+#include "pair_totals.hpp"
+#include "segment_export.hpp"
 
-static inline bool is_encoding_less_than(int encoding, int degree);
 static inline double compute_probability_ibd1_from(
     double kinship_coefficient, double probability_ibd2);
+static inline void infer_candidate(double max_degree, const struct dumpable_pair &pair, OutputWriter &out);
 
 /**
  * Constructor of Dumpable.
  *
  * @param order an Ordering that specifies the ordering of the IDs as they appear
  *     in the vcf file.
+ * @param num_chromosomes number of chromosomes individuals are processed on.
  */
-Dumpable::Dumpable(const class Ordering &order) :
+Dumpable::Dumpable(const class Ordering &order, int num_chromosomes) :
     previous_last_dumpable_index(-1),
-    last_dumpable_indices(NUM_CHROMOSOMES, -1),
+    last_dumpable_indices(num_chromosomes, -1),
     id_ordering(order) {}
 
 
@@ -77,6 +80,56 @@ Dumpable::set_previous_last_dumpable_index(int index)
 }
 
 
+/**
+ * @return the last index in the range returned by the previous call to
+ *     Dumpable::get_dumpable_indices.
+ */
+int
+Dumpable::get_previous_last_dumpable_index()
+{
+    return previous_last_dumpable_index;
+}
+
+
+/**
+ * @return index of the last processed individual for each chromosome.
+ */
+const std::vector<int>&
+Dumpable::get_last_dumpable_indices()
+{
+    return last_dumpable_indices;
+}
+
+
+/**
+ * Restore the state of this Dumpable, e.g. from a checkpoint.
+ *
+ * @param previous_index as returned by Dumpable::get_previous_last_dumpable_index.
+ * @param indices as returned by Dumpable::get_last_dumpable_indices.
+ */
+void
+Dumpable::restore(int previous_index, const std::vector<int> &indices)
+{
+    previous_last_dumpable_index = previous_index;
+    last_dumpable_indices = indices;
+}
+
+
+/**
+ * Make room for the totals of pairs with every individual.
+ *
+ * @param num_ids number of individuals.
+ */
+void
+PairAccumulator::resize(int num_ids)
+{
+    if ((int) stats.size() < num_ids) {
+        stats.resize(num_ids);
+        positions.resize(num_ids);
+    }
+}
+
+
 /**
  * Write all individuals in the given inclusive range to either temporary output or
  * final output. An individual will be written to temporary output if there are
@@ -90,8 +143,15 @@ Dumpable::set_previous_last_dumpable_index(int index)
  * @matrices an vector of matrix. Each matrix is a 2D unordered map where M[i][j]
  *     is a struct pair_stats that records the total IBD1 and IBD2 between individual
  *     with index i and individual with index j.
- * @temp_out temporary output.
+ * @accumulator aggregates the pairs of one individual at a time. Owned by the
+ *     caller so that it is reused across calls, and sized for all individuals here.
+ * @defer whether all candidates are written to temporary output regardless of the
+ *     number of pairs of full-siblings recorded.
+ * @candidates temporary output.
  * @out final output.
+ * @totals pair-totals sidecar every pair is also written to. Not written if null.
+ * @segments segment export pairs are selected for. None are selected if null.
+ * @num_pairs incremented by the number of pairs in the range.
  *
  * @return number of individuals written to output.
  */
@@ -102,13 +162,20 @@ dump_range(
     Ordering &order,
     const std::pair<int, int> &range,
     std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> &matrices,
-    std::ostream &temp_out,
-    std::ostream &out)
+    PairAccumulator &accumulator,
+    bool defer,
+    CandidateStore &candidates,
+    OutputWriter &out,
+    PairTotalsWriter *totals,
+    SegmentExport *segments,
+    uint64_t &num_pairs)
 {
     int num_dumped = 0;
 
+    accumulator.resize(order.size());
+
     for (int id1_index = range.first; id1_index <= range.second; ++id1_index) {
-        std::unordered_map<int, struct pair_stats> id2_index_to_writable_stats;
+        accumulator.clear();
 
         // Aggregate individuals sharing IBD with this individual
         for (const auto &matrix : matrices) {
@@ -119,7 +186,7 @@ dump_range(
                     int id2_index = id2_index_to_stats.first;
                     const struct pair_stats &sub_stats = id2_index_to_stats.second;
 
-                    struct pair_stats &stats = id2_index_to_writable_stats[id2_index];
+                    struct pair_stats &stats = accumulator.get(id2_index);
                     stats.total_ibd1 += sub_stats.total_ibd1 - sub_stats.total_ibd2;
                     stats.total_ibd2 += sub_stats.total_ibd2;
                 }
@@ -128,52 +195,26 @@ dump_range(
 
         // Write out all the pairs consisted of this individual and another individual
         // sharing IBD with this individual
-        for (const auto &id2_index_to_stats : id2_index_to_writable_stats) {
-            const struct pair_stats &stats = id2_index_to_stats.second;
-            double kinship_coefficient = compute_kinship_coefficient(stats.total_ibd1, stats.total_ibd2);
-            double probability_ibd2 = compute_probability_ibd2(stats.total_ibd2);
-
-            if (probability_ibd2 >= FS_START) {
-                add_full_sibling(stats);
+        num_pairs += accumulator.get_touched().size();
+        for (int id2_index : accumulator.get_touched()) {
+            const struct pair_stats &stats = accumulator.at(id2_index);
+            if (totals) {
+                totals->write(id1_index, id2_index, stats);
             }
-
-            int num_full_siblings = get_num_full_siblings();
-            if (kinship_coefficient >= min_kinship_coefficient && num_full_siblings < MIN_NUM_FS) {
-                // Write to temporary
-                struct dumpable_pair pair;
-                pair.id1_index = id1_index;
-                pair.id2_index = id2_index_to_stats.first;
-                pair.kinship_coefficient = kinship_coefficient;
-                pair.probability_ibd2 = probability_ibd2;
-
-                if (!temp_out.write(reinterpret_cast<char *>(&pair), sizeof(struct dumpable_pair))) {
-                    throw std::runtime_error {"Failed to write to temporary file"};
-                }
-                ++num_dumped;
-
-            } else if (num_full_siblings >= MIN_NUM_FS) {
-                // Write to final directly
-
-                // Adjust inference boundaries
-                shift_boundary();
-
-                int encoding = get_encoding(kinship_coefficient, probability_ibd2);
-                if (is_encoding_less_than(encoding, max_degree)) {
-                    double probability_ibd1 = compute_probability_ibd1(stats.total_ibd1);
-                    double probability_ibd0 = std::max(1 - probability_ibd1 - probability_ibd2, 0.0);
-
-                    write_pair(
-                        order.get(id1_index),
-                        order.get(id2_index_to_stats.first),
-                        kinship_coefficient,
-                        probability_ibd0,
-                        probability_ibd1,
-                        probability_ibd2,
-                        get_encoding(kinship_coefficient, probability_ibd2),
-                        out
-                    );
-                }
+            if (segments) {
+                segments->select(id1_index, id2_index, stats);
             }
+            num_dumped += dump_pair(
+                max_degree,
+                min_kinship_coefficient,
+                order,
+                id1_index,
+                id2_index,
+                stats,
+                defer,
+                candidates,
+                out
+            );
         }
 
         // Discard information about this individual
@@ -182,29 +223,124 @@ dump_range(
         }
     }
 
-    out.flush();
-    temp_out.flush();
-
     return num_dumped;
 }
 
 
+/**
+ * Write one pair to either temporary output or final output. The pair will be
+ * written to temporary output if there are insufficient number of pairs of
+ * full-siblings recorded.
+ *
+ * @param max_degree largest degree user is looking for.
+ * @param min_kinship_coefficient pairs with kinship coefficients below this will not be
+ *     written to any output.
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param stats total IBD1 (excluding IBD2) and total IBD2 shared by the pair
+ *     across all chromosomes.
+ * @param defer whether the pair is written to temporary output regardless of the
+ *     number of pairs of full-siblings recorded.
+ * @param candidates temporary output.
+ * @param out final output.
+ *
+ * @return 1 if the pair was written to temporary output, 0 otherwise.
+ */
+int
+dump_pair(
+    int max_degree,
+    double min_kinship_coefficient,
+    Ordering &order,
+    int id1_index,
+    int id2_index,
+    const struct pair_stats &stats,
+    bool defer,
+    CandidateStore &candidates,
+    OutputWriter &out)
+{
+    double kinship_coefficient = compute_kinship_coefficient(stats.total_ibd1, stats.total_ibd2);
+    double probability_ibd2 = compute_probability_ibd2(stats.total_ibd2);
+
+    // Full-siblings among the calibrated individuals were recorded with their
+    // sampled kinship, which is replaced by the genome-wide one
+    if (id1_index < get_num_calibrated_ids()) {
+        update_calibrated_full_sibling(id1_index, id2_index, stats, probability_ibd2 >= FS_START);
+    } else if (probability_ibd2 >= FS_START) {
+        add_full_sibling(stats);
+    }
+
+    int num_full_siblings = get_num_full_siblings();
+    if (kinship_coefficient >= min_kinship_coefficient && (defer || num_full_siblings < MIN_NUM_FS)) {
+        // Write to temporary
+        struct dumpable_pair pair;
+        pair.id1_index = id1_index;
+        pair.id2_index = id2_index;
+        pair.kinship_coefficient = kinship_coefficient;
+        pair.probability_ibd2 = probability_ibd2;
+
+        candidates.write(reinterpret_cast<char *>(&pair), sizeof(struct dumpable_pair));
+        return 1;
+
+    } else if (!defer && num_full_siblings >= MIN_NUM_FS) {
+        // Write to final directly
+
+        // Adjust inference boundaries
+        shift_boundary();
+
+        int encoding = get_encoding(kinship_coefficient, probability_ibd2);
+        if (is_encoding_less_than(encoding, max_degree)) {
+            double probability_ibd1 = compute_probability_ibd1(stats.total_ibd1);
+            double probability_ibd0 = std::max(1 - probability_ibd1 - probability_ibd2, 0.0);
+
+            out.write_pair(
+                id1_index,
+                id2_index,
+                kinship_coefficient,
+                probability_ibd0,
+                probability_ibd1,
+                probability_ibd2,
+                get_encoding(kinship_coefficient, probability_ibd2)
+            );
+        }
+    }
+    return 0;
+}
+
+
 /**
  * Read from temporary output, infer the relationships of the candidates, and write
- * them to final output.
+ * them to final output. Candidates kept in memory are read in place.
  *
  * @param largest degree user is looking for.
  * @num_dumped total number of pairs written to temporary output.
- * @temp_in temporary output for reading.
+ * @candidates temporary output.
  * @order an Ordering that specifies the ordering of the IDs as they appear in VCF.
  * @out final output.
  */
 void
 infer_candidates(
     double max_degree,
-    uint64_t num_dumped, std::istream &temp_in,
-    Ordering &order, std::ostream &out)
+    uint64_t num_dumped, CandidateStore &candidates,
+    Ordering &order, OutputWriter &out)
 {
+    if (candidates.is_in_memory()) {
+        const std::vector<char> &data = candidates.get_candidates();
+        if (data.size() != num_dumped * sizeof(struct dumpable_pair)) {
+            throw std::runtime_error {"Failed to read from temporary file"};
+        }
+
+        struct dumpable_pair pair;
+        for (size_t offset = 0; offset < data.size(); offset += sizeof(struct dumpable_pair)) {
+            std::memcpy(&pair, data.data() + offset, sizeof(struct dumpable_pair));
+            infer_candidate(max_degree, pair, out);
+        }
+
+        out.flush();
+        return;
+    }
+
+    std::istream &temp_in = candidates.input();
     struct dumpable_pair *pair;
     char buffer[sizeof(struct dumpable_pair)];
     uint64_t num_read = 0;
@@ -213,25 +349,7 @@ infer_candidates(
     while (temp_in.read(buffer, sizeof(struct dumpable_pair))) {
         ++num_read;
         pair = reinterpret_cast<struct dumpable_pair*>(buffer);
-
-        int encoding = get_encoding((*pair).kinship_coefficient, (*pair).probability_ibd2);
-
-        // Write to final output if this candidate pair is closer than max_degree
-        if (is_encoding_less_than(encoding, max_degree)) {
-            double probability_ibd1 = std::max(compute_probability_ibd1_from((*pair).kinship_coefficient, (*pair).probability_ibd2), 0.0);
-            double probability_ibd0 = std::max(1 - probability_ibd1 - (*pair).probability_ibd2, 0.0);
-
-            write_pair(
-                order.get((*pair).id1_index),
-                order.get((*pair).id2_index),
-                (*pair).kinship_coefficient,
-                probability_ibd0,
-                probability_ibd1,
-                (*pair).probability_ibd2,
-                encoding,
-                out
-            );
-        }
+        infer_candidate(max_degree, *pair, out);
     }
 
     if (num_read != num_dumped || !temp_in.eof()) {
@@ -241,19 +359,34 @@ infer_candidates(
     out.flush();
 }
 
+
 /**
- * Determines if the input encoding represents a degree closer than the input degree.
+ * Infer the relationship of one candidate pair and write it to final output if
+ * it is closer than max_degree.
  *
- * @param encoding encoding of the relationship between a pair of individuals.
- * @param degree the degree to compare against.
+ * @param max_degree largest degree user is looking for.
+ * @param pair a candidate pair read from temporary output.
+ * @param out final output.
  */
-static inline bool
-is_encoding_less_than(int encoding, int degree)
+static inline void
+infer_candidate(double max_degree, const struct dumpable_pair &pair, OutputWriter &out)
 {
-    if (degree == 1) {
-        return encoding <= 2;
-    } else {
-        return encoding - 1 <= degree;
+    int encoding = get_encoding(pair.kinship_coefficient, pair.probability_ibd2);
+
+    // Write to final output if this candidate pair is closer than max_degree
+    if (is_encoding_less_than(encoding, max_degree)) {
+        double probability_ibd1 = std::max(compute_probability_ibd1_from(pair.kinship_coefficient, pair.probability_ibd2), 0.0);
+        double probability_ibd0 = std::max(1 - probability_ibd1 - pair.probability_ibd2, 0.0);
+
+        out.write_pair(
+            pair.id1_index,
+            pair.id2_index,
+            pair.kinship_coefficient,
+            probability_ibd0,
+            probability_ibd1,
+            pair.probability_ibd2,
+            encoding
+        );
     }
 }
 
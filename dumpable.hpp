@@ -13,36 +13,70 @@
 
 #include "ordering.hpp"
 #include "classifier.hpp"
+#include "output_writer.hpp"
+#include "candidate_store.hpp"
+#include "parser.hpp"
+
+class PairTotalsWriter;
+class SegmentExport;
 
 
 void infer_candidates(
     double max_degree,
-    uint64_t num_dumped, std::istream &temp_in,
-    Ordering &order, std::ostream &out);
+    uint64_t num_dumped, CandidateStore &candidates,
+    Ordering &order, OutputWriter &out);
 
 
-inline void
-output_header(std::ostream &out)
+/**
+ * Determines if the input encoding represents a degree closer than the input degree.
+ *
+ * @param encoding encoding of the relationship between a pair of individuals.
+ * @param degree the degree to compare against.
+ */
+inline bool
+is_encoding_less_than(int encoding, int degree)
 {
-    out << "ID1\tID2\tKINSHIP\tIBD0\tIBD1\tIBD2\tTYPE" << std::endl;
+    if (degree == 1) {
+        return encoding <= 2;
+    } else {
+        return encoding - 1 <= degree;
+    }
 }
 
 
-inline void
-write_pair(
-    std::string &id1, std::string &id2,
-    double kinship_coefficient, double probability_ibd0,
-    double probability_ibd1, double probability_ibd2,
-    int encoding,
-    std::ostream &out)
-{
-    out << id1 << "\t" << id2 << "\t"
-        << kinship_coefficient << "\t"
-        << probability_ibd0 << "\t"
-        << probability_ibd1 << "\t"
-        << probability_ibd2 << "\t"
-        << TYPES[encoding] << std::endl;
-}
+// Totals of the pairs of one individual, aggregated across the matrices of all
+// threads. A sparse set over the indices of all individuals: totals are stored
+// densely by the index of the other individual, and the indices touched since the
+// last clear are listed, so that aggregating and clearing take as long as the
+// individual has pairs, without hashing or allocation.
+class PairAccumulator {
+public:
+    void resize(int num_ids);
+
+    // Totals of the pair with id2_index, zeroed when first touched since the last clear
+    inline struct pair_stats &get(int id2_index)
+    {
+        unsigned int position = positions[id2_index];
+        if (position >= touched.size() || touched[position] != id2_index) {
+            positions[id2_index] = touched.size();
+            touched.push_back(id2_index);
+            stats[id2_index] = pair_stats();
+        }
+        return stats[id2_index];
+    }
+
+    // Indices touched since the last clear, in the order they were first touched
+    const std::vector<int> &get_touched() const { return touched; }
+
+    const struct pair_stats &at(int id2_index) const { return stats[id2_index]; }
+
+    void clear() { touched.clear(); }
+
+private:
+    std::vector<struct pair_stats> stats;
+    std::vector<unsigned int> positions;
+    std::vector<int> touched;
+};
 
 
 int dump_range(
@@ -51,8 +85,25 @@ int dump_range(
     Ordering &order,
     const std::pair<int, int> &range,
     std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> &matrices,
-    std::ostream &temp_out,
-    std::ostream &out);
+    PairAccumulator &accumulator,
+    bool defer,
+    CandidateStore &candidates,
+    OutputWriter &out,
+    PairTotalsWriter *totals,
+    SegmentExport *segments,
+    uint64_t &num_pairs);
+
+
+int dump_pair(
+    int max_degree,
+    double min_kinship_coefficient,
+    Ordering &order,
+    int id1_index,
+    int id2_index,
+    const struct pair_stats &stats,
+    bool defer,
+    CandidateStore &candidates,
+    OutputWriter &out);
 
 
 struct dumpable_pair {
@@ -65,7 +116,7 @@ struct dumpable_pair {
 
 class Dumpable {
 public:
-    Dumpable(const class Ordering &order);
+    Dumpable(const class Ordering &order, int num_chromosomes);
 
     void update(int chromosome_number, int index);
 
@@ -73,6 +124,12 @@ public:
 
     void set_previous_last_dumpable_index(int index);
 
+    int get_previous_last_dumpable_index();
+
+    const std::vector<int> &get_last_dumpable_indices();
+
+    void restore(int previous_index, const std::vector<int> &indices);
+
 private:
     int previous_last_dumpable_index;
     std::vector<int> last_dumpable_indices;
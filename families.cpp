@@ -0,0 +1,217 @@
+/**
+ * This file is responsible for analyses of a finished result set as a graph:
+ * the families, i.e. connected components of related individuals, and a set
+ * of individuals that are unrelated to each other.
+ *
+ * Two individuals are related if their relationship is of the given degree or
+ * closer.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "dumpable.hpp"
+#include "families.hpp"
+
+static int find_root(std::vector<int> &parents, int index);
+
+/**
+ * Find the families with union-find over the related pairs.
+ *
+ * @param graph the result set.
+ * @param max_degree pairs of this degree or closer are related.
+ *
+ * @return family of every individual. Families are numbered from 0 in the order
+ *     of their first individual in VCF order.
+ */
+std::vector<int>
+find_families(RelatednessGraph &graph, int max_degree)
+{
+    int num_ids = graph.size();
+    std::vector<int> parents(num_ids);
+    std::vector<int> sizes(num_ids, 1);
+    for (int i = 0; i < num_ids; ++i) {
+        parents[i] = i;
+    }
+
+    for (int i = 0; i < num_ids; ++i) {
+        std::pair<const struct relative *, const struct relative *> range = graph.get_relatives(i);
+        for (const struct relative *it = range.first; it != range.second; ++it) {
+            // Every pair is listed by both individuals, join it once
+            if (it->index < i || !is_encoding_less_than(it->encoding, max_degree)) {
+                continue;
+            }
+
+            int root1 = find_root(parents, i);
+            int root2 = find_root(parents, it->index);
+            if (root1 == root2) {
+                continue;
+            }
+            // Attach the smaller tree below the larger one
+            if (sizes[root1] < sizes[root2]) {
+                std::swap(root1, root2);
+            }
+            parents[root2] = root1;
+            sizes[root1] += sizes[root2];
+        }
+    }
+
+    std::vector<int> families(num_ids);
+    std::vector<int> root_to_family(num_ids, -1);
+    int num_families = 0;
+    for (int i = 0; i < num_ids; ++i) {
+        int root = find_root(parents, i);
+        if (root_to_family[root] < 0) {
+            root_to_family[root] = num_families++;
+        }
+        families[i] = root_to_family[root];
+    }
+    return families;
+}
+
+
+/**
+ * Greedily pick a maximal set of individuals no two of which are related.
+ * Individuals with fewer relatives are picked first, so that each pick rules
+ * out as few others as possible.
+ *
+ * @param graph the result set.
+ * @param max_degree pairs of this degree or closer are related.
+ *
+ * @return indices of the picked individuals in ascending order.
+ */
+std::vector<int>
+find_unrelated(RelatednessGraph &graph, int max_degree)
+{
+    int num_ids = graph.size();
+
+    // Number of relatives of every individual
+    std::vector<int> num_relatives(num_ids, 0);
+    int most_relatives = 0;
+    for (int i = 0; i < num_ids; ++i) {
+        std::pair<const struct relative *, const struct relative *> range = graph.get_relatives(i);
+        for (const struct relative *it = range.first; it != range.second; ++it) {
+            if (is_encoding_less_than(it->encoding, max_degree)) {
+                ++num_relatives[i];
+            }
+        }
+        most_relatives = std::max(most_relatives, num_relatives[i]);
+    }
+
+    // Counting sort by number of relatives, ties in index order
+    std::vector<int> starts(most_relatives + 2, 0);
+    for (int i = 0; i < num_ids; ++i) {
+        ++starts[num_relatives[i] + 1];
+    }
+    for (size_t i = 1; i < starts.size(); ++i) {
+        starts[i] += starts[i - 1];
+    }
+    std::vector<int> order(num_ids);
+    for (int i = 0; i < num_ids; ++i) {
+        order[starts[num_relatives[i]]++] = i;
+    }
+
+    std::vector<bool> excluded(num_ids, false);
+    std::vector<int> unrelated;
+    for (int index : order) {
+        if (excluded[index]) {
+            continue;
+        }
+        unrelated.push_back(index);
+
+        std::pair<const struct relative *, const struct relative *> range = graph.get_relatives(index);
+        for (const struct relative *it = range.first; it != range.second; ++it) {
+            if (is_encoding_less_than(it->encoding, max_degree)) {
+                excluded[it->index] = true;
+            }
+        }
+    }
+
+    std::sort(unrelated.begin(), unrelated.end());
+    return unrelated;
+}
+
+
+/**
+ * Load a result set and write its families to {output_path}families.txt and a
+ * maximal set of unrelated individuals to {output_path}unrelated.txt.
+ *
+ * @param results_path path of final output in any output format.
+ * @param samples_path IDs of all individuals in VCF order for text output, see
+ *     RelatednessGraph. Individuals are written in this order.
+ * @param output_path directory to write to, ending with a slash, or empty for the
+ *     working directory.
+ * @param max_degree pairs of this degree or closer are related.
+ */
+void
+write_families(
+    const std::string &results_path,
+    const std::string &samples_path,
+    const std::string &output_path,
+    int max_degree)
+{
+    auto start = std::chrono::steady_clock::now();
+    RelatednessGraph graph(results_path, samples_path);
+    auto loaded = std::chrono::steady_clock::now();
+    std::cout << "Loaded " << graph.get_num_pairs() << " pairs of " << graph.size() << " individuals in "
+        << std::chrono::duration<double>(loaded - start).count() << " s" << std::endl;
+
+    std::vector<int> families = find_families(graph, max_degree);
+    std::vector<int> unrelated = find_unrelated(graph, max_degree);
+
+    std::vector<int> family_sizes;
+    for (int family : families) {
+        if (family >= (int) family_sizes.size()) {
+            family_sizes.resize(family + 1, 0);
+        }
+        ++family_sizes[family];
+    }
+
+    std::string families_path = output_path + "families.txt";
+    std::ofstream families_out(families_path);
+    if (!families_out) {
+        throw std::runtime_error {"Failed to open " + families_path};
+    }
+    families_out << "ID\tFAMILY\tSIZE" << '\n';
+    for (int i = 0; i < graph.size(); ++i) {
+        families_out << graph.get(i) << '\t' << families[i] << '\t' << family_sizes[families[i]] << '\n';
+    }
+
+    std::string unrelated_path = output_path + "unrelated.txt";
+    std::ofstream unrelated_out(unrelated_path);
+    if (!unrelated_out) {
+        throw std::runtime_error {"Failed to open " + unrelated_path};
+    }
+    for (int index : unrelated) {
+        unrelated_out << graph.get(index) << '\n';
+    }
+
+    if (!families_out.flush() || !unrelated_out.flush()) {
+        throw std::runtime_error {"Failed to write to " + output_path};
+    }
+
+    std::cout << family_sizes.size() << " families, " << unrelated.size() << " unrelated individuals in "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - loaded).count() << " s" << std::endl;
+}
+
+
+/**
+ * @param parents parent of every individual in the union-find forest. Paths are
+ *     halved along the way.
+ * @param index index of an individual.
+ *
+ * @return the root of the tree of the individual.
+ */
+static int
+find_root(std::vector<int> &parents, int index)
+{
+    while (parents[index] != index) {
+        parents[index] = parents[parents[index]];
+        index = parents[index];
+    }
+    return index;
+}
@@ -0,0 +1,26 @@
+/**
+ * This file is responsible for analyses of a finished result set as a graph:
+ * the families, i.e. connected components of related individuals, and a set
+ * of individuals that are unrelated to each other.
+ *
+ */
+
+#ifndef FAMILIES_HPP
+#define FAMILIES_HPP
+
+#include <string>
+#include <vector>
+
+#include "relatedness_graph.hpp"
+
+std::vector<int> find_families(RelatednessGraph &graph, int max_degree);
+
+std::vector<int> find_unrelated(RelatednessGraph &graph, int max_degree);
+
+void write_families(
+    const std::string &results_path,
+    const std::string &samples_path,
+    const std::string &output_path,
+    int max_degree);
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * This file is responsible for files written as a sequence of gzip members, so
+ * that they can be made consistent on disk at a checkpoint and later be
+ * truncated back to that point and appended to.
+ *
+ * A member is closed whenever the file has to be consistent on disk and a new
+ * one is appended. Gzip readers decompress the concatenated members as one
+ * stream. Without compression, the same calls only flush the file.
+ *
+ */
+
+#include <boost/filesystem.hpp>
+
+#include "gzip_member_writer.hpp"
+
+/**
+ * Constructor of GzipMemberWriter. Nothing is opened until GzipMemberWriter::open.
+ *
+ * @param path path of the file.
+ * @param compressed whether members are gzip compressed.
+ * @param level zlib compression level of the members.
+ */
+GzipMemberWriter::GzipMemberWriter(const std::string &path, bool compressed, int level) :
+    path(path),
+    compressed(compressed),
+    level(level) {}
+
+
+/**
+ * Open the file for writing. Anything after offset is discarded.
+ *
+ * @param offset size of the file to keep, as returned by GzipMemberWriter::sync.
+ *     0 starts a new file.
+ */
+void
+GzipMemberWriter::open(uint64_t offset)
+{
+    close_member();
+    if (offset == 0) {
+        std::ofstream(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    } else {
+        boost::filesystem::resize_file(path, offset);
+    }
+    open_member();
+}
+
+
+/**
+ * @return whether the file is open for writing.
+ */
+bool
+GzipMemberWriter::is_open()
+{
+    return (bool) out;
+}
+
+
+/**
+ * @return stream writing to the current member. Only valid while open.
+ */
+std::ostream&
+GzipMemberWriter::stream()
+{
+    return *out;
+}
+
+
+/**
+ * Close the current member so that everything written so far is on disk, and
+ * start a new one.
+ *
+ * @return size of the file.
+ */
+uint64_t
+GzipMemberWriter::sync()
+{
+    close_member();
+    uint64_t size = boost::filesystem::file_size(path);
+    open_member();
+    return size;
+}
+
+
+/**
+ * Close the current member and the file. No-op if not open.
+ */
+void
+GzipMemberWriter::close()
+{
+    close_member();
+}
+
+
+void
+GzipMemberWriter::open_member()
+{
+    file = std::make_unique<std::ofstream>(path, std::ios::out | std::ios::app | std::ios::binary);
+    buffer = std::make_unique<boost::iostreams::filtering_streambuf<boost::iostreams::output>>();
+    if (compressed) {
+        buffer->push(boost::iostreams::gzip_compressor(level));
+    }
+    buffer->push(*file);
+    out = std::make_unique<std::ostream>(buffer.get());
+}
+
+
+void
+GzipMemberWriter::close_member()
+{
+    if (!out) {
+        return;
+    }
+    out.reset();
+    // Destroying the chain writes the gzip trailer
+    buffer.reset();
+    file.reset();
+}
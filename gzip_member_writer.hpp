@@ -0,0 +1,48 @@
+/**
+ * This file is responsible for files written as a sequence of gzip members, so
+ * that they can be made consistent on disk at a checkpoint and later be
+ * truncated back to that point and appended to.
+ *
+ */
+
+#ifndef GZIP_MEMBER_WRITER_HPP
+#define GZIP_MEMBER_WRITER_HPP
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <iostream>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+class GzipMemberWriter {
+public:
+    GzipMemberWriter(
+        const std::string &path,
+        bool compressed = true,
+        int level = boost::iostreams::gzip::default_compression);
+
+    void open(uint64_t offset);
+
+    bool is_open();
+
+    std::ostream &stream();
+
+    uint64_t sync();
+
+    void close();
+
+private:
+    std::string path;
+    bool compressed;
+    int level;
+    std::unique_ptr<std::ofstream> file;
+    std::unique_ptr<boost::iostreams::filtering_streambuf<boost::iostreams::output>> buffer;
+    std::unique_ptr<std::ostream> out;
+
+    void open_member();
+    void close_member();
+};
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * This file is responsible for the sparse kinship matrix: the kinship
+ * coefficients of all pairs in final output as a symmetric matrix indexed by
+ * the ordering of the individuals, for mixed-model tools.
+ *
+ * KinshipMatrixWriter passes every pair on to the writer of final output and
+ * also writes it to:
+ *
+ *   kinship.grm.sp and kinship.grm.id, the sparse GRM of GCTA. Each line of
+ *   kinship.grm.sp holds the row and column of an entry in the lower triangle,
+ *   i.e. the larger index first, and twice the kinship coefficient. Entries are
+ *   written as pairs are, and the diagonal of 1 is written at the end.
+ *   kinship.grm.id lists the individuals in the same order, with each ID as both
+ *   family and individual ID.
+ *
+ *   kinship.csr, the full symmetric matrix of kinship coefficients in compressed
+ *   sparse row format, with 0.5 on the diagonal. It holds KINSHIP_MATRIX_MAGIC,
+ *   the number of rows and the number of entries as uint64_t, num_rows + 1 row
+ *   offsets as uint64_t, the column of every entry as uint32_t and the value of
+ *   every entry as float, all little-endian. Columns are sorted within a row, so
+ *   the arrays can be memory-mapped as they are, e.g. into scipy.sparse.csr_matrix.
+ *
+ * Pairs arrive sorted by id1 but not by id2, and each pair is an entry of both of
+ * its rows. Instead of sorting every pair in memory, entries are spooled to disk
+ * and only the size of every row is counted. Once output is complete, the row
+ * offsets follow from the sizes, and a pass over the spool places every entry in
+ * its rows of the memory-mapped matrix. Only the rows are then sorted.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/filesystem.hpp>
+
+#include "kinship_matrix.hpp"
+
+#define KINSHIP_MATRIX_MAGIC "RAFFIKM1"
+#define KINSHIP_MATRIX_MAGIC_LENGTH 8
+
+// Entries read from the spool at a time
+#define KINSHIP_ENTRY_BATCH_SIZE (1 << 16)
+
+static std::string get_entries_file(const std::string &output_path);
+
+/**
+ * @param output_path output directory. Empty or ending with '/'.
+ *
+ * @return path of the matrix in compressed sparse row format.
+ */
+std::string
+get_kinship_matrix_file(const std::string &output_path)
+{
+    return output_path + "kinship.csr";
+}
+
+
+/**
+ * Constructor of KinshipMatrixWriter. Starts the spool and kinship.grm.sp.
+ *
+ * @param output writer of final output every pair is passed on to.
+ * @param output_path output directory. Empty or ending with '/'.
+ * @param order an Ordering that specifies the rows of the matrix.
+ */
+KinshipMatrixWriter::KinshipMatrixWriter(
+    std::unique_ptr<OutputWriter> output, const std::string &output_path, Ordering &order) :
+    output(std::move(output)),
+    output_path(output_path),
+    order(order),
+    row_sizes(order.size()),
+    entries(get_entries_file(output_path), std::ios::out | std::ios::trunc | std::ios::binary),
+    grm(output_path + "kinship.grm.sp", std::ios::out | std::ios::trunc)
+{
+    if (!entries || !grm) {
+        throw std::runtime_error {"Failed to open the kinship matrix in " + output_path};
+    }
+    grm << std::setprecision(6);
+}
+
+
+/**
+ * Write the header of final output.
+ */
+void
+KinshipMatrixWriter::write_header()
+{
+    output->write_header();
+}
+
+
+/**
+ * Write one pair to final output and add it to the matrix.
+ *
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param kinship_coefficient
+ * @param probability_ibd0
+ * @param probability_ibd1
+ * @param probability_ibd2
+ * @param encoding encoding of the type of relationship, an index of TYPES.
+ */
+void
+KinshipMatrixWriter::write_pair(
+    int id1_index, int id2_index,
+    double kinship_coefficient, double probability_ibd0,
+    double probability_ibd1, double probability_ibd2,
+    int encoding)
+{
+    output->write_pair(
+        id1_index, id2_index,
+        kinship_coefficient, probability_ibd0,
+        probability_ibd1, probability_ibd2,
+        encoding
+    );
+
+    struct kinship_entry entry {(uint32_t) id1_index, (uint32_t) id2_index, (float) kinship_coefficient};
+    entries.write(reinterpret_cast<const char *>(&entry), sizeof(struct kinship_entry));
+    ++row_sizes[id1_index];
+    ++row_sizes[id2_index];
+
+    grm << std::max(id1_index, id2_index) << "\t" << std::min(id1_index, id2_index) << "\t"
+        << 2 * kinship_coefficient << "\n";
+}
+
+
+/**
+ * Flush final output and the files of the matrix.
+ */
+void
+KinshipMatrixWriter::flush()
+{
+    output->flush();
+    if (!entries.flush() || !grm.flush()) {
+        throw std::runtime_error {"Failed to write the kinship matrix in " + output_path};
+    }
+}
+
+
+/**
+ * Finish final output, complete kinship.grm.sp and kinship.grm.id and build
+ * kinship.csr.
+ */
+void
+KinshipMatrixWriter::close()
+{
+    output->close();
+
+    for (int index = 0; index < order.size(); ++index) {
+        grm << index << "\t" << index << "\t" << 1 << "\n";
+    }
+    grm.close();
+
+    std::ofstream ids(output_path + "kinship.grm.id", std::ios::out | std::ios::trunc);
+    for (int index = 0; index < order.size(); ++index) {
+        ids << order.get(index) << "\t" << order.get(index) << "\n";
+    }
+    ids.close();
+
+    entries.close();
+    if (!grm || !ids || !entries) {
+        throw std::runtime_error {"Failed to write the kinship matrix in " + output_path};
+    }
+
+    build_matrix();
+    std::remove(get_entries_file(output_path).c_str());
+}
+
+
+/**
+ * Build kinship.csr from the spooled entries.
+ */
+void
+KinshipMatrixWriter::build_matrix()
+{
+    uint64_t num_rows = order.size();
+    std::vector<uint64_t> row_offsets(num_rows + 1);
+    for (uint64_t row = 0; row < num_rows; ++row) {
+        // Each row also has its diagonal entry
+        row_offsets[row + 1] = row_offsets[row] + row_sizes[row] + 1;
+    }
+    uint64_t num_entries = row_offsets[num_rows];
+
+    std::string path = get_kinship_matrix_file(output_path);
+    std::string partial_path = path + ".partial";
+    uint64_t header_size = KINSHIP_MATRIX_MAGIC_LENGTH + 2 * sizeof(uint64_t);
+    // Created as usual first, since a file created by mapping it is only accessible to its owner
+    std::ofstream(partial_path, std::ios::out | std::ios::trunc | std::ios::binary);
+    boost::filesystem::resize_file(partial_path, header_size + (num_rows + 1) * sizeof(uint64_t) +
+        num_entries * (sizeof(uint32_t) + sizeof(float)));
+    boost::iostreams::mapped_file file(partial_path, boost::iostreams::mapped_file::readwrite);
+
+    char *data = file.data();
+    std::memcpy(data, KINSHIP_MATRIX_MAGIC, KINSHIP_MATRIX_MAGIC_LENGTH);
+    std::memcpy(data + KINSHIP_MATRIX_MAGIC_LENGTH, &num_rows, sizeof(uint64_t));
+    std::memcpy(data + KINSHIP_MATRIX_MAGIC_LENGTH + sizeof(uint64_t), &num_entries, sizeof(uint64_t));
+    std::memcpy(data + header_size, row_offsets.data(), (num_rows + 1) * sizeof(uint64_t));
+    uint32_t *columns = reinterpret_cast<uint32_t *>(data + header_size + (num_rows + 1) * sizeof(uint64_t));
+    float *values = reinterpret_cast<float *>(columns + num_entries);
+
+    // Next free entry of every row, starting with the diagonal
+    std::vector<uint64_t> &next = row_sizes;
+    for (uint64_t row = 0; row < num_rows; ++row) {
+        columns[row_offsets[row]] = row;
+        values[row_offsets[row]] = 0.5;
+        next[row] = row_offsets[row] + 1;
+    }
+
+    std::ifstream in(get_entries_file(output_path), std::ios::in | std::ios::binary);
+    std::vector<struct kinship_entry> batch(KINSHIP_ENTRY_BATCH_SIZE);
+    while (in) {
+        in.read(reinterpret_cast<char *>(batch.data()), batch.size() * sizeof(struct kinship_entry));
+        size_t num_read = in.gcount() / sizeof(struct kinship_entry);
+        for (size_t i = 0; i < num_read; ++i) {
+            const struct kinship_entry &entry = batch[i];
+            columns[next[entry.id1_index]] = entry.id2_index;
+            values[next[entry.id1_index]++] = entry.kinship_coefficient;
+            columns[next[entry.id2_index]] = entry.id1_index;
+            values[next[entry.id2_index]++] = entry.kinship_coefficient;
+        }
+    }
+    if (!in.eof()) {
+        throw std::runtime_error {"Failed to read " + get_entries_file(output_path)};
+    }
+
+    std::vector<std::pair<uint32_t, float>> row_entries;
+    for (uint64_t row = 0; row < num_rows; ++row) {
+        uint64_t start = row_offsets[row];
+        uint64_t end = row_offsets[row + 1];
+        row_entries.clear();
+        for (uint64_t i = start; i < end; ++i) {
+            row_entries.emplace_back(columns[i], values[i]);
+        }
+        std::sort(row_entries.begin(), row_entries.end());
+        for (uint64_t i = start; i < end; ++i) {
+            columns[i] = row_entries[i - start].first;
+            values[i] = row_entries[i - start].second;
+        }
+    }
+
+    file.close();
+    if (std::rename(partial_path.c_str(), path.c_str())) {
+        throw std::runtime_error {"Failed to write " + path};
+    }
+}
+
+
+/**
+ * @param output_path output directory. Empty or ending with '/'.
+ *
+ * @return path of the spool of entries.
+ */
+static std::string
+get_entries_file(const std::string &output_path)
+{
+    return output_path + "kinship.entries.partial";
+}
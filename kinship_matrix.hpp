@@ -0,0 +1,56 @@
+/**
+ * This file is responsible for the sparse kinship matrix: the kinship
+ * coefficients of all pairs in final output as a symmetric matrix indexed by
+ * the ordering of the individuals, for mixed-model tools.
+ *
+ */
+
+#ifndef KINSHIP_MATRIX_HPP
+#define KINSHIP_MATRIX_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+
+#include "output_writer.hpp"
+#include "ordering.hpp"
+
+// A pair written to final output, spooled until the matrix is built
+struct kinship_entry {
+    uint32_t id1_index;
+    uint32_t id2_index;
+    float kinship_coefficient;
+};
+
+std::string get_kinship_matrix_file(const std::string &output_path);
+
+class KinshipMatrixWriter : public OutputWriter {
+public:
+    KinshipMatrixWriter(std::unique_ptr<OutputWriter> output, const std::string &output_path, Ordering &order);
+
+    void write_header() override;
+
+    void write_pair(
+        int id1_index, int id2_index,
+        double kinship_coefficient, double probability_ibd0,
+        double probability_ibd1, double probability_ibd2,
+        int encoding) override;
+
+    void flush() override;
+
+    void close() override;
+
+private:
+    std::unique_ptr<OutputWriter> output;
+    std::string output_path;
+    Ordering &order;
+    // Off-diagonal entries of every row
+    std::vector<uint64_t> row_sizes;
+    std::ofstream entries;
+    std::ofstream grm;
+
+    void build_matrix();
+};
+
+#endif
@@ -5,38 +5,235 @@
  *
  */
 
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <string>
+#include <sstream>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <future>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL
+#endif
+
 #include "mapper.hpp"
 
 #include "RaPIDaffin.hpp"
 
 
-// Length of genome
+static std::vector<struct chromosome_region> get_autosomes();
+static bool parse_site_range(const std::string &range, struct chromosome_region &region);
+static std::unique_ptr<std::vector<double>> parse_map(int chromosome_number, std::string &map_path);
+static std::vector<long> parse_positions(int chromosome_number, const std::string &vcf_prefix);
+static double sum_lengths_scalar(
+    const double *distances,
+    const int *starting_sites,
+    const int *ending_sites,
+    size_t num_intervals,
+    double *lengths,
+    double total);
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2"))) static double sum_lengths_avx2(
+    const double *distances,
+    const int *starting_sites,
+    const int *ending_sites,
+    size_t num_intervals,
+    double *lengths,
+    double total);
+#endif
+static bool use_avx2();
+
+// Length of the analysed regions of all chromosomes
 double TOTAL_LENGTH = 0;
+// Chromosomes analysed, autosomes 1 to NUM_AUTOSOMES unless configured otherwise
+static std::vector<struct chromosome_region> chromosomes = get_autosomes();
+// Whether a chromosome is only analysed in part, so that segments are clipped
+static bool has_partial_regions = false;
 // Genetic maps for all chromosomes
 static std::vector<std::unique_ptr<std::vector<double>>> maps;
+// Base-pair positions of the sites of all chromosomes, read from their VCFs when
+// segments are located by position
+static std::vector<std::vector<long>> positions;
+// Whether get_genetic_lengths gathers with AVX2, decided once for the CPU
+static bool avx2 = use_avx2();
 
-static std::unique_ptr<std::vector<double>> parse_map(int chromosome_number, std::string &map_path);
+
+/**
+ * Parse a comma-separated list of chromosomes, e.g. "1-22,X" or "20:0-50000,21,22".
+ * A range of numbers is one chromosome for each number. A chromosome can be
+ * followed by a range of sites to analyse, e.g. "20:1000-" from site 1000 to the
+ * end of the map.
+ *
+ * @param list the list to parse.
+ * @param regions filled with the chromosomes in the order they are listed.
+ *
+ * @return whether the list is well-formed and names every chromosome once.
+ */
+bool
+parse_chromosome_regions(const std::string &list, std::vector<struct chromosome_region> &regions)
+{
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        size_t colon = item.find(':');
+        size_t dash = item.find('-');
+        if (colon != std::string::npos) {
+            struct chromosome_region region;
+            region.name = item.substr(0, colon);
+            if (region.name.empty() || !parse_site_range(item.substr(colon + 1), region)) {
+                return false;
+            }
+            regions.push_back(region);
+        } else if (dash != std::string::npos) {
+            int first = std::atoi(item.substr(0, dash).c_str());
+            int last = std::atoi(item.substr(dash + 1).c_str());
+            if (first < 1 || first > last) {
+                return false;
+            }
+            for (int number = first; number <= last; ++number) {
+                struct chromosome_region region;
+                region.name = std::to_string(number);
+                regions.push_back(region);
+            }
+        } else if (!item.empty()) {
+            struct chromosome_region region;
+            region.name = item;
+            regions.push_back(region);
+        } else {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < regions.size(); ++i) {
+        for (size_t j = 0; j < i; ++j) {
+            if (regions[i].name == regions[j].name) {
+                return false;
+            }
+        }
+    }
+    return !regions.empty();
+}
+
+
+/**
+ * Set the chromosomes analysed from now on. Must be called before init_maps.
+ *
+ * @param regions chromosomes, numbered from 1 in this order.
+ */
+void
+set_chromosomes(const std::vector<struct chromosome_region> &regions)
+{
+    chromosomes = regions;
+    has_partial_regions = false;
+    for (const struct chromosome_region &region : chromosomes) {
+        if (region.starting_site != 0 || region.ending_site != -1) {
+            has_partial_regions = true;
+        }
+    }
+}
+
+
+/**
+ * @return number of chromosomes analysed.
+ */
+int
+get_num_chromosomes()
+{
+    return chromosomes.size();
+}
+
+
+/**
+ * @param chromosome_number number of a chromosome, from 1.
+ *
+ * @return the chromosome. Its ending site is resolved once its map has been read.
+ */
+const struct chromosome_region&
+get_chromosome(int chromosome_number)
+{
+    return chromosomes[chromosome_number - 1];
+}
+
+
+/**
+ * @param name name of a chromosome.
+ *
+ * @return number of the chromosome, 0 if it is not analysed.
+ */
+int
+get_chromosome_number(const std::string &name)
+{
+    for (size_t i = 0; i < chromosomes.size(); ++i) {
+        if (chromosomes[i].name == name) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
 
 
 /**
- * Read genetic maps for all the chromosomes.
+ * Clip a segment to the analysed region of its chromosome.
+ *
+ * @param chromosome_number
+ * @param starting_site first site of the segment, moved to the region.
+ * @param ending_site last site of the segment, moved to the region.
+ *
+ * @return whether any of the segment is in the region.
+ */
+bool
+clip_to_region(int chromosome_number, int &starting_site, int &ending_site)
+{
+    if (!has_partial_regions) {
+        return true;
+    }
+    const struct chromosome_region &region = chromosomes[chromosome_number - 1];
+    starting_site = std::max(starting_site, region.starting_site);
+    ending_site = std::min(ending_site, region.ending_site);
+    return starting_site < ending_site;
+}
+
+
+/**
+ * Read genetic maps for all the chromosomes. TOTAL_LENGTH becomes the length of
+ * their analysed regions.
  *
  * @param map_path folder in which genetic maps are stored.
  */
 void
 init_maps(std::string &map_path)
 {
-    for (int chrom = 1; chrom <= NUM_CHROMOSOMES; ++chrom) {
+    TOTAL_LENGTH = 0;
+    for (int chrom = 1; chrom <= get_num_chromosomes(); ++chrom) {
         maps.push_back(parse_map(chrom, map_path));
     }
 }
 
 
+/**
+ * Set TOTAL_LENGTH to the length of the analysed regions of all chromosomes
+ * without keeping their genetic maps, for steps that classify pairs but never
+ * look up a site.
+ *
+ * @param map_path folder in which genetic maps are stored.
+ */
+void
+init_total_length(std::string &map_path)
+{
+    TOTAL_LENGTH = 0;
+    for (int chrom = 1; chrom <= get_num_chromosomes(); ++chrom) {
+        parse_map(chrom, map_path);
+    }
+}
+
+
 /**
  * Free all read genetic maps.
  */
@@ -44,6 +241,50 @@ void
 deinit_maps()
 {
     maps.clear();
+    positions.clear();
+}
+
+
+/**
+ * Read the base-pair positions of the sites of all chromosomes, so that segments
+ * located by position can be converted to sites. Genetic maps must have been
+ * initialized, and each VCF must have a site for each row of its map.
+ *
+ * @param vcf_prefix path of the VCFs up to the chromosome name. Assume the VCF of
+ *     a chromosome is named {vcf_prefix}{name}.vcf.gz.
+ */
+void
+init_positions(const std::string &vcf_prefix)
+{
+    std::vector<std::future<std::vector<long>>> futures;
+    for (int chrom = 1; chrom <= get_num_chromosomes(); ++chrom) {
+        futures.push_back(std::async(std::launch::async, parse_positions, chrom, std::cref(vcf_prefix)));
+    }
+    positions.clear();
+    for (std::future<std::vector<long>> &f : futures) {
+        positions.push_back(f.get());
+    }
+}
+
+
+/**
+ * Convert a segment located by base-pair positions to the sites it spans.
+ *
+ * @param chromosome_number
+ * @param start_position first base pair of the segment.
+ * @param end_position last base pair of the segment.
+ * @param starting_site filled with the first site at or after start_position.
+ * @param ending_site filled with the last site at or before end_position.
+ *
+ * @return whether the segment spans more than one site.
+ */
+bool
+get_sites(int chromosome_number, long start_position, long end_position, int &starting_site, int &ending_site)
+{
+    const std::vector<long> &sites = positions[chromosome_number - 1];
+    starting_site = std::lower_bound(sites.begin(), sites.end(), start_position) - sites.begin();
+    ending_site = std::upper_bound(sites.begin(), sites.end(), end_position) - sites.begin() - 1;
+    return starting_site < ending_site;
 }
 
 
@@ -53,24 +294,26 @@ std::unique_ptr<T> make_unique(Args&&... args) {
 }
 
 /**
- * Read the genetic map of one chromosome. Add the length of the chromosome to
- * TOTAL_LENGTH.
+ * Read the genetic map of one chromosome. Add the length of its analysed region
+ * to TOTAL_LENGTH.
  *
  * @param chromosome_number
  * @param map_path folder in which the genetic map is stored. Assume the the map
- *     is named as chr{xx}.rMap.
+ *     is named as chr{name}.rMap.
  *
  * @return unique pointer to a vector of genetic distances.
  */
 static std::unique_ptr<std::vector<double>>
 parse_map(int chromosome_number, std::string &map_path)
 {
+    struct chromosome_region &region = chromosomes[chromosome_number - 1];
+    std::string file_path = map_path + "chr" + region.name + ".rMap";
 
     //std::cout << chromosome_number << "," << map_path << "\n";
     std::unique_ptr<std::vector<double>> p_distances = make_unique<std::vector<double>>();
     std::vector<double> &distances = *p_distances.get();
 
-    std::ifstream in {map_path + "chr" + std::to_string(chromosome_number) + ".rMap"};
+    std::ifstream in {file_path};
     std::string line;
 
     while (std::getline(in, line)) {
@@ -80,11 +323,70 @@ parse_map(int chromosome_number, std::string &map_path)
         distances.push_back(distance);
     }
 
-    TOTAL_LENGTH += distances.back() - distances.front();
+    if (distances.empty()) {
+        throw std::runtime_error {"Failed to read genetic map " + file_path};
+    }
+    if (region.ending_site == -1) {
+        region.ending_site = distances.size() - 1;
+    }
+    if (region.starting_site >= region.ending_site || region.ending_site >= (int) distances.size()) {
+        throw std::runtime_error {"Sites of chromosome " + region.name + " are outside its genetic map " + file_path};
+    }
+
+    TOTAL_LENGTH += distances[region.ending_site] - distances[region.starting_site];
     return p_distances;
 }
 
 
+/**
+ * Read the base-pair positions of the sites of one chromosome from its VCF.
+ *
+ * @param chromosome_number
+ * @param vcf_prefix path of the VCF up to the chromosome name.
+ *
+ * @return position of each site, in the order of the rows of the genetic map.
+ */
+static std::vector<long>
+parse_positions(int chromosome_number, const std::string &vcf_prefix)
+{
+    std::string file_path = vcf_prefix + chromosomes[chromosome_number - 1].name + ".vcf.gz";
+    std::ifstream file(file_path, std::ios_base::in | std::ios_base::binary);
+    if (!file) {
+        throw std::runtime_error {"Failed to open VCF " + file_path};
+    }
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> buffer;
+    buffer.push(boost::iostreams::gzip_decompressor());
+    buffer.push(file);
+    std::istream in(&buffer);
+
+    std::vector<long> sites;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        // POS is the second column
+        size_t sep = line.find('\t');
+        if (sep == std::string::npos) {
+            throw std::runtime_error {"Malformed VCF " + file_path};
+        }
+        long position = std::strtol(line.c_str() + sep + 1, NULL, 10);
+        if (!sites.empty() && position < sites.back()) {
+            throw std::runtime_error {"Sites of VCF " + file_path + " are not sorted by position"};
+        }
+        sites.push_back(position);
+    }
+
+    if (sites.size() != maps[chromosome_number - 1]->size()) {
+        throw std::runtime_error {
+            "VCF " + file_path + " has " + std::to_string(sites.size()) + " sites but its genetic map has " +
+            std::to_string(maps[chromosome_number - 1]->size())
+        };
+    }
+    return sites;
+}
+
+
 /**
  * Compute the genetic length between two sites.
  *
@@ -100,3 +402,181 @@ get_genetic_length(int starting_site, int ending_site, int chromosome_number)
     return distances[ending_site] - distances[starting_site];
 }
 
+
+/**
+ * Compute the genetic lengths of many intervals on one chromosome at once. The map
+ * of the chromosome is looked up once, and with AVX2 the sites of four intervals
+ * are gathered at a time. Lengths are added to total in the order of the intervals,
+ * so that the sum is the same with either kernel, and the same as adding
+ * get_genetic_length one at a time.
+ *
+ * @param starting_sites first site of each interval.
+ * @param ending_sites last site of each interval.
+ * @param num_intervals
+ * @param chromosome_number
+ * @param lengths filled with the length of each interval, unless NULL.
+ * @param total sum the lengths are added to.
+ *
+ * @return total plus the lengths of all intervals.
+ */
+double
+get_genetic_lengths(
+    const int *starting_sites,
+    const int *ending_sites,
+    size_t num_intervals,
+    int chromosome_number,
+    double *lengths,
+    double total)
+{
+    const double *distances = maps[chromosome_number - 1]->data();
+#ifdef HAVE_AVX2_KERNEL
+    if (avx2) {
+        return sum_lengths_avx2(distances, starting_sites, ending_sites, num_intervals, lengths, total);
+    }
+#endif
+    return sum_lengths_scalar(distances, starting_sites, ending_sites, num_intervals, lengths, total);
+}
+
+
+/**
+ * @return name of the kernel get_genetic_lengths uses on this CPU.
+ */
+const char *
+get_genetic_length_kernel()
+{
+    return avx2 ? "avx2" : "scalar";
+}
+
+
+/**
+ * Pick the kernel get_genetic_lengths uses instead of the one detected for the
+ * CPU, e.g. to compare the kernels. Not thread-safe.
+ *
+ * @param name "avx2" or "scalar".
+ *
+ * @return whether the kernel is available on this CPU.
+ */
+bool
+set_genetic_length_kernel(const std::string &name)
+{
+    if (name == "scalar") {
+        avx2 = false;
+        return true;
+    } else if (name == "avx2" && use_avx2()) {
+        avx2 = true;
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * Scalar kernel of get_genetic_lengths.
+ */
+static double
+sum_lengths_scalar(
+    const double *distances,
+    const int *starting_sites,
+    const int *ending_sites,
+    size_t num_intervals,
+    double *lengths,
+    double total)
+{
+    for (size_t i = 0; i < num_intervals; ++i) {
+        double length = distances[ending_sites[i]] - distances[starting_sites[i]];
+        if (lengths) {
+            lengths[i] = length;
+        }
+        total += length;
+    }
+    return total;
+}
+
+
+#ifdef HAVE_AVX2_KERNEL
+/**
+ * AVX2 kernel of get_genetic_lengths. The distances at the sites of four
+ * intervals are gathered at a time.
+ */
+__attribute__((target("avx2"))) static double
+sum_lengths_avx2(
+    const double *distances,
+    const int *starting_sites,
+    const int *ending_sites,
+    size_t num_intervals,
+    double *lengths,
+    double total)
+{
+    size_t i = 0;
+    for (; i + 4 <= num_intervals; i += 4) {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(starting_sites + i));
+        __m128i last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ending_sites + i));
+        __m256d starts = _mm256_i32gather_pd(distances, first, sizeof(double));
+        __m256d ends = _mm256_i32gather_pd(distances, last, sizeof(double));
+        double batch[4];
+        _mm256_storeu_pd(batch, _mm256_sub_pd(ends, starts));
+        if (lengths) {
+            std::copy(batch, batch + 4, lengths + i);
+        }
+        // In order, not as a horizontal sum
+        total += batch[0];
+        total += batch[1];
+        total += batch[2];
+        total += batch[3];
+    }
+    return sum_lengths_scalar(
+        distances, starting_sites + i, ending_sites + i, num_intervals - i, lengths ? lengths + i : NULL, total);
+}
+#endif
+
+
+/**
+ * @return whether get_genetic_lengths can gather with AVX2 on this CPU.
+ */
+static bool
+use_avx2()
+{
+#ifdef HAVE_AVX2_KERNEL
+    // Called by a static initializer, possibly before the one of the runtime
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+
+
+/**
+ * @return autosomes 1 to NUM_AUTOSOMES, analysed in full.
+ */
+static std::vector<struct chromosome_region>
+get_autosomes()
+{
+    std::vector<struct chromosome_region> autosomes(NUM_AUTOSOMES);
+    for (int i = 0; i < NUM_AUTOSOMES; ++i) {
+        autosomes[i].name = std::to_string(i + 1);
+    }
+    return autosomes;
+}
+
+
+/**
+ * Parse a range of sites, e.g. "1000-50000", or "1000-" up to the end of the map.
+ *
+ * @param range the range to parse.
+ * @param region filled with the first and last sites.
+ *
+ * @return whether the range is well-formed.
+ */
+static bool
+parse_site_range(const std::string &range, struct chromosome_region &region)
+{
+    size_t dash = range.find('-');
+    if (dash == std::string::npos || dash == 0) {
+        return false;
+    }
+    region.starting_site = std::atoi(range.substr(0, dash).c_str());
+    region.ending_site = dash + 1 == range.size() ? -1 : std::atoi(range.substr(dash + 1).c_str());
+    return region.starting_site >= 0 && (region.ending_site == -1 || region.ending_site > region.starting_site);
+}
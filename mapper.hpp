@@ -8,12 +8,84 @@
 #ifndef MAPPER_HPP
 #define MAPPER_HPP
 
+#include <cstddef>
 #include <string>
+#include <vector>
 
 extern double TOTAL_LENGTH;
 
+// Intervals GeneticLengthSum holds before their lengths are looked up at once
+#define GENETIC_LENGTH_BATCH 64
+
+// A chromosome analysed by a run. Chromosomes are numbered from 1 in the order
+// they are configured, and named in the files of their maps, VCFs and RaPID outputs.
+struct chromosome_region {
+    std::string name;
+    // First and last sites, i.e. rows of the genetic map, that are analysed.
+    // Segments are clipped to them. An ending site of -1 is the last site of the map.
+    int starting_site = 0;
+    int ending_site = -1;
+};
+
+bool parse_chromosome_regions(const std::string &list, std::vector<struct chromosome_region> &regions);
+void set_chromosomes(const std::vector<struct chromosome_region> &regions);
+int get_num_chromosomes();
+const struct chromosome_region &get_chromosome(int chromosome_number);
+int get_chromosome_number(const std::string &name);
+bool clip_to_region(int chromosome_number, int &starting_site, int &ending_site);
+
 void init_maps(std::string &map_path);
+void init_total_length(std::string &map_path);
 double get_genetic_length(int starting_site, int ending_site, int chromosome_number);
+double get_genetic_lengths(
+    const int *starting_sites,
+    const int *ending_sites,
+    size_t num_intervals,
+    int chromosome_number,
+    double *lengths,
+    double total);
+const char *get_genetic_length_kernel();
+bool set_genetic_length_kernel(const std::string &name);
 void deinit_maps();
 
+void init_positions(const std::string &vcf_prefix);
+bool get_sites(int chromosome_number, long start_position, long end_position, int &starting_site, int &ending_site);
+
+// Sum of the genetic lengths of intervals on one chromosome. Intervals are looked
+// up in batches with get_genetic_lengths, and are added in the order they were
+// given, so that the sum is the same as adding get_genetic_length one at a time.
+class GeneticLengthSum {
+public:
+    GeneticLengthSum(int chromosome_number, double total = 0) :
+        chromosome_number(chromosome_number), total(total) {}
+
+    void add(int starting_site, int ending_site)
+    {
+        starting_sites[size] = starting_site;
+        ending_sites[size] = ending_site;
+        if (++size == GENETIC_LENGTH_BATCH) {
+            flush();
+        }
+    }
+
+    double get()
+    {
+        flush();
+        return total;
+    }
+
+private:
+    void flush()
+    {
+        total = get_genetic_lengths(starting_sites, ending_sites, size, chromosome_number, nullptr, total);
+        size = 0;
+    }
+
+    int chromosome_number;
+    double total;
+    int starting_sites[GENETIC_LENGTH_BATCH];
+    int ending_sites[GENETIC_LENGTH_BATCH];
+    size_t size = 0;
+};
+
 #endif
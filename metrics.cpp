@@ -0,0 +1,393 @@
+/**
+ * This file is responsible for recording where a run spends its time, how much
+ * work it has done and how much memory it holds, and for reporting it as JSON or
+ * as a readable snapshot.
+ *
+ * Every worker thread only updates the metrics of its own chromosomes and its
+ * own barrier waits. They are read by the master thread while all worker
+ * threads are blocked at a synchronization, so no locking is needed.
+ *
+ */
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "metrics.hpp"
+
+static volatile std::sig_atomic_t report_requested = 0;
+
+static void request_report(int signal);
+static void write_stage_metrics(std::ostream &out, const struct stage_metrics &metrics);
+static double get_chromosome_seconds(const struct run_metrics &metrics, size_t chromosome);
+static double get_chromosome_eta(const struct run_metrics &metrics, size_t chromosome);
+static void write_seconds(std::ostream &out, double seconds);
+
+/**
+ * Add the times and counts of another part of a run to this one.
+ *
+ * @param other metrics of the other part.
+ */
+void
+stage_metrics::add(const struct stage_metrics &other)
+{
+    decompress += other.decompress;
+    parse_line += other.parse_line;
+    process_segment += other.process_segment;
+    update_total_ibd1 += other.update_total_ibd1;
+    barrier_wait += other.barrier_wait;
+    dump_range += other.dump_range;
+    calibration += other.calibration;
+    infer_candidates += other.infer_candidates;
+    segment_export += other.segment_export;
+    checkpoint += other.checkpoint;
+    num_lines += other.num_lines;
+    num_segments += other.num_segments;
+    num_short_segments += other.num_short_segments;
+    num_ids += other.num_ids;
+    num_pairs_created += other.num_pairs_created;
+    num_pairs_dumped += other.num_pairs_dumped;
+}
+
+
+/**
+ * @return resident set size of this process in bytes, 0 if unknown.
+ */
+uint64_t
+get_rss_bytes()
+{
+    // Total program size and resident set size in pages
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0;
+    uint64_t resident = 0;
+    if (!(statm >> size >> resident)) {
+        return 0;
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+/**
+ * @return largest resident set size this process has had in bytes.
+ */
+uint64_t
+get_peak_rss_bytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // In kilobytes on Linux
+    return (uint64_t) usage.ru_maxrss * 1024;
+}
+
+
+/**
+ * Estimate the seconds until all RaPID output has been parsed. Every chromosome
+ * is assumed to keep consuming compressed bytes at its rate so far.
+ *
+ * @param metrics snapshot of a run.
+ *
+ * @return seconds until the slowest chromosome is finished, negative if unknown
+ *     because a chromosome has not consumed anything yet.
+ */
+double
+get_parsing_eta(const struct run_metrics &metrics)
+{
+    double eta = 0;
+    for (size_t i = 0; i < metrics.progress.size(); ++i) {
+        double chromosome_eta = get_chromosome_eta(metrics, i);
+        if (chromosome_eta < 0) {
+            return -1;
+        }
+        eta = std::max(eta, chromosome_eta);
+    }
+    return eta;
+}
+
+
+/**
+ * Request a report with SIGUSR1, e.g. kill -USR1 {pid}. The request is answered
+ * at the next synchronization.
+ */
+void
+install_report_signal()
+{
+    std::signal(SIGUSR1, request_report);
+}
+
+
+/**
+ * @return whether a report has been requested since the last call.
+ */
+bool
+is_report_requested()
+{
+    if (!report_requested) {
+        return false;
+    }
+    report_requested = 0;
+    return true;
+}
+
+
+/**
+ * Write a snapshot of the metrics of a run as JSON. The file is replaced as a
+ * whole, so that a reader never sees a partial report.
+ *
+ * @param path path of the report.
+ * @param metrics the snapshot.
+ */
+void
+write_metrics(const std::string &path, const struct run_metrics &metrics)
+{
+    // Each thread with the chromosomes it parses
+    std::vector<struct stage_metrics> threads = metrics.threads;
+    for (size_t i = 0; i < metrics.chromosomes.size(); ++i) {
+        threads[metrics.chromosome_threads[i]].add(metrics.chromosomes[i]);
+    }
+
+    struct stage_metrics total = metrics.master;
+    for (const struct stage_metrics &thread : threads) {
+        total.add(thread);
+    }
+
+    std::string partial_path = path + ".partial";
+    std::ofstream out(partial_path, std::ios::out | std::ios::trunc);
+    out << std::fixed << std::setprecision(6);
+
+    out << "{\n";
+    out << "  \"finished\": " << (metrics.finished ? "true" : "false") << ",\n";
+    out << "  \"elapsed_seconds\": " << metrics.elapsed << ",\n";
+    out << "  \"individuals_processed\": " << metrics.num_processed << ",\n";
+    out << "  \"individuals\": " << metrics.num_ids << ",\n";
+    out << "  \"parsing_eta_seconds\": ";
+    write_seconds(out, get_parsing_eta(metrics));
+    out << ",\n";
+
+    const struct memory_metrics &memory = metrics.memory;
+    out << "  \"memory\": {\"rss_bytes\": " << memory.rss_bytes
+        << ", \"peak_rss_bytes\": " << memory.peak_rss_bytes
+        << ", \"matrix_bytes\": [";
+    for (size_t thread = 0; thread < memory.matrix_bytes.size(); ++thread) {
+        out << (thread ? ", " : "") << memory.matrix_bytes[thread];
+    }
+    out << "], \"peak_matrix_bytes\": " << memory.peak_matrix_bytes
+        << ", \"segment_bytes\": " << memory.segment_bytes
+        << ", \"peak_segment_bytes\": " << memory.peak_segment_bytes
+        << ", \"candidate_bytes\": " << memory.candidate_bytes
+        << ", \"temporary_bytes\": " << memory.temporary_bytes
+        << "},\n";
+    out << "  \"total\": ";
+    write_stage_metrics(out, total);
+    out << ",\n  \"master\": ";
+    write_stage_metrics(out, metrics.master);
+
+    out << ",\n  \"threads\": [";
+    for (size_t thread = 0; thread < threads.size(); ++thread) {
+        out << (thread ? ",\n" : "\n") << "    {\"thread\": " << thread << ", \"chromosomes\": [";
+        bool first = true;
+        for (size_t i = 0; i < metrics.chromosome_threads.size(); ++i) {
+            if (metrics.chromosome_threads[i] == (int) thread) {
+                out << (first ? "" : ", ") << "\"" << metrics.chromosome_names[i] << "\"";
+                first = false;
+            }
+        }
+        out << "], \"metrics\": ";
+        write_stage_metrics(out, threads[thread]);
+        out << "}";
+    }
+
+    out << "\n  ],\n  \"chromosomes\": [";
+    for (size_t i = 0; i < metrics.chromosomes.size(); ++i) {
+        out << (i ? ",\n" : "\n") << "    {\"chromosome\": \"" << metrics.chromosome_names[i] << "\""
+            << ", \"thread\": " << metrics.chromosome_threads[i] << ", \"metrics\": ";
+        write_stage_metrics(out, metrics.chromosomes[i]);
+        if (i < metrics.progress.size()) {
+            const struct chromosome_progress &progress = metrics.progress[i];
+            double seconds = get_chromosome_seconds(metrics, i);
+            out << ", \"finished\": " << (progress.finished ? "true" : "false")
+                << ", \"compressed_bytes\": " << progress.compressed_size
+                << ", \"compressed_bytes_read\": " << progress.compressed_read
+                << ", \"segment_bytes\": " << progress.segment_bytes
+                << ", \"segments_per_second\": " << (seconds > 0 ? metrics.chromosomes[i].num_segments / seconds : 0)
+                << ", \"individuals_per_second\": " << (seconds > 0 ? metrics.chromosomes[i].num_ids / seconds : 0)
+                << ", \"eta_seconds\": ";
+            write_seconds(out, get_chromosome_eta(metrics, i));
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+
+    out.close();
+    if (!out || std::rename(partial_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error {"Failed to write metrics to " + path};
+    }
+}
+
+
+/**
+ * Write a readable snapshot of a run: its progress, its memory and the throughput
+ * and ETA of every chromosome.
+ *
+ * @param out output.
+ * @param metrics the snapshot.
+ */
+void
+write_progress(std::ostream &out, const struct run_metrics &metrics)
+{
+    const double MB = 1 << 20;
+    const struct memory_metrics &memory = metrics.memory;
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+
+    double eta = get_parsing_eta(metrics);
+    out << "After " << metrics.elapsed << " s: " << metrics.num_processed << " of " << metrics.num_ids
+        << " individuals written, parsing ETA ";
+    if (eta < 0) {
+        out << "unknown";
+    } else {
+        out << eta << " s";
+    }
+    out << std::endl;
+
+    uint64_t matrix_bytes = 0;
+    for (uint64_t bytes : memory.matrix_bytes) {
+        matrix_bytes += bytes;
+    }
+    out << "Memory: RSS " << memory.rss_bytes / MB << " MB (peak " << memory.peak_rss_bytes / MB << " MB)"
+        << ", pair matrices " << matrix_bytes / MB << " MB (peak " << memory.peak_matrix_bytes / MB << " MB)"
+        << ", segments " << memory.segment_bytes / MB << " MB (peak " << memory.peak_segment_bytes / MB << " MB)"
+        << ", candidates " << memory.candidate_bytes / MB << " MB in memory"
+        << " and " << memory.temporary_bytes / MB << " MB in the temporary output" << std::endl;
+
+    out << std::setw(10) << "chromosome" << std::setw(8) << "thread" << std::setw(8) << "read"
+        << std::setw(14) << "segments/s" << std::setw(15) << "individuals/s" << std::setw(10) << "ETA (s)" << std::endl;
+    for (size_t i = 0; i < metrics.progress.size(); ++i) {
+        const struct chromosome_progress &progress = metrics.progress[i];
+        double seconds = get_chromosome_seconds(metrics, i);
+        double read = progress.finished || progress.compressed_size == 0 ?
+            1 : (double) progress.compressed_read / progress.compressed_size;
+        double chromosome_eta = get_chromosome_eta(metrics, i);
+
+        out << std::setw(10) << metrics.chromosome_names[i] << std::setw(8) << metrics.chromosome_threads[i]
+            << std::setw(7) << read * 100 << "%"
+            << std::setprecision(0)
+            << std::setw(14) << (seconds > 0 ? metrics.chromosomes[i].num_segments / seconds : 0)
+            << std::setw(15) << (seconds > 0 ? metrics.chromosomes[i].num_ids / seconds : 0)
+            << std::setprecision(1);
+        if (chromosome_eta < 0) {
+            out << std::setw(10) << "-";
+        } else {
+            out << std::setw(10) << chromosome_eta;
+        }
+        out << std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+
+/**
+ * Signal handler of SIGUSR1.
+ *
+ * @param signal the signal.
+ */
+static void
+request_report(int signal)
+{
+    report_requested = 1;
+}
+
+
+/**
+ * Write the metrics of one part of a run as a JSON object.
+ *
+ * @param out output.
+ * @param metrics the metrics.
+ */
+static void
+write_stage_metrics(std::ostream &out, const struct stage_metrics &metrics)
+{
+    out << "{\"seconds\": {"
+        << "\"decompress\": " << metrics.decompress
+        << ", \"parse_line\": " << metrics.parse_line
+        << ", \"process_segment\": " << metrics.process_segment
+        << ", \"update_total_ibd1\": " << metrics.update_total_ibd1
+        << ", \"barrier_wait\": " << metrics.barrier_wait
+        << ", \"dump_range\": " << metrics.dump_range
+        << ", \"calibration\": " << metrics.calibration
+        << ", \"infer_candidates\": " << metrics.infer_candidates
+        << ", \"segment_export\": " << metrics.segment_export
+        << ", \"checkpoint\": " << metrics.checkpoint
+        << "}, \"lines\": " << metrics.num_lines
+        << ", \"segments\": " << metrics.num_segments
+        << ", \"short_segments\": " << metrics.num_short_segments
+        << ", \"individuals\": " << metrics.num_ids
+        << ", \"pairs_created\": " << metrics.num_pairs_created
+        << ", \"pairs_dumped\": " << metrics.num_pairs_dumped
+        << "}";
+}
+
+
+/**
+ * @param metrics snapshot of a run.
+ * @param chromosome index of a chromosome.
+ *
+ * @return seconds the chromosome has been parsed for in this run.
+ */
+static double
+get_chromosome_seconds(const struct run_metrics &metrics, size_t chromosome)
+{
+    const struct chromosome_progress &progress = metrics.progress[chromosome];
+    return progress.finished ? progress.seconds : metrics.elapsed;
+}
+
+
+/**
+ * Estimate the seconds until a chromosome has been parsed from the compressed
+ * bytes it has consumed so far in this run.
+ *
+ * @param metrics snapshot of a run.
+ * @param chromosome index of a chromosome.
+ *
+ * @return the estimate, 0 if finished and negative if unknown.
+ */
+static double
+get_chromosome_eta(const struct run_metrics &metrics, size_t chromosome)
+{
+    const struct chromosome_progress &progress = metrics.progress[chromosome];
+    if (progress.finished) {
+        return 0;
+    }
+    if (progress.compressed_read <= progress.compressed_start) {
+        return -1;
+    }
+    uint64_t remaining = progress.compressed_size - std::min(progress.compressed_read, progress.compressed_size);
+    return metrics.elapsed * remaining / (progress.compressed_read - progress.compressed_start);
+}
+
+
+/**
+ * Write seconds as a JSON number, or null if negative, i.e. unknown.
+ *
+ * @param out output.
+ * @param seconds the seconds.
+ */
+static void
+write_seconds(std::ostream &out, double seconds)
+{
+    if (seconds < 0) {
+        out << "null";
+    } else {
+        out << seconds;
+    }
+}
@@ -0,0 +1,188 @@
+/**
+ * This file is responsible for recording where a run spends its time and how
+ * much work it has done, and for reporting it as JSON.
+ *
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Time spent and work done by one part of a run. Times are in seconds.
+struct stage_metrics {
+    // Reading lines of gzipped RaPID output, which includes decompressing it
+    double decompress = 0;
+    double parse_line = 0;
+    // Excluding update_total_ibd1
+    double process_segment = 0;
+    double update_total_ibd1 = 0;
+    // Waiting at the synchronization between cycles
+    double barrier_wait = 0;
+    double dump_range = 0;
+    // Calibration pre-pass before parsing
+    double calibration = 0;
+    double infer_candidates = 0;
+    // Writing the exported segments of selected pairs after parsing
+    double segment_export = 0;
+    double checkpoint = 0;
+    // Lines read from RaPID output
+    uint64_t num_lines = 0;
+    // Segments processed, i.e. lines that belong to this run
+    uint64_t num_segments = 0;
+    // Segments dropped for being shorter than the minimum length
+    uint64_t num_short_segments = 0;
+    // Individuals whose segments have been processed
+    uint64_t num_ids = 0;
+    // Pairs sharing segments on a chromosome
+    uint64_t num_pairs_created = 0;
+    // Pairs whose totals across chromosomes have been aggregated and written
+    uint64_t num_pairs_dumped = 0;
+
+    void add(const struct stage_metrics &other);
+};
+
+// Progress through the RaPID output of one chromosome and the memory it holds.
+struct chromosome_progress {
+    bool finished = false;
+    // Seconds from the start of the run until the chromosome was finished
+    double seconds = 0;
+    // Compressed bytes of RaPID output, in total, already consumed when this run
+    // started and consumed so far
+    uint64_t compressed_size = 0;
+    uint64_t compressed_start = 0;
+    uint64_t compressed_read = 0;
+    // Estimated bytes of the segments of the individual being parsed
+    uint64_t segment_bytes = 0;
+};
+
+// Live memory of a run, sampled at synchronizations. Sizes of containers are
+// estimated from their numbers of elements and buckets.
+struct memory_metrics {
+    // Pair matrix of each worker thread
+    std::vector<uint64_t> matrix_bytes;
+    uint64_t peak_matrix_bytes = 0;
+    // Segments of the individuals being parsed, on all chromosomes
+    uint64_t segment_bytes = 0;
+    uint64_t peak_segment_bytes = 0;
+    // Candidate pairs kept in memory and written to the temporary output
+    uint64_t candidate_bytes = 0;
+    uint64_t temporary_bytes = 0;
+    // Resident set size of the process, now and at its peak
+    uint64_t rss_bytes = 0;
+    uint64_t peak_rss_bytes = 0;
+};
+
+// Snapshot of the metrics of a run.
+struct run_metrics {
+    bool finished = false;
+    // Seconds since the run started
+    double elapsed = 0;
+    // Number of individuals written so far, out of num_ids
+    int num_processed = 0;
+    int num_ids = 0;
+    // Chromosome i is at index i - 1
+    std::vector<struct stage_metrics> chromosomes;
+    std::vector<std::string> chromosome_names;
+    // Worker thread parsing each chromosome
+    std::vector<int> chromosome_threads;
+    // Barrier waits of each worker thread. Chromosomes are added to their threads
+    // when reported.
+    std::vector<struct stage_metrics> threads;
+    struct stage_metrics master;
+    // Chromosome i is at index i - 1
+    std::vector<struct chromosome_progress> progress;
+    struct memory_metrics memory;
+};
+
+// Adds the time between consecutive laps to stage_metrics. Does nothing if
+// disabled, so that untimed runs do not read the clock.
+class StageTimer {
+public:
+    StageTimer(bool enabled);
+
+    void start();
+
+    void lap(double &seconds);
+
+private:
+    bool enabled;
+    std::chrono::steady_clock::time_point last;
+};
+
+/**
+ * Constructor of StageTimer. The first lap starts now.
+ *
+ * @param enabled whether times are taken.
+ */
+inline
+StageTimer::StageTimer(bool enabled) : enabled(enabled)
+{
+    start();
+}
+
+
+/**
+ * Start a new lap without recording the current one.
+ */
+inline void
+StageTimer::start()
+{
+    if (enabled) {
+        last = std::chrono::steady_clock::now();
+    }
+}
+
+
+/**
+ * Record the current lap and start a new one.
+ *
+ * @param seconds a time in stage_metrics the current lap is added to.
+ */
+inline void
+StageTimer::lap(double &seconds)
+{
+    if (enabled) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        seconds += std::chrono::duration<double>(now - last).count();
+        last = now;
+    }
+}
+
+
+/**
+ * Estimate the bytes held by an unordered_map or unordered_set, excluding what
+ * its elements point to.
+ *
+ * @param table the hash table.
+ *
+ * @return bytes of its buckets and of its nodes.
+ */
+template <class Table>
+inline uint64_t
+get_hash_table_bytes(const Table &table)
+{
+    // A node holds a pointer to the next node and the element
+    return table.bucket_count() * sizeof(void*) +
+        table.size() * (sizeof(void*) + sizeof(typename Table::value_type));
+}
+
+
+uint64_t get_rss_bytes();
+
+uint64_t get_peak_rss_bytes();
+
+double get_parsing_eta(const struct run_metrics &metrics);
+
+void install_report_signal();
+
+bool is_report_requested();
+
+void write_metrics(const std::string &path, const struct run_metrics &metrics);
+
+void write_progress(std::ostream &out, const struct run_metrics &metrics);
+
+#endif
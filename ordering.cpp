@@ -6,6 +6,7 @@
  */
 
 #include <fstream>
+#include <stdexcept>
 
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
@@ -24,6 +25,20 @@ Ordering::Ordering(std::string &file_path)
     get_id_ordering(file_path);
 }
 
+/**
+ * Constructor of Ordering from IDs that are already in order, e.g. IDs stored
+ * alongside results.
+ *
+ * @param ids IDs of all individuals, in the order of their indices.
+ */
+Ordering::Ordering(const std::vector<std::string> &ids) :
+    ids(ids)
+{
+    for (int index = 0; index < (int) ids.size(); ++index) {
+        id_to_index[ids[index]] = index;
+    }
+}
+
 /**
  * @param id an ID
  *
@@ -36,6 +51,26 @@ Ordering::get_index(std::string &id)
 }
 
 
+/**
+ * Look up an ID that may not be in the ordering, e.g. one read from the output
+ * of an IBD caller run on other samples. Unlike Ordering::get_index, the
+ * ordering is never modified, so that threads can look up IDs concurrently.
+ *
+ * @param id an ID
+ *
+ * @return the index of the ID in the ordering
+ */
+int
+Ordering::find_index(const std::string &id) const
+{
+    auto it = id_to_index.find(id);
+    if (it == id_to_index.end()) {
+        throw std::runtime_error {"Sample " + id + " is not in the VCF"};
+    }
+    return it->second;
+}
+
+
 /**
  * @return index of the last invidual.
  */
@@ -22,8 +22,12 @@ class Ordering {
 public:
 	Ordering(std::string &file_path);
 
+	Ordering(const std::vector<std::string> &ids);
+
 	int get_index(std::string &id);
 
+	int find_index(const std::string &id) const;
+
 	int get_last_index();
 
 	std::string& get(int index);
@@ -0,0 +1,479 @@
+/**
+ * This file is responsible for formatting rows of final output.
+ *
+ * Rows are formatted into a reusable buffer that is written to the underlying
+ * stream only when it is full or explicitly flushed, instead of flushing the
+ * stream after every row.
+ *
+ * predictions.txt.gz is a sequence of gzip members, one per buffer, compressed
+ * by up to num_threads threads at a time and written in order.
+ *
+ * predictions.bin starts with OUTPUT_MAGIC and the number of individuals as a
+ * uint32, followed by blocks of at most 65536 pairs. A block is the number of
+ * pairs n as a uint32, then the columns id1 (n uint32 indices), id2 (n uint32),
+ * kinship coefficient, IBD0, IBD1 and IBD2 (n float each) and type (n uint8
+ * indices of TYPES). Integers and floats are in native byte order. Index i is
+ * the ID on line i + 1 of the sample manifest predictions.samples.txt.
+ *
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+
+#include "classifier.hpp"
+#include "output_writer.hpp"
+
+// Digits after the decimal point of kinship coefficients and IBD probabilities
+#define PRECISION 4
+
+// Upper bound of the length of a formatted probability or kinship coefficient
+#define MAX_VALUE_LENGTH 32
+
+// First bytes of predictions.bin
+#define OUTPUT_MAGIC "RAFFIPB1"
+
+/**
+ * @param name name of an output format: tsv, tsv.gz or binary.
+ * @param format filled with the format.
+ *
+ * @return whether name is a known format.
+ */
+bool
+parse_output_format(const std::string &name, OutputFormat &format)
+{
+    if (name == "tsv") {
+        format = OutputFormat::TSV;
+    } else if (name == "tsv.gz") {
+        format = OutputFormat::TSV_GZ;
+    } else if (name == "binary") {
+        format = OutputFormat::BINARY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @param format
+ *
+ * @return name of the final output file in the output directory.
+ */
+std::string
+get_output_file_name(OutputFormat format)
+{
+    switch (format) {
+        case OutputFormat::TSV_GZ:
+            return "predictions.txt.gz";
+        case OutputFormat::BINARY:
+            return "predictions.bin";
+        default:
+            return "predictions.txt";
+    }
+}
+
+
+/**
+ * Write the IDs of all individuals, one per line in the order of their indices.
+ *
+ * @param path
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ */
+void
+write_sample_manifest(const std::string &path, Ordering &order)
+{
+    std::ofstream manifest(path, std::ios::out | std::ios::trunc);
+    for (int index = 0; index < order.size(); ++index) {
+        manifest << order.get(index) << "\n";
+    }
+    if (!manifest.flush()) {
+        throw std::runtime_error {"Failed to write " + path};
+    }
+}
+
+
+/**
+ * Create a writer of final output.
+ *
+ * @param format
+ * @param out final output, opened in binary mode.
+ * @param order an Ordering that maps indices of individuals to their IDs.
+ * @param num_threads number of threads compressing TSV_GZ output at a time.
+ *
+ * @return the writer.
+ */
+std::unique_ptr<OutputWriter>
+make_output_writer(
+    OutputFormat format,
+    std::ostream &out,
+    Ordering &order,
+    unsigned int num_threads)
+{
+    switch (format) {
+        case OutputFormat::TSV_GZ:
+            return std::unique_ptr<OutputWriter>(new GzipTsvWriter(out, order, num_threads));
+        case OutputFormat::BINARY:
+            return std::unique_ptr<OutputWriter>(new BinaryWriter(out, order));
+        default:
+            return std::unique_ptr<OutputWriter>(new TsvWriter(out, order));
+    }
+}
+
+
+/**
+ * Constructor of TsvWriter.
+ *
+ * @param out final output.
+ * @param order an Ordering that maps indices of individuals to their IDs.
+ * @param capacity number of bytes buffered before they are written to out.
+ */
+TsvWriter::TsvWriter(std::ostream &out, Ordering &order, size_t capacity) :
+    out(out),
+    order(order),
+    buffer(capacity),
+    size(0) {}
+
+
+/**
+ * Destructor of TsvWriter. Write out whatever is still buffered.
+ */
+TsvWriter::~TsvWriter()
+{
+    write_buffer();
+}
+
+
+/**
+ * Write the header of final output.
+ */
+void
+TsvWriter::write_header()
+{
+    static const char header[] = "ID1\tID2\tKINSHIP\tIBD0\tIBD1\tIBD2\tTYPE\n";
+    append(header, sizeof(header) - 1);
+}
+
+
+/**
+ * Write one pair to final output.
+ *
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param kinship_coefficient
+ * @param probability_ibd0
+ * @param probability_ibd1
+ * @param probability_ibd2
+ * @param encoding encoding of the type of relationship, an index of TYPES.
+ */
+void
+TsvWriter::write_pair(
+    int id1_index, int id2_index,
+    double kinship_coefficient, double probability_ibd0,
+    double probability_ibd1, double probability_ibd2,
+    int encoding)
+{
+    const std::string &id1 = order.get(id1_index);
+    const std::string &id2 = order.get(id2_index);
+    const std::string &type = TYPES[encoding];
+
+    reserve(id1.size() + id2.size() + type.size() + 4 * MAX_VALUE_LENGTH + 7);
+
+    append(id1.data(), id1.size());
+    buffer[size++] = '\t';
+    append(id2.data(), id2.size());
+    buffer[size++] = '\t';
+    append_fixed(kinship_coefficient);
+    buffer[size++] = '\t';
+    append_fixed(probability_ibd0);
+    buffer[size++] = '\t';
+    append_fixed(probability_ibd1);
+    buffer[size++] = '\t';
+    append_fixed(probability_ibd2);
+    buffer[size++] = '\t';
+    append(type.data(), type.size());
+    buffer[size++] = '\n';
+}
+
+
+/**
+ * Write out everything buffered and flush the underlying stream.
+ */
+void
+TsvWriter::flush()
+{
+    write_buffer();
+    if (!out.flush()) {
+        throw std::runtime_error {"Failed to write to output"};
+    }
+}
+
+
+/**
+ * Make room for length more bytes, writing out the buffer if it is too full.
+ * The buffer grows if a single row is longer than its capacity.
+ *
+ * @param length
+ */
+void
+TsvWriter::reserve(size_t length)
+{
+    if (size + length > buffer.size()) {
+        write_buffer();
+        if (length > buffer.size()) {
+            buffer.resize(length);
+        }
+    }
+}
+
+
+/**
+ * Append bytes to the buffer.
+ *
+ * @param data
+ * @param length
+ */
+void
+TsvWriter::append(const char *data, size_t length)
+{
+    reserve(length);
+    std::memcpy(buffer.data() + size, data, length);
+    size += length;
+}
+
+
+/**
+ * Append a value in fixed notation with PRECISION digits after the decimal point.
+ * Room must have been reserved.
+ *
+ * @param value
+ */
+void
+TsvWriter::append_fixed(double value)
+{
+    char *end = buffer.data() + size;
+    std::to_chars_result result = std::to_chars(end, end + MAX_VALUE_LENGTH, value, std::chars_format::fixed, PRECISION);
+    if (result.ec != std::errc()) {
+        throw std::runtime_error {"Failed to format " + std::to_string(value)};
+    }
+    size = result.ptr - buffer.data();
+}
+
+
+/**
+ * Write the buffer out as a block and empty it.
+ */
+void
+TsvWriter::write_buffer()
+{
+    if (size == 0) {
+        return;
+    }
+    write_block(buffer.data(), size);
+    size = 0;
+}
+
+
+/**
+ * Write a block of formatted rows to the underlying stream.
+ *
+ * @param data
+ * @param length
+ */
+void
+TsvWriter::write_block(const char *data, size_t length)
+{
+    out.write(data, length);
+}
+
+
+/**
+ * Constructor of GzipTsvWriter.
+ *
+ * @param out final output.
+ * @param order an Ordering that maps indices of individuals to their IDs.
+ * @param num_threads number of blocks compressed at a time.
+ */
+GzipTsvWriter::GzipTsvWriter(std::ostream &out, Ordering &order, unsigned int num_threads) :
+    TsvWriter(out, order),
+    num_threads(std::max(num_threads, 1u)) {}
+
+
+/**
+ * Destructor of GzipTsvWriter. Compress and write out whatever is still buffered.
+ */
+GzipTsvWriter::~GzipTsvWriter()
+{
+    write_buffer();
+    write_pending();
+}
+
+
+/**
+ * Compress and write out everything buffered and flush the underlying stream.
+ * The file ends with a complete gzip member afterwards.
+ */
+void
+GzipTsvWriter::flush()
+{
+    write_buffer();
+    write_pending();
+    if (!out.flush()) {
+        throw std::runtime_error {"Failed to write to output"};
+    }
+}
+
+
+/**
+ * Start compressing a block into a gzip member of its own. If num_threads blocks
+ * are already being compressed, wait for the oldest one and write it out first.
+ *
+ * @param data
+ * @param length
+ */
+void
+GzipTsvWriter::write_block(const char *data, size_t length)
+{
+    if (pending.size() >= num_threads) {
+        out << pending.front().get();
+        pending.pop_front();
+    }
+
+    pending.push_back(std::async(std::launch::async, [](std::string block) {
+        std::string member;
+        boost::iostreams::filtering_ostream compressor;
+        compressor.push(boost::iostreams::gzip_compressor());
+        compressor.push(boost::iostreams::back_inserter(member));
+        compressor.write(block.data(), block.size());
+        compressor.reset();
+        return member;
+    }, std::string(data, length)));
+}
+
+
+/**
+ * Wait for all blocks being compressed and write them out in order.
+ */
+void
+GzipTsvWriter::write_pending()
+{
+    while (!pending.empty()) {
+        out << pending.front().get();
+        pending.pop_front();
+    }
+}
+
+
+/**
+ * Constructor of BinaryWriter.
+ *
+ * @param out final output.
+ * @param order an Ordering that specifies the number of individuals.
+ * @param capacity number of pairs in a full block.
+ */
+BinaryWriter::BinaryWriter(std::ostream &out, Ordering &order, size_t capacity) :
+    out(out),
+    order(order),
+    capacity(capacity) {}
+
+
+/**
+ * Destructor of BinaryWriter. Write out whatever is still buffered.
+ */
+BinaryWriter::~BinaryWriter()
+{
+    write_block();
+}
+
+
+/**
+ * Write the magic number and the number of individuals.
+ */
+void
+BinaryWriter::write_header()
+{
+    uint32_t num_ids = order.size();
+    out.write(OUTPUT_MAGIC, sizeof(OUTPUT_MAGIC) - 1);
+    out.write(reinterpret_cast<const char *>(&num_ids), sizeof(num_ids));
+}
+
+
+/**
+ * Add one pair to the current block. The block is written out once it is full.
+ *
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param kinship_coefficient
+ * @param probability_ibd0
+ * @param probability_ibd1
+ * @param probability_ibd2
+ * @param encoding encoding of the type of relationship, an index of TYPES.
+ */
+void
+BinaryWriter::write_pair(
+    int id1_index, int id2_index,
+    double kinship_coefficient, double probability_ibd0,
+    double probability_ibd1, double probability_ibd2,
+    int encoding)
+{
+    id1_indices.push_back(id1_index);
+    id2_indices.push_back(id2_index);
+    kinship_coefficients.push_back(kinship_coefficient);
+    probabilities_ibd0.push_back(probability_ibd0);
+    probabilities_ibd1.push_back(probability_ibd1);
+    probabilities_ibd2.push_back(probability_ibd2);
+    encodings.push_back(encoding);
+
+    if (encodings.size() >= capacity) {
+        write_block();
+    }
+}
+
+
+/**
+ * Write out the current block and flush the underlying stream.
+ */
+void
+BinaryWriter::flush()
+{
+    write_block();
+    if (!out.flush()) {
+        throw std::runtime_error {"Failed to write to output"};
+    }
+}
+
+
+/**
+ * Write the current block column by column and start a new one.
+ */
+void
+BinaryWriter::write_block()
+{
+    uint32_t num_pairs = encodings.size();
+    if (num_pairs == 0) {
+        return;
+    }
+
+    out.write(reinterpret_cast<const char *>(&num_pairs), sizeof(num_pairs));
+    out.write(reinterpret_cast<const char *>(id1_indices.data()), num_pairs * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char *>(id2_indices.data()), num_pairs * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char *>(kinship_coefficients.data()), num_pairs * sizeof(float));
+    out.write(reinterpret_cast<const char *>(probabilities_ibd0.data()), num_pairs * sizeof(float));
+    out.write(reinterpret_cast<const char *>(probabilities_ibd1.data()), num_pairs * sizeof(float));
+    out.write(reinterpret_cast<const char *>(probabilities_ibd2.data()), num_pairs * sizeof(float));
+    out.write(reinterpret_cast<const char *>(encodings.data()), num_pairs * sizeof(uint8_t));
+
+    id1_indices.clear();
+    id2_indices.clear();
+    kinship_coefficients.clear();
+    probabilities_ibd0.clear();
+    probabilities_ibd1.clear();
+    probabilities_ibd2.clear();
+    encodings.clear();
+}
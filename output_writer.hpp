@@ -0,0 +1,139 @@
+/**
+ * This file is responsible for formatting rows of final output.
+ *
+ */
+
+#ifndef OUTPUT_WRITER_HPP
+#define OUTPUT_WRITER_HPP
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "ordering.hpp"
+
+enum class OutputFormat {
+    // Tab-separated text, predictions.txt
+    TSV,
+    // Tab-separated text compressed as a sequence of gzip members, predictions.txt.gz
+    TSV_GZ,
+    // Block-columnar binary with indices of individuals, predictions.bin
+    BINARY
+};
+
+bool parse_output_format(const std::string &name, OutputFormat &format);
+
+std::string get_output_file_name(OutputFormat format);
+
+void write_sample_manifest(const std::string &path, Ordering &order);
+
+class OutputWriter {
+public:
+    virtual ~OutputWriter() {}
+
+    virtual void write_header() = 0;
+
+    virtual void write_pair(
+        int id1_index, int id2_index,
+        double kinship_coefficient, double probability_ibd0,
+        double probability_ibd1, double probability_ibd2,
+        int encoding) = 0;
+
+    virtual void flush() = 0;
+
+    // Called once every pair has been written
+    virtual void close() { flush(); }
+};
+
+std::unique_ptr<OutputWriter> make_output_writer(
+    OutputFormat format,
+    std::ostream &out,
+    Ordering &order,
+    unsigned int num_threads);
+
+class TsvWriter : public OutputWriter {
+public:
+    TsvWriter(std::ostream &out, Ordering &order, size_t capacity = 1 << 20);
+
+    ~TsvWriter();
+
+    void write_header() override;
+
+    void write_pair(
+        int id1_index, int id2_index,
+        double kinship_coefficient, double probability_ibd0,
+        double probability_ibd1, double probability_ibd2,
+        int encoding) override;
+
+    void flush() override;
+
+protected:
+    std::ostream &out;
+
+    void write_buffer();
+    virtual void write_block(const char *data, size_t length);
+
+private:
+    Ordering &order;
+    std::vector<char> buffer;
+    size_t size;
+
+    void reserve(size_t length);
+    void append(const char *data, size_t length);
+    void append_fixed(double value);
+};
+
+class GzipTsvWriter : public TsvWriter {
+public:
+    GzipTsvWriter(std::ostream &out, Ordering &order, unsigned int num_threads);
+
+    ~GzipTsvWriter();
+
+    void flush() override;
+
+protected:
+    void write_block(const char *data, size_t length) override;
+
+private:
+    unsigned int num_threads;
+    // Blocks being compressed, in the order they are written
+    std::deque<std::future<std::string>> pending;
+
+    void write_pending();
+};
+
+class BinaryWriter : public OutputWriter {
+public:
+    BinaryWriter(std::ostream &out, Ordering &order, size_t capacity = 1 << 16);
+
+    ~BinaryWriter();
+
+    void write_header() override;
+
+    void write_pair(
+        int id1_index, int id2_index,
+        double kinship_coefficient, double probability_ibd0,
+        double probability_ibd1, double probability_ibd2,
+        int encoding) override;
+
+    void flush() override;
+
+private:
+    std::ostream &out;
+    Ordering &order;
+    size_t capacity;
+    std::vector<uint32_t> id1_indices;
+    std::vector<uint32_t> id2_indices;
+    std::vector<float> kinship_coefficients;
+    std::vector<float> probabilities_ibd0;
+    std::vector<float> probabilities_ibd1;
+    std::vector<float> probabilities_ibd2;
+    std::vector<uint8_t> encodings;
+
+    void write_block();
+};
+
+#endif
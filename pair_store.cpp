@@ -0,0 +1,203 @@
+/**
+ * This file is responsible for the per-chromosome pair store: the total IBD1 and
+ * IBD2 shared by every pair on one chromosome, sorted by the indices of the pair,
+ * so that chromosomes can be replaced and all pairs reclassified without
+ * reprocessing every chromosome.
+ *
+ * Each chromosome is stored in chr{i}.pairs.gz as a header followed by struct
+ * stored_pair records sorted by id1 and then id2. The file is written under a
+ * temporary name and only replaces a previous store once the chromosome is complete.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <tuple>
+#include <stdexcept>
+
+#include <boost/iostreams/filter/gzip.hpp>
+
+#include "pair_store.hpp"
+
+#define PAIR_STORE_MAGIC "RAFFIPS1"
+#define PAIR_STORE_MAGIC_LENGTH 8
+
+/**
+ * @param store_path folder of the pair store. Empty or ending with '/'.
+ * @param chromosome name of the chromosome.
+ *
+ * @return path of the file storing the chromosome.
+ */
+std::string
+get_pair_store_file(const std::string &store_path, const std::string &chromosome)
+{
+    return store_path + "chr" + chromosome + ".pairs.gz";
+}
+
+
+/**
+ * Constructor of PairStoreWriter. Opens {path}.partial for writing.
+ *
+ * @param path path of the file storing one chromosome.
+ * @param num_ids total number of individuals.
+ * @param offset size of a partial file to keep, as returned by
+ *     PairStoreWriter::sync before a checkpoint. 0 starts a new file.
+ */
+PairStoreWriter::PairStoreWriter(const std::string &path, int num_ids, uint64_t offset) :
+    path(path),
+    partial_path(path + ".partial"),
+    num_ids(num_ids),
+    writer(partial_path)
+{
+    writer.open(offset);
+    if (offset == 0) {
+        writer.stream().write(PAIR_STORE_MAGIC, PAIR_STORE_MAGIC_LENGTH);
+        writer.stream().write(reinterpret_cast<const char *>(&num_ids), sizeof(int));
+    }
+}
+
+
+/**
+ * Write the totals of all pairs of one individual on this chromosome.
+ * Individuals must be written in increasing order of their indices.
+ *
+ * @param id1_index index of the individual.
+ * @param pairs totals of the pairs. Sorted by id2_index in place.
+ */
+void
+PairStoreWriter::write(int id1_index, std::vector<struct stored_pair> &pairs)
+{
+    if (id1_index <= prev_id1_index) {
+        throw std::runtime_error {"RaPID output is not sorted by the first ID"};
+    }
+    prev_id1_index = id1_index;
+
+    std::sort(pairs.begin(), pairs.end(), [](const struct stored_pair &a, const struct stored_pair &b) {
+        return a.id2_index < b.id2_index;
+    });
+    if (!writer.stream().write(reinterpret_cast<const char *>(pairs.data()), pairs.size() * sizeof(struct stored_pair))) {
+        throw std::runtime_error {"Failed to write to pair store " + partial_path};
+    }
+}
+
+
+/**
+ * Close the current gzip member so that everything written so far is on disk,
+ * and start a new one.
+ *
+ * @return size of the partial file.
+ */
+uint64_t
+PairStoreWriter::sync()
+{
+    return writer.sync();
+}
+
+
+/**
+ * Finish writing and replace the previous store of this chromosome.
+ */
+void
+PairStoreWriter::close()
+{
+    writer.close();
+    if (std::rename(partial_path.c_str(), path.c_str())) {
+        throw std::runtime_error {"Failed to replace pair store " + path};
+    }
+}
+
+
+/**
+ * Constructor of PairStoreReader.
+ *
+ * @param path path of the file storing one chromosome.
+ * @param num_ids total number of individuals. Must match the number the store
+ *     was written with.
+ */
+PairStoreReader::PairStoreReader(const std::string &path, int num_ids) :
+    file(path, std::ios_base::in | std::ios_base::binary),
+    in(&buffer)
+{
+    if (!file) {
+        throw std::runtime_error {"Failed to open pair store " + path};
+    }
+    buffer.push(boost::iostreams::gzip_decompressor());
+    buffer.push(file);
+
+    char magic[PAIR_STORE_MAGIC_LENGTH];
+    int stored_num_ids;
+    if (!in.read(magic, PAIR_STORE_MAGIC_LENGTH) || std::memcmp(magic, PAIR_STORE_MAGIC, PAIR_STORE_MAGIC_LENGTH) ||
+        !in.read(reinterpret_cast<char *>(&stored_num_ids), sizeof(int))) {
+        throw std::runtime_error {"Not a pair store: " + path};
+    }
+    if (stored_num_ids != num_ids) {
+        throw std::runtime_error {"Pair store was written for a different set of individuals: " + path};
+    }
+}
+
+
+/**
+ * @param pair the next pair to be filled.
+ *
+ * @return false if there are no more pairs.
+ */
+bool
+PairStoreReader::next(struct stored_pair &pair)
+{
+    return (bool) in.read(reinterpret_cast<char *>(&pair), sizeof(struct stored_pair));
+}
+
+
+/**
+ * Merge the stores of several chromosomes and pass every pair with its totals
+ * across these chromosomes to consume, in increasing order of id1 and then id2.
+ * Only one pair per chromosome is held in memory.
+ *
+ * @param paths files storing one chromosome each.
+ * @param num_ids total number of individuals.
+ * @param consume called with id1_index, id2_index and a struct pair_stats in which
+ *     total_ibd1 excludes IBD2, as aggregated by dump_range.
+ */
+void
+merge_pair_stores(
+    const std::vector<std::string> &paths,
+    int num_ids,
+    const std::function<void(int, int, const struct pair_stats &)> &consume)
+{
+    std::vector<std::unique_ptr<PairStoreReader>> readers;
+    std::vector<struct stored_pair> heads(paths.size());
+
+    // Min-heap of (id1_index, id2_index, reader)
+    typedef std::tuple<int, int, int> key;
+    std::priority_queue<key, std::vector<key>, std::greater<key>> heap;
+
+    for (unsigned int i = 0; i < paths.size(); ++i) {
+        readers.push_back(std::make_unique<PairStoreReader>(paths[i], num_ids));
+        if (readers[i]->next(heads[i])) {
+            heap.emplace(heads[i].id1_index, heads[i].id2_index, i);
+        }
+    }
+
+    while (!heap.empty()) {
+        int id1_index = std::get<0>(heap.top());
+        int id2_index = std::get<1>(heap.top());
+        struct pair_stats stats;
+
+        // Sum the pair over all chromosomes
+        while (!heap.empty() && std::get<0>(heap.top()) == id1_index && std::get<1>(heap.top()) == id2_index) {
+            int i = std::get<2>(heap.top());
+            heap.pop();
+
+            stats.total_ibd1 += heads[i].total_ibd1 - heads[i].total_ibd2;
+            stats.total_ibd2 += heads[i].total_ibd2;
+
+            if (readers[i]->next(heads[i])) {
+                heap.emplace(heads[i].id1_index, heads[i].id2_index, i);
+            }
+        }
+
+        consume(id1_index, id2_index, stats);
+    }
+}
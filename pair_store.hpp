@@ -0,0 +1,69 @@
+/**
+ * This file is responsible for the per-chromosome pair store: the total IBD1 and
+ * IBD2 shared by every pair on one chromosome, sorted by the indices of the pair,
+ * so that chromosomes can be replaced and all pairs reclassified without
+ * reprocessing every chromosome.
+ *
+ */
+
+#ifndef PAIR_STORE_HPP
+#define PAIR_STORE_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <functional>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+
+#include "parser.hpp"
+#include "gzip_member_writer.hpp"
+
+// Totals of a pair on one chromosome
+struct stored_pair {
+    int id1_index;
+    int id2_index;
+    // Total length covered by segments on any haplotype combination, as in the matrices
+    double total_ibd1;
+    double total_ibd2;
+};
+
+std::string get_pair_store_file(const std::string &store_path, const std::string &chromosome);
+
+class PairStoreWriter {
+public:
+    PairStoreWriter(const std::string &path, int num_ids, uint64_t offset);
+
+    void write(int id1_index, std::vector<struct stored_pair> &pairs);
+
+    uint64_t sync();
+
+    void close();
+
+private:
+    std::string path;
+    std::string partial_path;
+    int num_ids;
+    int prev_id1_index = -1;
+    GzipMemberWriter writer;
+};
+
+class PairStoreReader {
+public:
+    PairStoreReader(const std::string &path, int num_ids);
+
+    bool next(struct stored_pair &pair);
+
+private:
+    std::ifstream file;
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> buffer;
+    std::istream in;
+};
+
+void merge_pair_stores(
+    const std::vector<std::string> &paths,
+    int num_ids,
+    const std::function<void(int, int, const struct pair_stats &)> &consume);
+
+#endif
@@ -0,0 +1,241 @@
+/**
+ * This file is responsible for the pair-totals sidecar: the total IBD1 and IBD2
+ * of every pair above a kinship floor together with the full-sibling calibration
+ * of the run, so that pairs can be reclassified without parsing RaPID output.
+ *
+ * The sidecar is a sequence of gzip members holding, in order, PAIR_TOTALS_MAGIC,
+ * the total genome length and the kinship floor as doubles, the number of
+ * individuals as an int and their IDs (each an int length followed by its
+ * characters), struct pair_totals_record records, a record with id1_index -1 and
+ * the struct classifier_state at the end of the run. The file is written under a
+ * temporary name and only appears once the run is complete.
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/iostreams/filter/gzip.hpp>
+
+#include "mapper.hpp"
+#include "pair_totals.hpp"
+
+#define PAIR_TOTALS_MAGIC "RAFFIPT1"
+#define PAIR_TOTALS_MAGIC_LENGTH 8
+
+/**
+ * @param output_path output directory. Empty or ending with '/'.
+ *
+ * @return path of the sidecar.
+ */
+std::string
+get_pair_totals_file(const std::string &output_path)
+{
+    return output_path + "pairs.totals";
+}
+
+
+/**
+ * Constructor of PairTotalsWriter. Opens {path}.partial for writing.
+ *
+ * @param path path of the sidecar.
+ * @param order an Ordering whose IDs are embedded in the sidecar.
+ * @param floor pairs with kinship coefficients below this are not written.
+ * @param offset size of a partial file to keep, as returned by
+ *     PairTotalsWriter::sync before a checkpoint. 0 starts a new file.
+ */
+PairTotalsWriter::PairTotalsWriter(const std::string &path, Ordering &order, double floor, uint64_t offset) :
+    path(path),
+    partial_path(path + ".partial"),
+    floor(floor),
+    writer(partial_path)
+{
+    writer.open(offset);
+    if (offset > 0) {
+        return;
+    }
+
+    std::ostream &out = writer.stream();
+    int num_ids = order.size();
+    out.write(PAIR_TOTALS_MAGIC, PAIR_TOTALS_MAGIC_LENGTH);
+    out.write(reinterpret_cast<const char *>(&TOTAL_LENGTH), sizeof(double));
+    out.write(reinterpret_cast<const char *>(&floor), sizeof(double));
+    out.write(reinterpret_cast<const char *>(&num_ids), sizeof(int));
+    for (int index = 0; index < num_ids; ++index) {
+        const std::string &id = order.get(index);
+        int length = id.size();
+        out.write(reinterpret_cast<const char *>(&length), sizeof(int));
+        out.write(id.data(), length);
+    }
+}
+
+
+/**
+ * Write the totals of a pair if its kinship coefficient is at least the floor.
+ *
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param stats total IBD1 (excluding IBD2) and total IBD2 shared by the pair
+ *     across all chromosomes.
+ */
+void
+PairTotalsWriter::write(int id1_index, int id2_index, const struct pair_stats &stats)
+{
+    if (compute_kinship_coefficient(stats.total_ibd1, stats.total_ibd2) < floor) {
+        return;
+    }
+
+    struct pair_totals_record record {id1_index, id2_index, stats.total_ibd1, stats.total_ibd2};
+    if (!writer.stream().write(reinterpret_cast<const char *>(&record), sizeof(struct pair_totals_record))) {
+        throw std::runtime_error {"Failed to write to " + partial_path};
+    }
+}
+
+
+/**
+ * Close the current gzip member so that everything written so far is on disk,
+ * and start a new one.
+ *
+ * @return size of the partial file.
+ */
+uint64_t
+PairTotalsWriter::sync()
+{
+    return writer.sync();
+}
+
+
+/**
+ * Write the calibration of the run and move the sidecar into place.
+ *
+ * @param state full-sibling calibration and thresholds at the end of the run.
+ */
+void
+PairTotalsWriter::close(const struct classifier_state &state)
+{
+    struct pair_totals_record end {-1, -1, 0, 0};
+    std::ostream &out = writer.stream();
+    out.write(reinterpret_cast<const char *>(&end), sizeof(struct pair_totals_record));
+    out.write(reinterpret_cast<const char *>(&state), sizeof(struct classifier_state));
+    if (!out) {
+        throw std::runtime_error {"Failed to write to " + partial_path};
+    }
+    writer.close();
+
+    if (std::rename(partial_path.c_str(), path.c_str())) {
+        throw std::runtime_error {"Failed to move " + partial_path + " into place"};
+    }
+}
+
+
+/**
+ * Constructor of PairTotalsReader. Reads the header of the sidecar.
+ *
+ * @param path path of the sidecar.
+ */
+PairTotalsReader::PairTotalsReader(const std::string &path) :
+    path(path),
+    file(path, std::ios_base::in | std::ios_base::binary),
+    in(&buffer)
+{
+    if (!file) {
+        throw std::runtime_error {"Failed to open " + path};
+    }
+    buffer.push(boost::iostreams::gzip_decompressor());
+    buffer.push(file);
+
+    char magic[PAIR_TOTALS_MAGIC_LENGTH];
+    int num_ids;
+    if (!in.read(magic, PAIR_TOTALS_MAGIC_LENGTH) ||
+        std::memcmp(magic, PAIR_TOTALS_MAGIC, PAIR_TOTALS_MAGIC_LENGTH) ||
+        !in.read(reinterpret_cast<char *>(&total_length), sizeof(double)) ||
+        !in.read(reinterpret_cast<char *>(&floor), sizeof(double)) ||
+        !in.read(reinterpret_cast<char *>(&num_ids), sizeof(int))) {
+        throw std::runtime_error {"Not a pair-totals sidecar: " + path};
+    }
+
+    ids.resize(num_ids);
+    for (std::string &id : ids) {
+        int length;
+        if (!in.read(reinterpret_cast<char *>(&length), sizeof(int))) {
+            throw std::runtime_error {"Truncated pair-totals sidecar: " + path};
+        }
+        id.resize(length);
+        if (!in.read(&id[0], length)) {
+            throw std::runtime_error {"Truncated pair-totals sidecar: " + path};
+        }
+    }
+}
+
+
+/**
+ * @return IDs of all individuals, in the order of their indices.
+ */
+const std::vector<std::string>&
+PairTotalsReader::get_ids()
+{
+    return ids;
+}
+
+
+/**
+ * @return total length of the genome the totals were computed on.
+ */
+double
+PairTotalsReader::get_total_length()
+{
+    return total_length;
+}
+
+
+/**
+ * @return kinship coefficient below which pairs were not written.
+ */
+double
+PairTotalsReader::get_floor()
+{
+    return floor;
+}
+
+
+/**
+ * Read the next pair.
+ *
+ * @param pair filled with the next pair.
+ *
+ * @return false after the last pair, once the calibration has been read.
+ */
+bool
+PairTotalsReader::next(struct pair_totals_record &pair)
+{
+    if (finished) {
+        return false;
+    }
+    if (!in.read(reinterpret_cast<char *>(&pair), sizeof(struct pair_totals_record))) {
+        throw std::runtime_error {"Truncated pair-totals sidecar: " + path};
+    }
+    if (pair.id1_index >= 0) {
+        return true;
+    }
+
+    if (!in.read(reinterpret_cast<char *>(&state), sizeof(struct classifier_state))) {
+        throw std::runtime_error {"Truncated pair-totals sidecar: " + path};
+    }
+    finished = true;
+    return false;
+}
+
+
+/**
+ * @return full-sibling calibration and thresholds at the end of the run. Only
+ *     available once next has returned false.
+ */
+const struct classifier_state&
+PairTotalsReader::get_classifier_state()
+{
+    if (!finished) {
+        throw std::runtime_error {"Calibration is stored after all pairs"};
+    }
+    return state;
+}
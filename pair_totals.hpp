@@ -0,0 +1,77 @@
+/**
+ * This file is responsible for the pair-totals sidecar: the total IBD1 and IBD2
+ * of every pair above a kinship floor together with the full-sibling calibration
+ * of the run, so that pairs can be reclassified without parsing RaPID output.
+ *
+ */
+
+#ifndef PAIR_TOTALS_HPP
+#define PAIR_TOTALS_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+
+#include "parser.hpp"
+#include "gzip_member_writer.hpp"
+#include "ordering.hpp"
+#include "classifier.hpp"
+
+// Totals of a pair across all chromosomes, as given to the classifier
+struct pair_totals_record {
+    int id1_index;
+    int id2_index;
+    // Total IBD1 excluding IBD2
+    double total_ibd1;
+    double total_ibd2;
+};
+
+std::string get_pair_totals_file(const std::string &output_path);
+
+class PairTotalsWriter {
+public:
+    PairTotalsWriter(const std::string &path, Ordering &order, double floor, uint64_t offset);
+
+    void write(int id1_index, int id2_index, const struct pair_stats &stats);
+
+    uint64_t sync();
+
+    void close(const struct classifier_state &state);
+
+private:
+    std::string path;
+    std::string partial_path;
+    double floor;
+    GzipMemberWriter writer;
+};
+
+class PairTotalsReader {
+public:
+    PairTotalsReader(const std::string &path);
+
+    const std::vector<std::string> &get_ids();
+
+    double get_total_length();
+
+    double get_floor();
+
+    bool next(struct pair_totals_record &pair);
+
+    const struct classifier_state &get_classifier_state();
+
+private:
+    std::string path;
+    std::ifstream file;
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> buffer;
+    std::istream in;
+    std::vector<std::string> ids;
+    double total_length;
+    double floor;
+    bool finished = false;
+    struct classifier_state state;
+};
+
+#endif
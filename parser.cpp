@@ -16,12 +16,18 @@
 #include <mutex>
 #include <unordered_map>
 #include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
 
 #include <stdio.h>
 #include <string.h>
 
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <boost/filesystem.hpp>
 
 #include "mapper.hpp"
 #include "parser.hpp"
@@ -29,21 +35,31 @@
 #include "proceed.hpp"
 #include "dumpable.hpp"
 #include "ordering.hpp"
+#include "candidate_store.hpp"
+#include "checkpoint.hpp"
+#include "pair_store.hpp"
+#include "output_writer.hpp"
+#include "pair_totals.hpp"
+#include "metrics.hpp"
+#include "parser_kernels.hpp"
+#include "calibration.hpp"
+#include "segment_export.hpp"
+#include "kinship_matrix.hpp"
 #include "RaPIDaffin.hpp"
 #include <vector>
 
 // Number of individuals to process on one chromosome between two synchronizations
 #define NUM_IDS_PER_CYCLE 1000
 
-// Information parsed from a line.
-struct line_info {
-    int id1_index = -1;
-    int id2_index = -1;
-    int hap1;
-    int hap2;
-    int starting_site;
-    int ending_site;
-};
+// Name of the checkpoint file in the output directory
+#define CHECKPOINT_FILE "raffi.checkpoint"
+
+// Segments shorter than these in cM are dropped by default when the largest degree
+// is 1, 2 or 3. Nothing is dropped for 4th degree.
+#define MIN_SEGMENT_LENGTH_FIRST 10
+#define MIN_SEGMENT_LENGTH_SECOND 7
+#define MIN_SEGMENT_LENGTH_THIRD 5
+
 
 static inline int haps_to_encoding(int hap1, int hap2);
 static inline int haps_encoding_to_complement(int encoding);
@@ -53,30 +69,33 @@ static inline int get_intersection_end(int end1, int end2);
 static inline std::unique_ptr<std::vector<std::pair<int, int>>> merge_two_segment_vectors(
     std::vector<std::pair<int, int>> &segments1,
     std::vector<std::pair<int, int>> &segments2);
-static inline std::unique_ptr<std::vector<std::pair<int, int>>> merge_four_segment_vectors(
-    std::vector<std::pair<int, int>> &segments1,
-    std::vector<std::pair<int, int>> &segments2,
-    std::vector<std::pair<int, int>> &segments3,
-    std::vector<std::pair<int, int>> &segments4);
-static inline double compute_total_ibd1(
-    std::vector<std::pair<int, int>> &segments,
-    int chromosome_number);
-static void parse_line(
-    std::string &line,
-    struct line_info &info,
-    class Ordering &order);
-static void update_total_ibd1(
+static void store_total_ibd(
     int chromosome_number,
     int id_index,
     std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> &id_to_haps_to_segment,
-    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix);
-static bool process_segment(
-    struct line_info &info,
+    PairStoreWriter &store);
+static void store_segments(
     int chromosome_number,
-    int chromosome_start,
-    std::vector<int> &prev_ids,
+    int id_index,
     std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> &id_to_haps_to_segment,
-    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix);
+    SegmentSpoolWriter &spool);
+static std::vector<std::pair<int, int>> merge_overlapping_segments(std::vector<std::pair<int, int>> &segments);
+static inline bool split_fields(const std::string &line, const char **fields, size_t *lengths, int num_fields);
+static inline bool locate_segment(
+    struct line_info &info,
+    int chromosome_number,
+    long start_position,
+    long end_position,
+    const std::pair<int, int> &id1_range);
+static inline bool is_ilash_haplotype(const char *field, size_t length);
+template <typename Source>
+static void build_pair_store(
+    int chromosome_number,
+    class Ordering &order,
+    std::string &rapid_output_path,
+    std::string &pair_store_path,
+    double min_segment_length);
+template <typename Source>
 static void worker(
     int thread,
     int num_threads,
@@ -84,10 +103,44 @@ static void worker(
     Dumpable &dumpable,
     class Ordering &order,
     std::string &rapid_output_path,
+    const std::pair<int, int> &id1_range,
     int chromosome_start,
     int chromosome_end,
-    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix);
+    std::vector<struct chromosome_state> &chromosomes,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix,
+    double min_segment_length,
+    bool timed,
+    struct stage_metrics &thread_metrics);
 static int get_min_kinship_coefficient(int max_degree);
+static std::pair<int, int> get_shard_range(int num_ids, int shard, int num_shards);
+static std::string get_temporary_file(const struct master_options &options);
+static double get_pair_totals_floor(const struct master_options &options);
+static double get_min_segment_length(const struct master_options &options);
+static std::unique_ptr<OutputWriter> open_output(
+    const struct master_options &options,
+    Ordering &order,
+    std::ofstream &file,
+    bool resume,
+    uint64_t offset);
+static void map_chromosomes(
+    Ordering &order,
+    std::string &rapid_output_path,
+    const struct master_options &options);
+static void reduce_pair_stores(Ordering &order, const struct master_options &options);
+static std::string get_shard_file(
+    const struct master_options &options,
+    int shard,
+    const std::string &extension);
+static void sample_metrics(
+    struct run_metrics &metrics,
+    std::vector<struct chromosome_state> &chromosomes,
+    const std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> &matrices,
+    CandidateStore &candidates,
+    std::chrono::steady_clock::time_point start,
+    int num_processed);
+static uint64_t get_compressed_offset(struct chromosome_state &state);
+static decltype(&worker<RapidSource>) get_worker(SegmentFormat format);
+static decltype(&build_pair_store<RapidSource>) get_pair_store_builder(SegmentFormat format);
 
 /**
  * Master thread responsible for synchronization, writing to either temporary or final
@@ -101,35 +154,48 @@ static int get_min_kinship_coefficient(int max_degree);
  * @param map_path folder that stores genetic maps.
  *     Assume the map for Chromosome i is named as chr{i}.rMap.
  *     E.g. chr22.rMap for chromosome 22.
- * @param max_degree largest degree user is looking for
- * @param num_threads number of worker threads to spawn.
- *     Each thread is responsible for 22 / num_threads chromosomes.
- * @param out final output
+ * @param options a struct master_options. Final output is written to
+ *     {options.output_path}predictions.txt. Each thread is responsible for
+ *     22 / options.num_threads chromosomes.
  */
 void
 master(
     std::string &vcf_path,
     std::string &rapid_output_path,
     std::string &map_path,
-    int max_degree,
-    unsigned int num_threads,
-    std::ostream &out)
+    const struct master_options &options)
 {
-    output_header(out);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int max_degree = options.max_degree;
+    // A shard writes all its candidate pairs and leaves inference to merge_shards
+    bool sharded = options.num_shards > 0;
+    std::string output_file_path = options.output_path + get_output_file_name(options.output_format);
+    std::string checkpoint_path = sharded ?
+        get_shard_file(options, options.shard, "checkpoint") : options.output_path + CHECKPOINT_FILE;
 
     // Initialize genetic maps
     init_maps(map_path);
+    if (options.segment_format != SegmentFormat::RAPID) {
+        init_positions(options.vcf_prefix);
+    }
 
-    // Maximum number of threads is 22
-    num_threads = std::min(num_threads, (unsigned int) NUM_CHROMOSOMES);
-    int num_chromosomes_per_thread = NUM_CHROMOSOMES / num_threads;
+    // Maximum number of threads is the number of chromosomes
+    int num_chromosomes = get_num_chromosomes();
+    unsigned int num_threads = std::min(options.num_threads, (unsigned int) num_chromosomes);
+    int num_chromosomes_per_thread = num_chromosomes / num_threads;
 
     std::vector<std::future<void>> futures;
     futures.reserve(num_threads);
 
     Proceed proceed(num_threads);
     Ordering id_ordering(vcf_path);
-    Dumpable dumpable_index(id_ordering);
+    Dumpable dumpable_index(id_ordering, num_chromosomes);
+
+    // Indices of id1 this run is responsible for
+    std::pair<int, int> id1_range {0, id_ordering.size()};
+    if (sharded) {
+        id1_range = get_shard_range(id_ordering.size(), options.shard, options.num_shards);
+    }
 
     // An vector of matrix. One for each thread. Each matrix is a
     // 2D unordered map where M[i][j] is a struct pair_stats that
@@ -137,45 +203,156 @@ master(
     // with index i and individual with index j.
     std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> matrices(num_threads);
 
-    uint64_t num_dumped = 0;
+    // Parsing progress of each chromosome
+    std::vector<struct chromosome_state> chromosomes(num_chromosomes);
+
+    // Stages are only timed if metrics are reported. Memory and progress are
+    // sampled at every synchronization if either metrics or progress are reported.
+    bool timed = !options.metrics_path.empty();
+    bool monitored = timed || options.progress_interval > 0;
+    struct run_metrics metrics;
+    metrics.num_ids = id_ordering.size();
+    metrics.threads.resize(num_threads);
+    metrics.chromosome_threads.resize(num_chromosomes);
+    metrics.progress.resize(num_chromosomes);
+    for (int chrom = 1; chrom <= num_chromosomes; ++chrom) {
+        metrics.chromosome_names.push_back(get_chromosome(chrom).name);
+    }
+    metrics.memory.matrix_bytes.resize(num_threads);
+    StageTimer timer(timed);
+    install_report_signal();
+
+    // Shorter segments are dropped as they are parsed
+    double min_segment_length = get_min_segment_length(options);
+    std::cout << "Minimum segment length is " << min_segment_length << " cM" << std::endl;
+
+    struct checkpoint_progress progress;
+    progress.max_degree = max_degree;
+    progress.min_segment_length = min_segment_length;
+    progress.temp_path = sharded ? get_shard_file(options, options.shard, "candidates") : get_temporary_file(options);
+    progress.temp_codec = options.temporary_codec;
+    // Candidates a resumed run kept in memory
+    std::vector<char> memory_candidates;
+    if (options.resume) {
+        load_checkpoint(checkpoint_path, id_ordering, progress, memory_candidates, dumpable_index, chromosomes, matrices[0]);
+        if (progress.max_degree != max_degree) {
+            throw std::runtime_error {"Checkpoint was taken with a different max degree"};
+        }
+        if (progress.min_segment_length != min_segment_length) {
+            throw std::runtime_error {"Checkpoint was taken with a different minimum segment length"};
+        }
+        set_num_calibrated_ids(progress.num_calibrated_ids);
+        std::cout << "Resuming after " << progress.num_processed << " individuals" << std::endl;
+    } else if (options.calibration_ids > 0 && !sharded) {
+        // Boundaries of a resumed run are restored from its checkpoint
+        timer.start();
+        calibrate(rapid_output_path, options.segment_format, id_ordering, options.calibration_ids, min_segment_length);
+        progress.num_calibrated_ids = get_num_calibrated_ids();
+        timer.lap(metrics.master.calibration);
+    }
+
+    // Temporary output. A resumed run continues the temporary output of its checkpoint.
+    CandidateStore candidates(progress.temp_path, progress.temp_codec, options.candidate_memory);
+
+    // Final output. Anything written after the checkpoint is discarded.
+    std::ofstream out_file;
+    std::unique_ptr<OutputWriter> out = sharded ?
+        make_output_writer(options.output_format, out_file, id_ordering, num_threads) :
+        open_output(options, id_ordering, out_file, options.resume, progress.output_offset);
+
+    // Pair store of each chromosome that has not been completed
+    if (!options.pair_store_path.empty()) {
+        boost::filesystem::create_directories(options.pair_store_path);
+        for (int chrom = 1; chrom <= num_chromosomes; ++chrom) {
+            struct chromosome_state &state = chromosomes[chrom - 1];
+            if (!state.finished) {
+                state.store = std::make_unique<PairStoreWriter>(
+                    get_pair_store_file(options.pair_store_path, get_chromosome(chrom).name),
+                    id_ordering.size(), state.store_offset);
+            }
+        }
+    }
+
+    // Totals of every pair, to reclassify without parsing again
+    std::unique_ptr<PairTotalsWriter> totals;
+    if (options.pair_totals) {
+        totals = std::make_unique<PairTotalsWriter>(
+            get_pair_totals_file(options.output_path),
+            id_ordering,
+            get_pair_totals_floor(options),
+            progress.totals_offset
+        );
+    }
+
+    // Merged segments of related pairs, spooled by the workers while they parse
+    std::unique_ptr<SegmentExport> segments;
+    if (options.segment_kinship >= 0) {
+        if (options.resume || sharded) {
+            throw std::runtime_error {"Segments can only be exported by a run that is neither resumed nor sharded"};
+        }
+        segments = std::make_unique<SegmentExport>(options.output_path, options.segment_kinship);
+        for (int chrom = 1; chrom <= num_chromosomes; ++chrom) {
+            chromosomes[chrom - 1].segments = std::make_unique<SegmentSpoolWriter>(
+                get_segment_spool_file(options.output_path, get_chromosome(chrom).name));
+        }
+    }
+
+    uint64_t num_dumped = progress.num_dumped;
     {
-        // Temporary output
-        std::ofstream temp_file_out = std::ofstream(".temporary", std::ios::out | std::ios::trunc | std::ios::binary);
-        boost::iostreams::filtering_streambuf<boost::iostreams::output> buffer_out;
-        buffer_out.push(boost::iostreams::gzip_compressor());
-        buffer_out.push(temp_file_out);
-        std::ostream temp_out(&buffer_out);
+        if (progress.temp_in_memory) {
+            candidates.open(std::move(memory_candidates));
+        } else {
+            candidates.open(progress.temp_offset);
+        }
 
         // Pairs with kinship coefficents smaller than this will not be written to any output.
         double min_kinship_coefficient = get_min_kinship_coefficient(max_degree);
 
         // Spwan worker threads
         for (unsigned int thread = 0; thread < num_threads; ++thread) {
+            int chromosome_start = thread * num_chromosomes_per_thread + 1;
+            // Last thread handles all remaining chromosomes
+            int chromosome_end = thread == num_threads - 1 ? num_chromosomes : (thread + 1) * num_chromosomes_per_thread;
+            for (int chrom = chromosome_start; chrom <= chromosome_end; ++chrom) {
+                metrics.chromosome_threads[chrom - 1] = thread;
+            }
+
             futures.push_back(std::async(
                 std::launch::async,
-                worker,
+                get_worker(options.segment_format),
                 thread,
                 num_threads,
                 std::ref(proceed),
                 std::ref(dumpable_index),
                 std::ref(id_ordering),
                 std::ref(rapid_output_path),
-                thread * num_chromosomes_per_thread + 1,
-                // Last thread handles all remaining chromosomes
-                thread == num_threads - 1 ? NUM_CHROMOSOMES : (thread + 1) * num_chromosomes_per_thread,
-                std::ref(matrices[thread])
+                std::cref(id1_range),
+                chromosome_start,
+                chromosome_end,
+                std::ref(chromosomes),
+                std::ref(matrices[thread]),
+                min_segment_length,
+                timed,
+                std::ref(metrics.threads[thread])
             ));
         }
 
-        int count = 0;
+        // Aggregates the pairs of each dumped individual across the matrices of all threads
+        PairAccumulator accumulator;
+
+        int count = progress.num_processed;
         bool done = false;
+        std::chrono::steady_clock::time_point last_checkpoint = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point last_progress = last_checkpoint;
         while (!done) {
+            timer.start();
             std::unique_lock<std::mutex> lock(proceed.mutex);
 
             // Wait until all threads are blocked
             while (!proceed.has_all_blocked()) {
                 proceed.wait_for_workers(lock);
             }
+            timer.lap(metrics.master.barrier_wait);
 
             // Write dumpable individuals to output
             std::pair<int, int> range = dumpable_index.get_dumpable_indices();
@@ -185,10 +362,16 @@ master(
                 id_ordering,
                 range,
                 matrices,
-                temp_out,
-                out
+                accumulator,
+                sharded,
+                candidates,
+                *out,
+                totals.get(),
+                segments.get(),
+                metrics.master.num_pairs_dumped
             );
             count += range.second - range.first + 1;
+            timer.lap(metrics.master.dump_range);
 
             std::cout << count << " individuals processed\r";
             std::cout.flush();
@@ -196,12 +379,57 @@ master(
             // Update index of last dumpable individual
             dumpable_index.set_previous_last_dumpable_index(range.second);
 
+            done = proceed.has_all_finished();
+
+            // Sample and report metrics while all worker threads are blocked. A
+            // snapshot is printed on request even if nothing else is reported.
+            bool requested = is_report_requested();
+            bool print_progress = requested || (options.progress_interval > 0 &&
+                std::chrono::steady_clock::now() - last_progress >= std::chrono::seconds(options.progress_interval));
+            if (monitored || requested) {
+                sample_metrics(metrics, chromosomes, matrices, candidates, start, count);
+            }
+            if (requested && timed) {
+                write_metrics(options.metrics_path, metrics);
+            }
+            if (print_progress) {
+                std::cerr << std::endl;
+                write_progress(std::cerr, metrics);
+                last_progress = std::chrono::steady_clock::now();
+            }
+
+            // Save the state of the run while all worker threads are blocked. Spooled
+            // segments and kinship matrix entries cannot be resumed, so no checkpoint is
+            // taken while either is written.
+            bool resumable = !segments && (sharded || !options.kinship_matrix);
+            if (!done && options.checkpoint_interval > 0 && resumable &&
+                std::chrono::steady_clock::now() - last_checkpoint >= std::chrono::seconds(options.checkpoint_interval)) {
+                progress.num_processed = count;
+                progress.num_dumped = num_dumped;
+                progress.temp_offset = candidates.sync();
+                progress.temp_in_memory = candidates.is_in_memory();
+                progress.output_offset = 0;
+                if (!sharded) {
+                    out->flush();
+                    progress.output_offset = boost::filesystem::file_size(output_file_path);
+                }
+                if (totals) {
+                    progress.totals_offset = totals->sync();
+                }
+                for (struct chromosome_state &state : chromosomes) {
+                    if (state.store) {
+                        state.store_offset = state.store->sync();
+                    }
+                }
+                save_checkpoint(checkpoint_path, id_ordering, progress, candidates, dumpable_index, chromosomes, matrices);
+                last_checkpoint = std::chrono::steady_clock::now();
+                timer.lap(metrics.master.checkpoint);
+            }
+
             // Reset number of blocked threads to number of unfinished threads
             proceed.update_num_blocked();
             proceed.allow_all_threads_proceed();
 
-            done = proceed.has_all_finished();
-
             // Resume worker threads
             proceed.signal_workers();
         }
@@ -218,26 +446,674 @@ master(
         f.get();
     }
 
+    if (sharded) {
+        // Keep the candidates and record what merge_shards needs to infer them
+        candidates.close();
+
+        struct classifier_state state = get_classifier_state();
+        std::ofstream calibration(get_shard_file(options, options.shard, "calibration"), std::ios::out | std::ios::trunc);
+        calibration << std::setprecision(17)
+            << num_dumped << "\t" << state.num_fs << "\t" << state.fs_total_kinship_coefficients << "\t"
+            << static_cast<int>(progress.temp_codec) << std::endl;
+        if (!calibration) {
+            throw std::runtime_error {"Failed to write calibration of shard " + std::to_string(options.shard)};
+        }
+
+        std::remove(checkpoint_path.c_str());
+        if (timed) {
+            sample_metrics(metrics, chromosomes, matrices, candidates, start, id_ordering.size());
+            metrics.finished = true;
+            write_metrics(options.metrics_path, metrics);
+        }
+        return;
+    }
+
     {
-        // Open temporary file for reading
-        std::ifstream temp_file_in(".temporary", std::ios_base::in | std::ios_base::binary);
-        boost::iostreams::filtering_streambuf<boost::iostreams::input> buffer_in;
-        buffer_in.push(boost::iostreams::gzip_decompressor());
-        buffer_in.push(temp_file_in);
-        std::istream temp_in(&buffer_in);
+        timer.start();
 
         // Adjust inference boundaries
         shift_boundary();
 
         // Read in candidate pairs and infer relatedness based on adjusted boundaries
-        infer_candidates(max_degree, num_dumped, temp_in, id_ordering, out);
+        infer_candidates(max_degree, num_dumped, candidates, id_ordering, *out);
+        out->close();
+
+        timer.lap(metrics.master.infer_candidates);
     }
 
     // Remove temporary file
-    if (std::remove(".temporary")) {
-        throw std::runtime_error {"Failed to remove temporary file"};
+    candidates.remove();
+
+    if (totals) {
+        totals->close(get_classifier_state());
+    }
+
+    if (segments) {
+        timer.start();
+        std::cout << std::endl << "Exporting segments of " << segments->get_num_selected() << " pairs" << std::endl;
+        segments->write(id_ordering);
+        timer.lap(metrics.master.segment_export);
+    }
+
+    // The run is complete. Its checkpoint is no longer needed.
+    std::remove(checkpoint_path.c_str());
+
+    if (timed) {
+        sample_metrics(metrics, chromosomes, matrices, candidates, start, id_ordering.size());
+        metrics.finished = true;
+        write_metrics(options.metrics_path, metrics);
+    }
+}
+
+
+/**
+ * Infer the candidate pairs written by all shards of a sharded run and write them
+ * to final output. Full-sibling calibration statistics of all shards are combined
+ * before the inference boundaries are adjusted.
+ *
+ * @param vcf_path path to a VCF file.
+ * @param map_path folder that stores genetic maps.
+ *     Assume the map for Chromosome i is named as chr{i}.rMap.
+ * @param options a struct master_options. Shards 1 to options.num_shards are read
+ *     from options.output_path.
+ */
+void
+merge_shards(
+    std::string &vcf_path,
+    std::string &map_path,
+    const struct master_options &options)
+{
+    // Genetic maps determine the length of genome
+    init_total_length(map_path);
+    Ordering id_ordering(vcf_path);
+
+    // Combine calibration of all shards
+    std::vector<uint64_t> num_dumped(options.num_shards + 1);
+    std::vector<int> codecs(options.num_shards + 1);
+    int num_full_siblings = 0;
+    double total_kinship_coefficients = 0;
+    for (int shard = 1; shard <= options.num_shards; ++shard) {
+        std::ifstream calibration(get_shard_file(options, shard, "calibration"));
+        int shard_num_full_siblings;
+        double shard_total_kinship_coefficients;
+        if (!(calibration >> num_dumped[shard] >> shard_num_full_siblings >> shard_total_kinship_coefficients
+                >> codecs[shard])) {
+            throw std::runtime_error {"Missing or incomplete shard " + std::to_string(shard)};
+        }
+        num_full_siblings += shard_num_full_siblings;
+        total_kinship_coefficients += shard_total_kinship_coefficients;
+    }
+    add_full_siblings(num_full_siblings, total_kinship_coefficients);
+
+    // Adjust inference boundaries
+    shift_boundary();
+
+    std::ofstream out_file;
+    std::unique_ptr<OutputWriter> out = open_output(options, id_ordering, out_file, false, 0);
+
+    for (int shard = 1; shard <= options.num_shards; ++shard) {
+        CandidateStore candidates(get_shard_file(options, shard, "candidates"), static_cast<CandidateCodec>(codecs[shard]));
+        infer_candidates(options.max_degree, num_dumped[shard], candidates, id_ordering, *out);
+    }
+    out->close();
+}
+
+
+/**
+ * Open final output in options.output_format and create its writer. A new
+ * output starts with a header and gets its sample manifest.
+ *
+ * @param options a struct master_options.
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param file stream of final output to open.
+ * @param resume whether to continue an existing output instead of starting over.
+ * @param offset size of the existing output to keep if resume is set.
+ *
+ * @return the writer of final output.
+ */
+static std::unique_ptr<OutputWriter>
+open_output(
+    const struct master_options &options,
+    Ordering &order,
+    std::ofstream &file,
+    bool resume,
+    uint64_t offset)
+{
+    std::string path = options.output_path + get_output_file_name(options.output_format);
+    if (resume) {
+        boost::filesystem::resize_file(path, offset);
+    }
+    file.open(path, std::ios::out | std::ios::binary | (resume ? std::ios::app : std::ios::trunc));
+    if (!file) {
+        throw std::runtime_error {"Failed to open " + path};
+    }
+
+    std::unique_ptr<OutputWriter> out = make_output_writer(options.output_format, file, order, options.num_threads);
+    if (!resume) {
+        // Sample indices of binary output, and the order of the samples for text output
+        write_sample_manifest(options.output_path + "predictions.samples.txt", order);
+        out->write_header();
+    }
+    if (options.kinship_matrix) {
+        out = std::make_unique<KinshipMatrixWriter>(std::move(out), options.output_path, order);
+    }
+    return out;
+}
+
+
+/**
+ * Create options.temporary_path if needed and pick a name for a new temporary
+ * file in it that no other run uses.
+ *
+ * @param options a struct master_options. The output directory is used if
+ *     options.temporary_path is empty.
+ *
+ * @return path of the temporary file.
+ */
+static std::string
+get_temporary_file(const struct master_options &options)
+{
+    boost::filesystem::path directory = options.temporary_path.empty() ? options.output_path : options.temporary_path;
+    if (!directory.empty()) {
+        boost::filesystem::create_directories(directory);
     }
+    return (directory / boost::filesystem::unique_path("raffi-%%%%-%%%%-%%%%-%%%%.temporary")).string();
+}
+
+
+/**
+ * Classify all pairs of a pair-totals sidecar again and write them to final
+ * output, without genetic maps, VCF or RaPID output.
+ *
+ * @param totals_path path of the sidecar.
+ * @param calibration which thresholds to classify with: "saved" restores the
+ *     calibration at the end of the run that wrote the sidecar, "recompute"
+ *     recalibrates from the full-siblings among the stored pairs, and "none"
+ *     uses the unadjusted thresholds.
+ * @param options a struct master_options. Only max_degree, output_path,
+ *     output_format and num_threads are used.
+ */
+void
+reclassify(
+    const std::string &totals_path,
+    const std::string &calibration,
+    const struct master_options &options)
+{
+    struct pair_totals_record pair;
+
+    // The calibration is stored after all pairs
+    {
+        PairTotalsReader reader(totals_path);
+        TOTAL_LENGTH = reader.get_total_length();
+        int num_full_siblings = 0;
+        double total_kinship_coefficients = 0;
+        while (reader.next(pair)) {
+            if (calibration == "recompute" &&
+                compute_probability_ibd2(pair.total_ibd2) >= FS_START) {
+                ++num_full_siblings;
+                total_kinship_coefficients += compute_kinship_coefficient(pair.total_ibd1, pair.total_ibd2);
+            }
+        }
+        if (calibration == "saved") {
+            set_classifier_state(reader.get_classifier_state());
+        } else if (calibration == "recompute") {
+            // Capped like merge_shards, so that the adjustment still happens
+            // with more than MAX_NUM_FS pairs of full-siblings
+            add_full_siblings(num_full_siblings, total_kinship_coefficients);
+            shift_boundary();
+        }
+    }
+
+    PairTotalsReader reader(totals_path);
+    Ordering id_ordering(reader.get_ids());
+
+    std::ofstream out_file;
+    std::unique_ptr<OutputWriter> out = open_output(options, id_ordering, out_file, false, 0);
+
+    uint64_t num_pairs = 0;
+    while (reader.next(pair)) {
+        ++num_pairs;
+        double kinship_coefficient = compute_kinship_coefficient(pair.total_ibd1, pair.total_ibd2);
+        double probability_ibd2 = compute_probability_ibd2(pair.total_ibd2);
+        int encoding = get_encoding(kinship_coefficient, probability_ibd2);
+        if (is_encoding_less_than(encoding, options.max_degree)) {
+            double probability_ibd1 = compute_probability_ibd1(pair.total_ibd1);
+            double probability_ibd0 = std::max(1 - probability_ibd1 - probability_ibd2, 0.0);
+            out->write_pair(
+                pair.id1_index,
+                pair.id2_index,
+                kinship_coefficient,
+                probability_ibd0,
+                probability_ibd1,
+                probability_ibd2,
+                encoding
+            );
+        }
+    }
+    out->close();
+
+    std::cout << "Reclassified " << num_pairs << " pairs" << std::endl;
+}
+
+
+/**
+ * @param num_ids total number of individuals.
+ * @param shard a shard between 1 and num_shards.
+ * @param num_shards
+ *
+ * @return half-open range of indices of id1 the shard is responsible for.
+ */
+static std::pair<int, int>
+get_shard_range(int num_ids, int shard, int num_shards)
+{
+    return {
+        (int) ((int64_t) num_ids * (shard - 1) / num_shards),
+        (int) ((int64_t) num_ids * shard / num_shards)
+    };
+}
+
+
+/**
+ * @param options a struct master_options of a sharded run.
+ * @param shard a shard between 1 and options.num_shards.
+ * @param extension what the file contains.
+ *
+ * @return path of a file of the shard, {output_path}shard.{shard}.of.{num_shards}.{extension}
+ */
+static std::string
+get_shard_file(const struct master_options &options, int shard, const std::string &extension)
+{
+    return options.output_path + "shard." + std::to_string(shard) + ".of." +
+        std::to_string(options.num_shards) + "." + extension;
+}
+
+
+/**
+ * Take a snapshot of the metrics, the progress and the live memory of a run. Must
+ * be called while all worker threads are blocked or finished.
+ *
+ * @param metrics metrics of the master thread and of each worker thread. Peaks
+ *     of memory are kept across snapshots.
+ * @param chromosomes parsing progress of all chromosomes, with their metrics.
+ * @param matrices pair matrix of each worker thread.
+ * @param candidates temporary output of candidate pairs.
+ * @param start when the run started.
+ * @param num_processed number of individuals written so far.
+ */
+static void
+sample_metrics(
+    struct run_metrics &metrics,
+    std::vector<struct chromosome_state> &chromosomes,
+    const std::vector<std::unordered_map<int, std::unordered_map<int, struct pair_stats>>> &matrices,
+    CandidateStore &candidates,
+    std::chrono::steady_clock::time_point start,
+    int num_processed)
+{
+    metrics.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    metrics.num_processed = num_processed;
+    metrics.chromosomes.clear();
+
+    struct memory_metrics &memory = metrics.memory;
+    memory.segment_bytes = 0;
+    for (size_t i = 0; i < chromosomes.size(); ++i) {
+        struct chromosome_state &state = chromosomes[i];
+        struct chromosome_progress &progress = metrics.progress[i];
+        metrics.chromosomes.push_back(state.metrics);
+
+        if (state.finished && !progress.finished) {
+            progress.finished = true;
+            progress.seconds = metrics.elapsed;
+        }
+        progress.compressed_size = state.compressed_size;
+        progress.compressed_start = state.compressed_start;
+        progress.compressed_read = get_compressed_offset(state);
+
+        progress.segment_bytes = get_hash_table_bytes(state.id_to_haps_to_segment);
+        for (const auto &id_to_segments : state.id_to_haps_to_segment) {
+            progress.segment_bytes += get_hash_table_bytes(id_to_segments.second);
+            for (const auto &haps_to_segments : id_to_segments.second) {
+                progress.segment_bytes += haps_to_segments.second.capacity() * sizeof(std::pair<int, int>);
+            }
+        }
+        memory.segment_bytes += progress.segment_bytes;
+    }
+    memory.peak_segment_bytes = std::max(memory.peak_segment_bytes, memory.segment_bytes);
+
+    uint64_t matrix_bytes = 0;
+    for (size_t thread = 0; thread < matrices.size(); ++thread) {
+        const std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix = matrices[thread];
+        memory.matrix_bytes[thread] = get_hash_table_bytes(matrix);
+        for (const auto &row : matrix) {
+            memory.matrix_bytes[thread] += get_hash_table_bytes(row.second);
+        }
+        matrix_bytes += memory.matrix_bytes[thread];
+    }
+    memory.peak_matrix_bytes = std::max(memory.peak_matrix_bytes, matrix_bytes);
+
+    memory.candidate_bytes = candidates.get_memory_size();
+    memory.temporary_bytes = candidates.get_disk_size();
+    memory.rss_bytes = get_rss_bytes();
+    // The kernel updates its peak lazily
+    memory.peak_rss_bytes = std::max({memory.peak_rss_bytes, memory.rss_bytes, get_peak_rss_bytes()});
+}
+
+
+/**
+ * @param state parsing progress of a chromosome.
+ *
+ * @return compressed bytes of RaPID output consumed so far, including what has
+ *     been read ahead by the decompressor. All of them once the chromosome has
+ *     been closed.
+ */
+static uint64_t
+get_compressed_offset(struct chromosome_state &state)
+{
+    if (!state.file) {
+        return state.compressed_size;
+    }
+    // Not tellg, which fails once the end of the file has been reached
+    std::streamoff offset = state.file->rdbuf()->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+    return offset < 0 ? state.compressed_size : offset;
+}
+
 
+/**
+ * @param format format of the IBD segments of a run.
+ *
+ * @return worker specialized for reading segments in format.
+ */
+static decltype(&worker<RapidSource>)
+get_worker(SegmentFormat format)
+{
+    switch (format) {
+        case SegmentFormat::HAP_IBD:
+            return worker<HapIbdSource>;
+        case SegmentFormat::ILASH:
+            return worker<IlashSource>;
+        default:
+            return worker<RapidSource>;
+    }
+}
+
+
+/**
+ * @param format format of the IBD segments of a run.
+ *
+ * @return build_pair_store specialized for reading segments in format.
+ */
+static decltype(&build_pair_store<RapidSource>)
+get_pair_store_builder(SegmentFormat format)
+{
+    switch (format) {
+        case SegmentFormat::HAP_IBD:
+            return build_pair_store<HapIbdSource>;
+        case SegmentFormat::ILASH:
+            return build_pair_store<IlashSource>;
+        default:
+            return build_pair_store<RapidSource>;
+    }
+}
+
+
+/**
+ * Process chromosomes independently of each other. Build the pair stores of the
+ * chromosomes in options.map_chromosomes from their RaPID outputs (map), then, if
+ * options.reduce is set, merge the pair stores of all chromosomes, classify all
+ * pairs and write them to final output (reduce). Either step can be run on its
+ * own, e.g. chromosomes mapped on different machines and reduced once all pair
+ * stores are in place.
+ *
+ * @param vcf_path path to a VCF file.
+ * @param rapid_output_path folder that stores the outputs of RaPID.
+ *     Assume output of Chromosome i is stored in subfolder i.
+ * @param map_path folder that stores genetic maps.
+ *     Assume the map for Chromosome i is named as chr{i}.rMap.
+ * @param options a struct master_options. The pair store is read from and
+ *     written to options.pair_store_path.
+ */
+void
+map_reduce(
+    std::string &vcf_path,
+    std::string &rapid_output_path,
+    std::string &map_path,
+    const struct master_options &options)
+{
+    Ordering id_ordering(vcf_path);
+
+    if (!options.map_chromosomes.empty()) {
+        // Initialize genetic maps
+        init_maps(map_path);
+        if (options.segment_format != SegmentFormat::RAPID) {
+            init_positions(options.vcf_prefix);
+        }
+        map_chromosomes(id_ordering, rapid_output_path, options);
+        deinit_maps();
+    } else {
+        // Reducing only needs the length of genome
+        init_total_length(map_path);
+    }
+
+    if (options.reduce) {
+        reduce_pair_stores(id_ordering, options);
+    }
+}
+
+
+/**
+ * Build the pair stores of the chromosomes in options.map_chromosomes.
+ * options.num_threads chromosomes are processed at a time, the largest RaPID
+ * outputs first, so that a long chromosome does not start last.
+ *
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param rapid_output_path folder that stores the outputs of RaPID.
+ * @param options a struct master_options.
+ */
+static void
+map_chromosomes(
+    Ordering &order,
+    std::string &rapid_output_path,
+    const struct master_options &options)
+{
+    std::string pair_store_path = options.pair_store_path;
+    boost::filesystem::create_directories(pair_store_path);
+    double min_segment_length = get_min_segment_length(options);
+    std::cout << "Minimum segment length is " << min_segment_length << " cM" << std::endl;
+
+    std::vector<int> chromosomes = options.map_chromosomes;
+    std::sort(chromosomes.begin(), chromosomes.end());
+    chromosomes.erase(std::unique(chromosomes.begin(), chromosomes.end()), chromosomes.end());
+
+    // Largest first
+    std::vector<std::pair<uintmax_t, int>> sizes_to_chromosomes;
+    for (int chrom : chromosomes) {
+        boost::system::error_code error;
+        uintmax_t size = boost::filesystem::file_size(
+            get_segment_file(options.segment_format, rapid_output_path, get_chromosome(chrom).name),
+            error
+        );
+        sizes_to_chromosomes.push_back({error ? 0 : size, chrom});
+    }
+    std::sort(sizes_to_chromosomes.rbegin(), sizes_to_chromosomes.rend());
+
+    // Each thread takes the next chromosome as soon as it finishes one
+    auto build = get_pair_store_builder(options.segment_format);
+    std::atomic<unsigned int> next {0};
+    unsigned int num_threads = std::min(std::max(options.num_threads, 1u), (unsigned int) sizes_to_chromosomes.size());
+    std::vector<std::future<void>> futures;
+    for (unsigned int thread = 0; thread < num_threads; ++thread) {
+        futures.push_back(std::async(std::launch::async, [&]() {
+            for (unsigned int i = next++; i < sizes_to_chromosomes.size(); i = next++) {
+                build(
+                    sizes_to_chromosomes[i].second, order, rapid_output_path, pair_store_path, min_segment_length);
+            }
+        }));
+    }
+    for (std::future<void> &f : futures) {
+        f.get();
+    }
+    std::cout << "Built pair stores of " << sizes_to_chromosomes.size() << " chromosomes" << std::endl;
+}
+
+
+/**
+ * Merge the pair stores of all chromosomes, classify all pairs and write them to
+ * final output. Only the next pair of each chromosome is held in memory.
+ *
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param options a struct master_options.
+ */
+static void
+reduce_pair_stores(Ordering &order, const struct master_options &options)
+{
+    int max_degree = options.max_degree;
+
+    std::ofstream out_file;
+    std::unique_ptr<OutputWriter> out = open_output(options, order, out_file, false, 0);
+
+    // Temporary output
+    CandidateStore candidates(get_temporary_file(options), options.temporary_codec, options.candidate_memory);
+    candidates.open(0);
+
+    // Pairs with kinship coefficents smaller than this will not be written to any output.
+    double min_kinship_coefficient = get_min_kinship_coefficient(max_degree);
+
+    std::vector<std::string> paths;
+    for (int chrom = 1; chrom <= get_num_chromosomes(); ++chrom) {
+        paths.push_back(get_pair_store_file(options.pair_store_path, get_chromosome(chrom).name));
+    }
+
+    std::unique_ptr<PairTotalsWriter> totals;
+    if (options.pair_totals) {
+        totals = std::make_unique<PairTotalsWriter>(
+            get_pair_totals_file(options.output_path),
+            order,
+            get_pair_totals_floor(options),
+            0
+        );
+    }
+
+    uint64_t num_dumped = 0;
+    merge_pair_stores(paths, order.size(), [&](int id1_index, int id2_index, const struct pair_stats &stats) {
+        if (totals) {
+            totals->write(id1_index, id2_index, stats);
+        }
+        num_dumped += dump_pair(
+            max_degree,
+            min_kinship_coefficient,
+            order,
+            id1_index,
+            id2_index,
+            stats,
+            false,
+            candidates,
+            *out
+        );
+    });
+
+    std::cout << "Wrote " << num_dumped << " candidate pairs to disk" << std::endl;
+
+    // Adjust inference boundaries
+    shift_boundary();
+
+    // Read in candidate pairs and infer relatedness based on adjusted boundaries
+    infer_candidates(max_degree, num_dumped, candidates, order, *out);
+    out->close();
+
+    // Remove temporary file
+    candidates.remove();
+
+    if (totals) {
+        totals->close(get_classifier_state());
+    }
+}
+
+
+/**
+ * Parse the RaPID output of one chromosome on its own and write the totals of
+ * every pair to the pair store of the chromosome. Only the segments of one
+ * individual are held in memory.
+ *
+ * @param chromosome_number
+ * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param rapid_output_path folder that stores the outputs of RaPID.
+ * @param pair_store_path folder of the pair store.
+ * @param min_segment_length segments shorter than this in cM are dropped.
+ */
+template <typename Source>
+static void
+build_pair_store(
+    int chromosome_number,
+    Ordering &order,
+    std::string &rapid_output_path,
+    std::string &pair_store_path,
+    double min_segment_length)
+{
+    std::string file_path = get_segment_file(Source::format, rapid_output_path, get_chromosome(chromosome_number).name);
+    std::ifstream file(file_path, std::ios_base::in | std::ios_base::binary);
+    if (!file) {
+        throw std::runtime_error {"Failed to open " + file_path};
+    }
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> buffer;
+    buffer.push(boost::iostreams::gzip_decompressor());
+    buffer.push(file);
+    std::istream in(&buffer);
+
+    PairStoreWriter store(get_pair_store_file(pair_store_path, get_chromosome(chromosome_number).name), order.size(), 0);
+
+    int prev_id = -1;
+    std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> id_to_haps_to_segment;
+    std::string line;
+    while (std::getline(in, line)) {
+        struct line_info info;
+        if (!Source::parse(line, info, order, {0, order.size()}, chromosome_number) ||
+            info.id1_index == info.id2_index ||
+            !clip_to_region(chromosome_number, info.starting_site, info.ending_site) ||
+            (min_segment_length > 0 &&
+             get_genetic_length(info.starting_site, info.ending_site, chromosome_number) < min_segment_length)) {
+            continue;
+        }
+
+        if (info.id1_index < prev_id) {
+            throw std::runtime_error {"Segments of " + file_path + " are not sorted by their first individual in VCF order"};
+        }
+        if (info.id1_index != prev_id) {
+            // Segments for the previous individual have been exausted
+            store_total_ibd(chromosome_number, prev_id, id_to_haps_to_segment, store);
+            id_to_haps_to_segment.clear();
+            prev_id = info.id1_index;
+        }
+        id_to_haps_to_segment[info.id2_index][haps_to_encoding(info.hap1, info.hap2)].emplace_back(info.starting_site, info.ending_site);
+    }
+    store_total_ibd(chromosome_number, prev_id, id_to_haps_to_segment, store);
+
+    store.close();
+}
+
+
+/**
+ * @param options a struct master_options.
+ *
+ * @return segments shorter than this in cM are dropped: options.min_segment_length,
+ *     or if negative, what the largest degree allows. Close relatives share long
+ *     segments, so the shorter segments of distant relatives and of unrelated
+ *     individuals can be left out when only close degrees are inferred.
+ */
+static double
+get_min_segment_length(const struct master_options &options)
+{
+    if (options.min_segment_length >= 0) {
+        return options.min_segment_length;
+    }
+    switch (options.max_degree) {
+        case 1:
+            return MIN_SEGMENT_LENGTH_FIRST;
+        case 2:
+            return MIN_SEGMENT_LENGTH_SECOND;
+        case 3:
+            return MIN_SEGMENT_LENGTH_THIRD;
+        default:
+            return 0;
+    }
 }
 
 
@@ -269,6 +1145,23 @@ static int get_min_kinship_coefficient(int max_degree) {
 }
 
 
+/**
+ * @param options a struct master_options.
+ *
+ * @return kinship coefficient below which pairs are not written to the pair-totals
+ *     sidecar. Defaults to what the largest supported degree needs, so that the
+ *     sidecar can be reclassified with any max degree.
+ */
+static double
+get_pair_totals_floor(const struct master_options &options)
+{
+    if (options.pair_totals_floor >= 0) {
+        return options.pair_totals_floor;
+    }
+    return FOURTH_START * MIN_POWER;
+}
+
+
 /**
  * Worker thread responsible for parsing one or more chromosomes.
 
@@ -288,12 +1181,22 @@ static int get_min_kinship_coefficient(int max_degree) {
  * @param rapid_output_path folder that stores the output of RaPID.
  *     Assume output of Chromosome i is stored in subfolder i.
  *     E.g. output of Chromosome 1 stored in {rapid_output_path}/1/
+ * @param id1_range half-open range of indices of id1 this run is responsible for.
+ *     Segments of other individuals are skipped.
  * @param chromosome_start first chromosome to parse.
  * @param chromosome_end last chromosome to parse.
+ * @param chromosomes parsing progress of all chromosomes. Chromosome i is at index
+ *     i - 1. Progress restored from a checkpoint is continued.
  * @param matrix a 2D unordered map where M[i][j] is a struct pair_stats that
  *     records the total IBD1 and IBD2 between individual with index i and
  *     individual with index j.
+ * @param min_segment_length segments shorter than this in cM are dropped before
+ *     they are processed.
+ * @param timed whether the stages of parsing are timed. Counts in the metrics of
+ *     each chromosome are kept regardless.
+ * @param thread_metrics metrics of this thread, i.e. its barrier waits.
  */
+template <typename Source>
 static void
 worker(
     int thread,
@@ -302,66 +1205,106 @@ worker(
     Dumpable &dumpable,
     Ordering &order,
     std::string &rapid_output_path,
+    const std::pair<int, int> &id1_range,
     int chromosome_start,
     int chromosome_end,
-    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix)
+    std::vector<struct chromosome_state> &chromosomes,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix,
+    double min_segment_length,
+    bool timed,
+    struct stage_metrics &thread_metrics)
 {
-    // Input file for each chromosome
-    std::vector<std::istream*> inputs;
-    chromosome_end = std::min(chromosome_end, NUM_CHROMOSOMES);
+    StageTimer timer(timed);
+    chromosome_end = std::min(chromosome_end, (int) chromosomes.size());
     int num_chromosomes = chromosome_end - chromosome_start + 1;
-    inputs.reserve(num_chromosomes);
+    int num_finished_chromosomes = 0;
 
     for (int chrom = chromosome_start; chrom <= chromosome_end; ++chrom) {
-        if (chrom > NUM_CHROMOSOMES) {
+        struct chromosome_state &state = chromosomes[chrom - 1];
+        if (state.finished) {
+            ++num_finished_chromosomes;
             continue;
-        } else {
-            // Read gzipped rapid output file
-            std::string file_path = rapid_output_path + "/" + std::to_string(chrom) +"/results.max.gz";
-            std::ifstream *file = new std::ifstream(file_path, std::ios_base::in | std::ios_base::binary);
-            boost::iostreams::filtering_streambuf<boost::iostreams::input> *buffer = new boost::iostreams::filtering_streambuf<boost::iostreams::input>();
-            (*buffer).push(boost::iostreams::gzip_decompressor());
-            (*buffer).push(*file);
+        }
 
-            inputs.push_back(new std::istream(buffer));
+        // Read gzipped segments
+        std::string file_path = get_segment_file(Source::format, rapid_output_path, get_chromosome(chrom).name);
+        state.file = std::make_unique<std::ifstream>(file_path, std::ios_base::in | std::ios_base::binary);
+        state.buffer = std::make_unique<boost::iostreams::filtering_streambuf<boost::iostreams::input>>();
+        state.buffer->push(boost::iostreams::gzip_decompressor());
+        state.buffer->push(*state.file);
+        state.in = std::make_unique<std::istream>(state.buffer.get());
+        state.compressed_size = boost::filesystem::file_size(file_path);
+
+        // Skip what has been parsed before the checkpoint
+        if (state.offset > 0 && !state.in->ignore(state.offset)) {
+            throw std::runtime_error {"IBD segments are shorter than recorded in checkpoint: " + file_path};
         }
+        state.compressed_start = get_compressed_offset(state);
     }
 
-    // Index of the last individual processed for each chromosome
-    std::vector<int> prev_ids(num_chromosomes, -1);
-    // Segments shared by the last individual for each chromosome
-    std::vector<std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>>> chrom_to_id_to_haps_to_segment(num_chromosomes);
-
-    int num_finished_chromosomes = 0;
-    std::vector<bool> has_finished(num_chromosomes, false);
-
     while (num_finished_chromosomes != num_chromosomes) {
         for (int chrom = chromosome_start; chrom <= chromosome_end; ++chrom) {
-            int index = chrom - chromosome_start;
+            struct chromosome_state &state = chromosomes[chrom - 1];
 
-            if (has_finished[index]) {
+            if (state.finished) {
                 continue;
             }
-            std::istream &in = *inputs[index];
+            std::istream &in = *state.in;
             std::string line;
 
-            int num_finished_ids = prev_ids[index] == -1 ? -1 : 0;
+            int num_finished_ids = state.prev_id == -1 ? -1 : 0;
             while (num_finished_ids < NUM_IDS_PER_CYCLE) {
                 // Handle NUM_IDS_PER_CYCLE individuals in a cycle
-                if (!std::getline(in, line)) {
+                struct line_info info;
+                bool in_shard = false;
+                bool exausted = !std::getline(in, line);
+                timer.lap(state.metrics.decompress);
+                if (!exausted) {
+                    ++state.metrics.num_lines;
+                    state.offset += line.size() + 1;
+                    try {
+                        in_shard = Source::parse(line, info, order, id1_range, chrom);
+                    } catch (std::runtime_error &error) {
+                        // The master would wait for this thread forever
+                        std::cerr << error.what() << std::endl;
+                        std::exit(EXIT_FAILURE);
+                    }
+                    timer.lap(state.metrics.parse_line);
+                    // Lines are sorted by id1. The remaining lines belong to later shards.
+                    exausted = !in_shard && info.id1_index >= id1_range.second;
+                }
+
+                if (exausted) {
                     // This chromosome has been exausted
-                    has_finished[index] = true;
+                    state.finished = true;
                     ++num_finished_chromosomes;
 
                     // Update total IBD1 for the last individual
+                    state.metrics.num_pairs_created += state.id_to_haps_to_segment.size();
                     update_total_ibd1(
-                        chrom, prev_ids[index],
-                        chrom_to_id_to_haps_to_segment[index],
+                        chrom, state.prev_id,
+                        state.id_to_haps_to_segment,
                         matrix
                     );
+                    timer.lap(state.metrics.update_total_ibd1);
+                    if (state.store) {
+                        store_total_ibd(chrom, state.prev_id, state.id_to_haps_to_segment, *state.store);
+                        state.store->close();
+                        state.store.reset();
+                    }
+                    if (state.segments) {
+                        store_segments(chrom, state.prev_id, state.id_to_haps_to_segment, *state.segments);
+                        state.segments->close();
+                        state.segments.reset();
+                    }
 
                     // Discard information about the last individual
-                    chrom_to_id_to_haps_to_segment[index].clear();
+                    state.id_to_haps_to_segment.clear();
+
+                    // Close the input
+                    state.in.reset();
+                    state.buffer.reset();
+                    state.file.reset();
 
                     // All individuals can be dumped
                     dumpable.update(chrom, order.get_last_index());
@@ -369,18 +1312,30 @@ worker(
                     break;
                 } else {
                     // This chromosome has not been exausted
-                    struct line_info info;
-                    parse_line(line, info, order);
-                    if (info.id1_index == info.id2_index) {
+                    if (!in_shard || info.id1_index == info.id2_index ||
+                        !clip_to_region(chrom, info.starting_site, info.ending_site)) {
+                        continue;
+                    }
+                    if (info.id1_index < state.prev_id) {
+                        // Individuals are dumped once their segments are exausted
+                        std::cerr << "Segments of chromosome " << get_chromosome(chrom).name
+                                  << " are not sorted by their first individual in VCF order" << std::endl;
+                        std::exit(EXIT_FAILURE);
+                    }
+                    // Short segments, mostly between unrelated individuals, never
+                    // reach the segments of the individual or the matrix
+                    if (min_segment_length > 0 &&
+                        get_genetic_length(info.starting_site, info.ending_site, chrom) < min_segment_length) {
+                        ++state.metrics.num_short_segments;
                         continue;
                     }
 
-                    // Segments shared by the individual of the previous segment
-                    // on this chromosome
-                    std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> &id_to_haps_to_segment = chrom_to_id_to_haps_to_segment[index];
-
-                    if (process_segment(info, chrom, chromosome_start, prev_ids, id_to_haps_to_segment, matrix)) {
+                    ++state.metrics.num_segments;
+                    bool is_new_individual = process_segment(info, chrom, state, matrix, timer);
+                    timer.lap(state.metrics.process_segment);
+                    if (is_new_individual) {
                         // Segments for the previous individual on this chromosome have been exausted
+                        ++state.metrics.num_ids;
                         ++num_finished_ids;
                         if (num_finished_ids == NUM_IDS_PER_CYCLE) {
                             dumpable.update(chrom, info.id1_index - 1);
@@ -391,6 +1346,7 @@ worker(
         }
 
         {
+            timer.start();
             std::unique_lock<std::mutex> lock(proceed.mutex);
             if (proceed.increment_num_blocked_and_get() == num_threads) {
                 // This thread is the last thread that reaches synchronization.
@@ -405,6 +1361,7 @@ worker(
 
             // Allow this thread to block at next synchronization
             proceed.disallow_thread_proceed(thread);
+            timer.lap(thread_metrics.barrier_wait);
         }
 
     }
@@ -437,7 +1394,7 @@ worker(
  *     is a struct pair_stats that records the total IBD1 and IBD2 between individual
  *     with index i and individual with index j.
  */
-static void
+void
 update_total_ibd1(
     int chromosome_number,
     int id_index,
@@ -461,6 +1418,143 @@ update_total_ibd1(
 }
 
 
+/**
+ * Write the total IBD1 and IBD2 shared between an individual specified by id_index
+ * and any other individual on one chromosome to the pair store of the chromosome.
+ * IBD2 is the total overlap between segments on complementary haplotype
+ * combinations, which process_segment accumulates as segments arrive.
+ *
+ * @param chromosome_number
+ * @param id_index index of the individual. No-op if -1.
+ * @param id_to_haps_to_segment an unordered map from the index of the other individual
+ *     in the pair to a vector of vectors of segments, as in update_total_ibd1.
+ * @param store pair store of the chromosome.
+ */
+static void
+store_total_ibd(
+    int chromosome_number,
+    int id_index,
+    std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> &id_to_haps_to_segment,
+    PairStoreWriter &store)
+{
+    if (id_index == -1) {
+        return;
+    }
+
+    std::vector<struct stored_pair> pairs;
+    pairs.reserve(id_to_haps_to_segment.size());
+    for (auto &iter : id_to_haps_to_segment) {
+        struct stored_pair pair;
+        pair.id1_index = id_index;
+        pair.id2_index = iter.first;
+        pair.total_ibd1 = compute_total_ibd1(*merge_four_segment_vectors(
+            iter.second[haps_to_encoding(0, 0)],
+            iter.second[haps_to_encoding(0, 1)],
+            iter.second[haps_to_encoding(1, 0)],
+            iter.second[haps_to_encoding(1, 1)]
+            ).get(),
+            chromosome_number
+        );
+
+        GeneticLengthSum total_ibd2(chromosome_number);
+        for (int encoding : {haps_to_encoding(0, 0), haps_to_encoding(1, 0)}) {
+            for (auto &segment : iter.second[encoding]) {
+                for (auto &complement : iter.second[haps_encoding_to_complement(encoding)]) {
+                    int start = get_intersection_start(segment.first, complement.first);
+                    int end = get_intersection_end(segment.second, complement.second);
+                    if (intersect(start, end)) {
+                        total_ibd2.add(start, end);
+                    }
+                }
+            }
+        }
+        pair.total_ibd2 = total_ibd2.get();
+        pairs.push_back(pair);
+    }
+
+    store.write(id_index, pairs);
+}
+
+
+
+/**
+ * Write the merged segments shared between an individual specified by id_index
+ * and any other individual on one chromosome to the spool of the chromosome.
+ * IBD2 intervals are the overlaps between segments on complementary haplotype
+ * combinations, as in store_total_ibd.
+ *
+ * @param chromosome_number
+ * @param id_index index of the individual. No-op if -1.
+ * @param id_to_haps_to_segment an unordered map from the index of the other individual
+ *     in the pair to a vector of vectors of segments, as in update_total_ibd1.
+ * @param spool segment spool of the chromosome.
+ */
+static void
+store_segments(
+    int chromosome_number,
+    int id_index,
+    std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> &id_to_haps_to_segment,
+    SegmentSpoolWriter &spool)
+{
+    if (id_index == -1) {
+        return;
+    }
+
+    std::vector<struct pair_segments> pairs(id_to_haps_to_segment.size());
+    auto pair = pairs.begin();
+    for (auto &iter : id_to_haps_to_segment) {
+        pair->id1_index = id_index;
+        pair->id2_index = iter.first;
+        pair->ibd = merge_overlapping_segments(*merge_four_segment_vectors(
+            iter.second[haps_to_encoding(0, 0)],
+            iter.second[haps_to_encoding(0, 1)],
+            iter.second[haps_to_encoding(1, 0)],
+            iter.second[haps_to_encoding(1, 1)]
+        ));
+
+        std::vector<std::pair<int, int>> overlaps;
+        for (int encoding : {haps_to_encoding(0, 0), haps_to_encoding(1, 0)}) {
+            for (auto &segment : iter.second[encoding]) {
+                for (auto &complement : iter.second[haps_encoding_to_complement(encoding)]) {
+                    int start = get_intersection_start(segment.first, complement.first);
+                    int end = get_intersection_end(segment.second, complement.second);
+                    if (intersect(start, end)) {
+                        overlaps.emplace_back(start, end);
+                    }
+                }
+            }
+        }
+        std::sort(overlaps.begin(), overlaps.end());
+        pair->ibd2 = merge_overlapping_segments(overlaps);
+        ++pair;
+    }
+
+    spool.write(id_index, pairs);
+}
+
+
+/**
+ * Merge overlapping segments, the same way compute_total_ibd1 does.
+ *
+ * @param segments a vector of segments sorted by their starts.
+ *
+ * @return disjoint segments covering the same sites, sorted by their starts.
+ */
+static std::vector<std::pair<int, int>>
+merge_overlapping_segments(std::vector<std::pair<int, int>> &segments)
+{
+    std::vector<std::pair<int, int>> merged;
+    for (auto &segment : segments) {
+        if (!merged.empty() && intersect(get_intersection_start(merged.back().first, segment.first),
+                get_intersection_end(merged.back().second, segment.second))) {
+            merged.back().second = std::max(merged.back().second, segment.second);
+        } else {
+            merged.push_back(segment);
+        }
+    }
+    return merged;
+}
+
 static void tokenize_line(const std::string& str,
 		std::vector<std::string>& tokens,
 		const std::string& delimiters)
@@ -487,12 +1581,17 @@ static void tokenize_line(const std::string& str,
  * @param one line of RaPID output
  * @param info a struct line_info that will be filled
  * @param order an Ordering that specifies the ordering of the IDs as they appear in VCF.
+ * @param id1_range half-open range of indices of id1 to parse. Only id1_index is
+ *     filled for lines outside of it.
+ *
+ * @return whether id1 is in id1_range.
  */
-static void
+bool
 parse_line(
     std::string &line,
     struct line_info &info,
-    class Ordering &order)
+    class Ordering &order,
+    const std::pair<int, int> &id1_range)
 {
   //  std::vector<std::string> res;//(10);
 //    std::cout << "line:" << line << "\n";
@@ -529,6 +1628,10 @@ parse_line(
                 // Second field in a line is id1
                 info.id1_index = order.get_index(field);
 		// std::cout << info.id1_index << ":id\n";
+                if (info.id1_index < id1_range.first || info.id1_index >= id1_range.second) {
+                    // Belongs to another shard
+                    return false;
+                }
                 break;
             case 3:
                 // Third field is id2
@@ -559,6 +1662,141 @@ parse_line(
         ++token_count;
     }
 
+    return true;
+}
+
+
+/**
+ * Find the first fields of a line separated by tabs or spaces, without copying it.
+ *
+ * @param line
+ * @param fields filled with the start of each field.
+ * @param lengths filled with the length of each field.
+ * @param num_fields number of fields to find.
+ *
+ * @return whether the line has num_fields fields.
+ */
+static inline bool
+split_fields(const std::string &line, const char **fields, size_t *lengths, int num_fields)
+{
+    const char *p = line.c_str();
+    for (int i = 0; i < num_fields; ++i) {
+        p += std::strspn(p, " \t");
+        if (*p == '\0') {
+            return false;
+        }
+        fields[i] = p;
+        lengths[i] = std::strcspn(p, " \t");
+        p += lengths[i];
+    }
+    return true;
+}
+
+
+/**
+ * Finish a segment located by base-pair positions. The individuals are ordered
+ * as in RaPID output, the one that comes first in the VCF being id1, and the
+ * positions are converted to sites.
+ *
+ * @param info a struct line_info with both individuals and haplotypes filled.
+ * @param chromosome_number the chromosome the segment is on.
+ * @param start_position first base pair of the segment.
+ * @param end_position last base pair of the segment.
+ * @param id1_range half-open range of indices of id1 to parse.
+ *
+ * @return whether id1 is in id1_range and the segment spans more than one site.
+ */
+static inline bool
+locate_segment(
+    struct line_info &info,
+    int chromosome_number,
+    long start_position,
+    long end_position,
+    const std::pair<int, int> &id1_range)
+{
+    if (info.id1_index > info.id2_index) {
+        std::swap(info.id1_index, info.id2_index);
+        std::swap(info.hap1, info.hap2);
+    }
+    if (info.id1_index < id1_range.first || info.id1_index >= id1_range.second) {
+        // Belongs to another shard
+        return false;
+    }
+    return get_sites(chromosome_number, start_position, end_position, info.starting_site, info.ending_site);
+}
+
+
+/**
+ * Parse a line of hap-IBD output: sample 1, its haplotype (1 or 2), sample 2, its
+ * haplotype, chromosome, first and last base pairs and length in cM.
+ */
+bool
+HapIbdSource::parse(
+    std::string &line,
+    struct line_info &info,
+    class Ordering &order,
+    const std::pair<int, int> &id1_range,
+    int chromosome_number)
+{
+    const char *fields[7];
+    size_t lengths[7];
+    if (!split_fields(line, fields, lengths, 7)) {
+        throw std::runtime_error {"Malformed hap-IBD line: " + line};
+    }
+
+    std::string id1(fields[0], lengths[0]);
+    std::string id2(fields[2], lengths[2]);
+    info.id1_index = order.find_index(id1);
+    info.id2_index = order.find_index(id2);
+    info.hap1 = fields[1][0] == '2';
+    info.hap2 = fields[3][0] == '2';
+    return locate_segment(
+        info, chromosome_number, std::strtol(fields[5], NULL, 10), std::strtol(fields[6], NULL, 10), id1_range);
+}
+
+
+/**
+ * @param field a field of iLASH output.
+ * @param length length of the field.
+ *
+ * @return whether the field is a sample suffixed by "_0", "_1", ".0" or ".1".
+ */
+static inline bool
+is_ilash_haplotype(const char *field, size_t length)
+{
+    return length >= 3 && (field[length - 2] == '_' || field[length - 2] == '.') &&
+        (field[length - 1] == '0' || field[length - 1] == '1');
+}
+
+
+/**
+ * Parse a line of iLASH output: family and haplotype of sample 1, family and
+ * haplotype of sample 2, chromosome, first and last base pairs, and so on.
+ * Haplotypes are samples suffixed by "_0", "_1", ".0" or ".1".
+ */
+bool
+IlashSource::parse(
+    std::string &line,
+    struct line_info &info,
+    class Ordering &order,
+    const std::pair<int, int> &id1_range,
+    int chromosome_number)
+{
+    const char *fields[7];
+    size_t lengths[7];
+    if (!split_fields(line, fields, lengths, 7) || !is_ilash_haplotype(fields[1], lengths[1]) ||
+        !is_ilash_haplotype(fields[3], lengths[3])) {
+        throw std::runtime_error {"Malformed iLASH line: " + line};
+    }
+
+    std::string id1(fields[1], lengths[1] - 2);
+    std::string id2(fields[3], lengths[3] - 2);
+    info.id1_index = order.find_index(id1);
+    info.id2_index = order.find_index(id2);
+    info.hap1 = fields[1][lengths[1] - 1] == '1';
+    info.hap2 = fields[3][lengths[3] - 1] == '1';
+    return locate_segment(
+        info, chromosome_number, std::strtol(fields[5], NULL, 10), std::strtol(fields[6], NULL, 10), id1_range);
 }
 
 
@@ -567,41 +1805,47 @@ parse_line(
  *
  * @param info a struct line_info that contains information about the segment.
  * @param chromosome_number the chromosome the segment is on.
- * @param chromosome_start the first chromosome the thread calling this function
- *     is responsible for.
- * @param prev_ids a vector of indices of the last individuals processed on chromosomes
- *     the calling thread is responsible for.
- * @param id_to_haps_to_segment an unordered map from the index of the other individual
- *     in the pair to a vector of vectors of segments. The each inner vectors contain
- *     segments on haplotypes 0-0, 0-1, 1-0, and 1-1. The exact index is converted using
- *     haps_to_encoding.
+ * @param state parsing progress of the chromosome. Its id_to_haps_to_segment is an
+ *     unordered map from the index of the other individual in the pair to a vector
+ *     of vectors of segments. The each inner vectors contain segments on haplotypes
+ *     0-0, 0-1, 1-0, and 1-1. The exact index is converted using haps_to_encoding.
  * @param matrix a 2D unordered map where M[i][j]
  *     is a struct pair_stats that records the total IBD1 and IBD2 between individual
  *     with index i and individual with index j.
  *
+ * @param timer timer of the worker thread. Updating total IBD1 is timed on its own.
+ *
  * @return whether this individual is a new individual on the input chromosome
  */
-static bool
+bool
 process_segment(
     struct line_info &info,
     int chromosome_number,
-    int chromosome_start,
-    std::vector<int> &prev_ids,
-    std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> &id_to_haps_to_segment,
-    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix)
+    struct chromosome_state &state,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix,
+    StageTimer &timer)
 {
     int hap_encoding = haps_to_encoding(info.hap1, info.hap2);
-    int index = chromosome_number - chromosome_start;
+    std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> &id_to_haps_to_segment = state.id_to_haps_to_segment;
 
-    bool is_same_individual_as_last_segment = info.id1_index == prev_ids[index];
+    bool is_same_individual_as_last_segment = info.id1_index == state.prev_id;
     if (!is_same_individual_as_last_segment) {
         // New individual
 
-        update_total_ibd1(chromosome_number, prev_ids[index], id_to_haps_to_segment, matrix);
+        timer.lap(state.metrics.process_segment);
+        state.metrics.num_pairs_created += id_to_haps_to_segment.size();
+        update_total_ibd1(chromosome_number, state.prev_id, id_to_haps_to_segment, matrix);
+        timer.lap(state.metrics.update_total_ibd1);
+        if (state.store) {
+            store_total_ibd(chromosome_number, state.prev_id, id_to_haps_to_segment, *state.store);
+        }
+        if (state.segments) {
+            store_segments(chromosome_number, state.prev_id, id_to_haps_to_segment, *state.segments);
+        }
         id_to_haps_to_segment.clear();
 
         // Remeber this new individual
-        prev_ids[index] = info.id1_index;
+        state.prev_id = info.id1_index;
 
     } else {
         // Still the same individual as last one
@@ -609,15 +1853,18 @@ process_segment(
         if (iter != id_to_haps_to_segment[info.id2_index].end()) {
             // Complements exist. Scan them to find IBD2
             std::vector<std::pair<int, int>> &segments = iter->second;
+            // The pair is in the matrix by the time its IBD1 is updated anyway
+            struct pair_stats &stats = matrix[info.id1_index][info.id2_index];
+            GeneticLengthSum total_ibd2(chromosome_number, stats.total_ibd2);
             for (auto &segment : segments) {
                 int start = get_intersection_start(info.starting_site, segment.first);
                 int end = get_intersection_end(info.ending_site, segment.second);
                 if (intersect(start, end)) {
-                    // Update total IBD2
-                    struct pair_stats &stats = matrix[info.id1_index][info.id2_index];
-                    stats.total_ibd2 += get_genetic_length(start, end, chromosome_number);
+                    total_ibd2.add(start, end);
                 }
             }
+            // Update total IBD2
+            stats.total_ibd2 = total_ibd2.get();
         }
     }
 
@@ -704,7 +1951,7 @@ haps_to_encoding(int hap1, int hap2)
  *
  * @return a unique pointer to merged vector of segments.
  */
-static inline std::unique_ptr<std::vector<std::pair<int, int>>>
+std::unique_ptr<std::vector<std::pair<int, int>>>
 merge_four_segment_vectors(
     std::vector<std::pair<int, int>> &segments1,
     std::vector<std::pair<int, int>> &segments2,
@@ -774,12 +2021,12 @@ merge_two_segment_vectors(
  *
  * @return total IBD1 length of the input segments without overlap.
  */
-static inline double
+double
 compute_total_ibd1(
     std::vector<std::pair<int, int>> &segments,
     int chromosome_number)
 {
-    double ans = 0;
+    GeneticLengthSum ans(chromosome_number);
     int current_start = segments.front().first;
     int current_end = segments.front().second;
     unsigned int next = 1;
@@ -792,14 +2039,14 @@ compute_total_ibd1(
         if (intersect(intersection_start, intersection_end)) {
             current_end = std::max(current_end, next_end);
         } else {
-            ans += get_genetic_length(current_start, current_end, chromosome_number);
+            ans.add(current_start, current_end);
             current_start = next_start;
             current_end = next_end;
         }
         ++next;
     }
 
-    ans += get_genetic_length(current_start, current_end, chromosome_number);
+    ans.add(current_start, current_end);
 
-    return ans;
+    return ans.get();
 }
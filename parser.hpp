@@ -10,18 +10,138 @@
 
 #include <unordered_map>
 #include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+
+#include "output_writer.hpp"
+#include "candidate_store.hpp"
+#include "metrics.hpp"
+#include "segment_source.hpp"
+
+class PairStoreWriter;
+class SegmentSpoolWriter;
+
+// Options of a relatedness inference run.
+struct master_options {
+    // Largest degree user is looking for
+    int max_degree = 4;
+    // Number of worker threads to spawn
+    unsigned int num_threads = 22;
+    // Folder predictions.txt and checkpoints are written to. Empty or ending with '/'.
+    std::string output_path;
+    // Seconds between two checkpoints. No checkpoint is taken if 0.
+    int checkpoint_interval = 0;
+    // Continue from the last checkpoint instead of starting over
+    bool resume = false;
+    // Folder of the per-chromosome pair store. Empty or ending with '/'. Nothing is
+    // stored if empty.
+    std::string pair_store_path;
+    // Chromosomes whose pair stores are built on their own from their RaPID outputs
+    // (map), independently of other chromosomes
+    std::vector<int> map_chromosomes;
+    // Merge the pair stores of all chromosomes and classify all pairs (reduce)
+    bool reduce = false;
+    // This run only handles pairs whose id1 is in the shard-th of num_shards equal
+    // slices of the ordering. Not sharded if num_shards is 0.
+    int shard = 0;
+    int num_shards = 0;
+    // Format of final output
+    OutputFormat output_format = OutputFormat::TSV;
+    // Folder of the temporary output of candidate pairs. The output directory if empty.
+    std::string temporary_path;
+    // Compression of the temporary output
+    CandidateCodec temporary_codec = CandidateCodec::GZIP;
+    // Bytes of candidate pairs kept in memory before they are spilled to the
+    // temporary output
+    uint64_t candidate_memory = 0;
+    // Write the totals of every pair and the calibration to the pair-totals sidecar
+    bool pair_totals = false;
+    // Pairs with kinship coefficients below this are left out of the sidecar.
+    // Negative to derive it from the largest supported degree.
+    double pair_totals_floor = -1;
+    // File the metrics of the run are reported to as JSON, at the end and on
+    // SIGUSR1. Stages are not timed if empty.
+    std::string metrics_path;
+    // Segments shorter than this in cM are dropped as soon as they are parsed.
+    // Negative to derive it from the largest degree.
+    double min_segment_length = 0;
+    // Seconds between two snapshots of progress, memory, throughput and ETA printed
+    // to stderr. None is printed if 0, except on SIGUSR1.
+    int progress_interval = 0;
+    // Individuals whose segments on a few chromosomes calibrate the inference
+    // boundaries before parsing, so that pairs are classified as they are dumped.
+    // No calibration pre-pass if 0.
+    int calibration_ids = 0;
+    // Merged segments of pairs with kinship coefficients of at least this are
+    // exported to {output_path}segments.bin. None are exported if negative.
+    double segment_kinship = -1;
+    // Whether the kinship coefficients of final output are also written as a
+    // sparse matrix, kinship.csr and kinship.grm.sp.
+    bool kinship_matrix = false;
+    // Format of the IBD segments read from rapid_output_path
+    SegmentFormat segment_format = SegmentFormat::RAPID;
+    // Path of the VCFs up to the chromosome name, {vcf_prefix}{name}.vcf.gz. The
+    // positions of their sites locate segments that are not given as sites.
+    std::string vcf_prefix;
+};
 
 void master(
     std::string &vcf_path,
     std::string &rapid_output_path,
     std::string &map_path,
-    int max_degree,
-    unsigned int num_threads,
-    std::ostream &out);
+    const struct master_options &options);
+
+void merge_shards(
+    std::string &vcf_path,
+    std::string &map_path,
+    const struct master_options &options);
+
+void reclassify(
+    const std::string &totals_path,
+    const std::string &calibration,
+    const struct master_options &options);
+
+void map_reduce(
+    std::string &vcf_path,
+    std::string &rapid_output_path,
+    std::string &map_path,
+    const struct master_options &options);
 
 struct pair_stats {
         double total_ibd1 = 0;
         double total_ibd2 = 0;
 };
 
+// Progress of parsing the RaPID output of one chromosome.
+struct chromosome_state {
+    // Gzipped RaPID output
+    std::unique_ptr<std::ifstream> file;
+    std::unique_ptr<boost::iostreams::filtering_streambuf<boost::iostreams::input>> buffer;
+    std::unique_ptr<std::istream> in;
+    // Number of decompressed bytes consumed so far
+    uint64_t offset = 0;
+    // Index of the last individual processed, -1 if none
+    int prev_id = -1;
+    // Whether the output has been exausted
+    bool finished = false;
+    // Segments shared by the last individual, keyed by the other individual and
+    // then by the haplotype encoding
+    std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> id_to_haps_to_segment;
+    // Pair store of this chromosome, if one is written
+    std::unique_ptr<PairStoreWriter> store;
+    // Size of the partial pair store at the last checkpoint
+    uint64_t store_offset = 0;
+    // Spool of the merged segments of this chromosome, if segments are exported
+    std::unique_ptr<SegmentSpoolWriter> segments;
+    // Size of the gzipped RaPID output and how much of it had been consumed when
+    // this run started
+    uint64_t compressed_size = 0;
+    uint64_t compressed_start = 0;
+    // Time spent and work done on this chromosome in this run
+    struct stage_metrics metrics;
+};
+
 #endif
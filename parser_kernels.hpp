@@ -0,0 +1,101 @@
+/**
+ * This file declares the functions of parser.cpp that handle one line of IBD
+ * segments or the segments of one individual at a time, so that they can be
+ * measured on their own.
+ *
+ */
+
+#ifndef PARSER_KERNELS_HPP
+#define PARSER_KERNELS_HPP
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "parser.hpp"
+#include "ordering.hpp"
+#include "metrics.hpp"
+
+// Information parsed from a line.
+struct line_info {
+    int id1_index = -1;
+    int id2_index = -1;
+    int hap1;
+    int hap2;
+    int starting_site;
+    int ending_site;
+};
+
+bool parse_line(
+    std::string &line,
+    struct line_info &info,
+    class Ordering &order,
+    const std::pair<int, int> &id1_range);
+
+// Readers of one line of the segments of each supported IBD caller. Workers are
+// specialized for the reader of a run at compile time. parse fills info as
+// parse_line does and returns whether id1 is in id1_range. Segments located by
+// base-pair position are converted to sites, and are skipped as outside of
+// id1_range if they do not span more than one site.
+struct RapidSource {
+    static constexpr SegmentFormat format = SegmentFormat::RAPID;
+
+    static bool parse(
+        std::string &line,
+        struct line_info &info,
+        class Ordering &order,
+        const std::pair<int, int> &id1_range,
+        int chromosome_number)
+    {
+        return parse_line(line, info, order, id1_range);
+    }
+};
+
+struct HapIbdSource {
+    static constexpr SegmentFormat format = SegmentFormat::HAP_IBD;
+
+    static bool parse(
+        std::string &line,
+        struct line_info &info,
+        class Ordering &order,
+        const std::pair<int, int> &id1_range,
+        int chromosome_number);
+};
+
+struct IlashSource {
+    static constexpr SegmentFormat format = SegmentFormat::ILASH;
+
+    static bool parse(
+        std::string &line,
+        struct line_info &info,
+        class Ordering &order,
+        const std::pair<int, int> &id1_range,
+        int chromosome_number);
+};
+
+bool process_segment(
+    struct line_info &info,
+    int chromosome_number,
+    struct chromosome_state &state,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix,
+    StageTimer &timer);
+
+void update_total_ibd1(
+    int chromosome_number,
+    int id_index,
+    std::unordered_map<int, std::unordered_map<int, std::vector<std::pair<int, int>>>> &id_to_haps_to_segment,
+    std::unordered_map<int, std::unordered_map<int, struct pair_stats>> &matrix);
+
+std::unique_ptr<std::vector<std::pair<int, int>>> merge_four_segment_vectors(
+    std::vector<std::pair<int, int>> &segments1,
+    std::vector<std::pair<int, int>> &segments2,
+    std::vector<std::pair<int, int>> &segments3,
+    std::vector<std::pair<int, int>> &segments4);
+
+double compute_total_ibd1(
+    std::vector<std::pair<int, int>> &segments,
+    int chromosome_number);
+
+#endif
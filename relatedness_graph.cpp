@@ -0,0 +1,362 @@
+/**
+ * This file is responsible for holding a finished result set in memory as an
+ * adjacency index, so that the relatives of an individual can be looked up
+ * without scanning the results.
+ *
+ * Both individuals of a pair list each other as a relative. The relatives of
+ * all individuals are stored back to back (compressed sparse rows) and sorted by
+ * kinship coefficient, closest first.
+ *
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+#include "classifier.hpp"
+#include "ordering.hpp"
+#include "relatedness_graph.hpp"
+
+// First bytes of binary results, see output_writer.cpp
+#define BINARY_MAGIC "RAFFIPB1"
+#define BINARY_MAGIC_LENGTH 8
+
+static bool parse_float(std::string_view field, float &value);
+
+/**
+ * Constructor of RelatednessGraph. Load final output in any of the output
+ * formats, told apart by the file name: predictions.txt, predictions.txt.gz or
+ * predictions.bin. Individuals are indexed in the order of the VCF, as by
+ * Ordering, so that individuals without relatives are included.
+ *
+ * @param results_path path of the final output.
+ * @param samples_path IDs of all individuals for text output, one per line or
+ *     a gzipped VCF (.vcf.gz). If empty, predictions.samples.txt next to the
+ *     output is used. Ignored for binary output, whose sample manifest is always
+ *     predictions.samples.txt.
+ */
+RelatednessGraph::RelatednessGraph(const std::string &results_path, const std::string &samples_path)
+{
+    // Index of one individual and the other individual as its relative
+    std::vector<std::pair<int, struct relative>> pairs;
+
+    if (boost::algorithm::ends_with(results_path, ".bin")) {
+        load_binary(results_path, pairs);
+    } else {
+        if (!samples_path.empty()) {
+            load_ids(samples_path);
+        } else {
+            std::string directory = results_path.substr(0, results_path.find_last_of('/') + 1);
+            load_ids(directory + "predictions.samples.txt");
+        }
+
+        std::ifstream file(results_path, std::ios_base::in | std::ios_base::binary);
+        if (!file) {
+            throw std::runtime_error {"Failed to open " + results_path};
+        }
+        boost::iostreams::filtering_streambuf<boost::iostreams::input> buffer;
+        if (boost::algorithm::ends_with(results_path, ".gz")) {
+            buffer.push(boost::iostreams::gzip_decompressor());
+        }
+        buffer.push(file);
+        std::istream in(&buffer);
+        load_text(in, pairs);
+    }
+
+    build(pairs);
+}
+
+
+/**
+ * @return number of individuals.
+ */
+int
+RelatednessGraph::size()
+{
+    return ids.size();
+}
+
+
+/**
+ * @return number of related pairs.
+ */
+uint64_t
+RelatednessGraph::get_num_pairs()
+{
+    return relatives.size() / 2;
+}
+
+
+/**
+ * @param id an ID.
+ *
+ * @return index of the individual, or -1 if the ID is unknown.
+ */
+int
+RelatednessGraph::get_index(const std::string &id)
+{
+    auto it = id_to_index.find(id);
+    return it == id_to_index.end() ? -1 : it->second;
+}
+
+
+/**
+ * @param index index of an individual.
+ *
+ * @return ID of the individual.
+ */
+const std::string&
+RelatednessGraph::get(int index)
+{
+    return ids[index];
+}
+
+
+/**
+ * @param index index of an individual.
+ *
+ * @return range of the relatives of the individual, closest first.
+ */
+std::pair<const struct relative *, const struct relative *>
+RelatednessGraph::get_relatives(int index)
+{
+    return {relatives.data() + offsets[index], relatives.data() + offsets[index + 1]};
+}
+
+
+/**
+ * @param index1 index of one individual.
+ * @param index2 index of the other individual.
+ *
+ * @return the relationship of the pair, or nullptr if they are not related. Its
+ *     index is whichever individual of the pair has fewer relatives.
+ */
+const struct relative*
+RelatednessGraph::find(int index1, int index2)
+{
+    // Both individuals list the pair, search the shorter list
+    if (offsets[index1 + 1] - offsets[index1] > offsets[index2 + 1] - offsets[index2]) {
+        std::swap(index1, index2);
+    }
+
+    std::pair<const struct relative *, const struct relative *> range = get_relatives(index1);
+    const struct relative *it = std::find_if(range.first, range.second, [index2](const struct relative &r) {
+        return r.index == index2;
+    });
+    return it == range.second ? nullptr : it;
+}
+
+
+/**
+ * Index the IDs of all individuals in order: the samples of a gzipped VCF
+ * (.vcf.gz), or a file with one ID per line.
+ *
+ * @param path path of the file.
+ */
+void
+RelatednessGraph::load_ids(const std::string &path)
+{
+    if (boost::algorithm::ends_with(path, ".vcf.gz")) {
+        std::string vcf_path = path;
+        Ordering order(vcf_path);
+        for (int index = 0; index < order.size(); ++index) {
+            add_id(order.get(index));
+        }
+        return;
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error {"Failed to open sample IDs " + path};
+    }
+    std::string id;
+    while (std::getline(in, id)) {
+        add_id(id);
+    }
+}
+
+
+/**
+ * Add an individual after those already indexed.
+ *
+ * @param id an ID.
+ */
+void
+RelatednessGraph::add_id(const std::string &id)
+{
+    if (id_to_index.insert({id, (int) ids.size()}).second) {
+        ids.push_back(id);
+    }
+}
+
+
+/**
+ * Read final output in TSV format. All individuals must have been indexed.
+ *
+ * @param in final output.
+ * @param pairs filled with every pair.
+ */
+void
+RelatednessGraph::load_text(std::istream &in, std::vector<std::pair<int, struct relative>> &pairs)
+{
+    std::string line;
+
+    // Header
+    std::getline(in, line);
+
+    while (std::getline(in, line)) {
+        // Split into the 7 tab-separated fields
+        std::string_view fields[7];
+        size_t num_fields = 0;
+        size_t start = 0;
+        while (num_fields < 7 && start <= line.size()) {
+            size_t end = std::min(line.find('\t', start), line.size());
+            fields[num_fields++] = std::string_view(line).substr(start, end - start);
+            start = end + 1;
+        }
+
+        struct relative pair;
+        if (num_fields != 7 || start <= line.size() ||
+            !parse_float(fields[2], pair.kinship_coefficient) ||
+            !parse_float(fields[3], pair.probability_ibd0) ||
+            !parse_float(fields[4], pair.probability_ibd1) ||
+            !parse_float(fields[5], pair.probability_ibd2)) {
+            throw std::runtime_error {"Malformed line in results: " + line};
+        }
+
+        pair.encoding = std::find(TYPES.begin(), TYPES.end(), fields[6]) - TYPES.begin();
+        if (pair.encoding == NUM_TYPES) {
+            throw std::runtime_error {"Unknown type of relationship: " + std::string(fields[6])};
+        }
+        int id1_index = get_index(std::string(fields[0]));
+        pair.index = get_index(std::string(fields[1]));
+        if (id1_index < 0 || pair.index < 0) {
+            throw std::runtime_error {"Results contain an ID missing from the sample IDs: " + line};
+        }
+        pairs.push_back({id1_index, pair});
+    }
+}
+
+
+/**
+ * Read final output in binary format and the sample manifest next to it.
+ *
+ * @param path path of predictions.bin.
+ * @param pairs filled with every pair.
+ */
+void
+RelatednessGraph::load_binary(const std::string &path, std::vector<std::pair<int, struct relative>> &pairs)
+{
+    load_ids(path.substr(0, path.size() - 4) + ".samples.txt");
+
+    std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+    char magic[BINARY_MAGIC_LENGTH];
+    uint32_t num_ids;
+    if (!in.read(magic, BINARY_MAGIC_LENGTH) || std::memcmp(magic, BINARY_MAGIC, BINARY_MAGIC_LENGTH) ||
+        !in.read(reinterpret_cast<char *>(&num_ids), sizeof(num_ids))) {
+        throw std::runtime_error {"Not binary results: " + path};
+    }
+    if (num_ids != ids.size()) {
+        throw std::runtime_error {"Sample manifest does not match " + path};
+    }
+
+    uint32_t num_pairs;
+    std::vector<uint32_t> id1_indices, id2_indices;
+    std::vector<float> kinship_coefficients, probabilities_ibd0, probabilities_ibd1, probabilities_ibd2;
+    std::vector<uint8_t> encodings;
+    while (in.read(reinterpret_cast<char *>(&num_pairs), sizeof(num_pairs))) {
+        id1_indices.resize(num_pairs);
+        id2_indices.resize(num_pairs);
+        kinship_coefficients.resize(num_pairs);
+        probabilities_ibd0.resize(num_pairs);
+        probabilities_ibd1.resize(num_pairs);
+        probabilities_ibd2.resize(num_pairs);
+        encodings.resize(num_pairs);
+
+        in.read(reinterpret_cast<char *>(id1_indices.data()), num_pairs * sizeof(uint32_t));
+        in.read(reinterpret_cast<char *>(id2_indices.data()), num_pairs * sizeof(uint32_t));
+        in.read(reinterpret_cast<char *>(kinship_coefficients.data()), num_pairs * sizeof(float));
+        in.read(reinterpret_cast<char *>(probabilities_ibd0.data()), num_pairs * sizeof(float));
+        in.read(reinterpret_cast<char *>(probabilities_ibd1.data()), num_pairs * sizeof(float));
+        in.read(reinterpret_cast<char *>(probabilities_ibd2.data()), num_pairs * sizeof(float));
+        if (!in.read(reinterpret_cast<char *>(encodings.data()), num_pairs * sizeof(uint8_t))) {
+            throw std::runtime_error {"Truncated binary results: " + path};
+        }
+
+        for (uint32_t i = 0; i < num_pairs; ++i) {
+            if (id1_indices[i] >= num_ids || id2_indices[i] >= num_ids || encodings[i] >= NUM_TYPES) {
+                throw std::runtime_error {"Corrupt binary results: " + path};
+            }
+            struct relative pair {
+                (int) id2_indices[i],
+                kinship_coefficients[i],
+                probabilities_ibd0[i],
+                probabilities_ibd1[i],
+                probabilities_ibd2[i],
+                encodings[i]
+            };
+            pairs.push_back({(int) id1_indices[i], pair});
+        }
+    }
+}
+
+
+/**
+ * Build the adjacency index. Each pair is added to the relatives of both of its
+ * individuals.
+ *
+ * @param pairs index of one individual and the other individual as its relative.
+ */
+void
+RelatednessGraph::build(const std::vector<std::pair<int, struct relative>> &pairs)
+{
+    // Count relatives of every individual
+    offsets.assign(ids.size() + 1, 0);
+    for (const auto &pair : pairs) {
+        ++offsets[pair.first + 1];
+        ++offsets[pair.second.index + 1];
+    }
+    for (size_t i = 1; i < offsets.size(); ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+
+    std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+    relatives.resize(offsets.back());
+    for (const auto &pair : pairs) {
+        relatives[next[pair.first]++] = pair.second;
+
+        struct relative reverse = pair.second;
+        reverse.index = pair.first;
+        relatives[next[pair.second.index]++] = reverse;
+    }
+
+    // Closest relatives first
+    for (size_t i = 0; i < ids.size(); ++i) {
+        std::sort(relatives.begin() + offsets[i], relatives.begin() + offsets[i + 1],
+            [](const struct relative &a, const struct relative &b) {
+                return a.kinship_coefficient > b.kinship_coefficient ||
+                    (a.kinship_coefficient == b.kinship_coefficient && a.index < b.index);
+            });
+    }
+}
+
+
+/**
+ * @param field a number as written by the output writers.
+ * @param value the number.
+ *
+ * @return whether the whole field is a number.
+ */
+static bool
+parse_float(std::string_view field, float &value)
+{
+    std::from_chars_result result = std::from_chars(field.data(), field.data() + field.size(), value);
+    return result.ec == std::errc() && result.ptr == field.data() + field.size();
+}
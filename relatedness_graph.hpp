@@ -0,0 +1,59 @@
+/**
+ * This file is responsible for holding a finished result set in memory as an
+ * adjacency index, so that the relatives of an individual can be looked up
+ * without scanning the results.
+ *
+ */
+
+#ifndef RELATEDNESS_GRAPH_HPP
+#define RELATEDNESS_GRAPH_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+// A relative of an individual
+struct relative {
+    // Index of the relative
+    int index;
+    float kinship_coefficient;
+    float probability_ibd0;
+    float probability_ibd1;
+    float probability_ibd2;
+    // Encoding of the type of relationship, an index of TYPES
+    int encoding;
+};
+
+class RelatednessGraph {
+public:
+    RelatednessGraph(const std::string &results_path, const std::string &samples_path = "");
+
+    int size();
+
+    uint64_t get_num_pairs();
+
+    int get_index(const std::string &id);
+
+    const std::string &get(int index);
+
+    std::pair<const struct relative *, const struct relative *> get_relatives(int index);
+
+    const struct relative *find(int index1, int index2);
+
+private:
+    std::vector<std::string> ids;
+    std::unordered_map<std::string, int> id_to_index;
+    // Relatives of individual i are relatives[offsets[i]] to relatives[offsets[i + 1] - 1],
+    // closest first
+    std::vector<uint64_t> offsets;
+    std::vector<struct relative> relatives;
+
+    void load_ids(const std::string &path);
+    void add_id(const std::string &id);
+    void load_text(std::istream &in, std::vector<std::pair<int, struct relative>> &pairs);
+    void load_binary(const std::string &path, std::vector<std::pair<int, struct relative>> &pairs);
+    void build(const std::vector<std::pair<int, struct relative>> &pairs);
+};
+
+#endif
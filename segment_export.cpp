@@ -0,0 +1,411 @@
+/**
+ * This file is responsible for exporting the merged IBD segments of related pairs:
+ * the intervals of sites a pair shares on any haplotype and on both haplotypes,
+ * indexed by the pair, for analyses that need more than the totals.
+ *
+ * Workers spool the merged segments of every pair of a chromosome to
+ * segments.chr{name}.partial as they finish an individual, so the master never
+ * waits on them. The master selects the pairs whose kinship coefficients reach the
+ * cutoff as it dumps them. Once parsing is done, the spools are merged and the
+ * segments of the selected pairs are written to segments.bin, which holds:
+ *
+ *   SEGMENT_EXPORT_MAGIC
+ *   the number of individuals as an int and their IDs, each an int length
+ *   followed by its characters
+ *   the number of chromosomes as an int and their names, encoded the same way
+ *   a block per pair: the number of chromosomes the pair shares segments on, and
+ *   for each of them its number (from 1, in the order above), the IBD intervals
+ *   and the IBD2 intervals
+ *   the index, a struct segment_index_entry per pair sorted by id1 and then id2
+ *   the offset of the index and the number of pairs as uint64_t, and
+ *   SEGMENT_EXPORT_MAGIC again
+ *
+ * Numbers in blocks are unsigned LEB128 varints. A list of intervals is its
+ * length followed by, for every interval, its first site minus the last site of
+ * the previous interval (0 for the first one) and its last site minus its first.
+ * Integers outside blocks are little-endian.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <queue>
+#include <tuple>
+#include <stdexcept>
+
+#include <boost/iostreams/filter/gzip.hpp>
+
+#include "mapper.hpp"
+#include "classifier.hpp"
+#include "segment_export.hpp"
+
+#define SEGMENT_EXPORT_MAGIC "RAFFISG1"
+#define SEGMENT_EXPORT_MAGIC_LENGTH 8
+
+// Entry of the index of segments.bin
+struct segment_index_entry {
+    int id1_index;
+    int id2_index;
+    // Offset of the block of the pair from the start of the file
+    uint64_t offset;
+};
+
+static void write_varint(std::ostream &out, uint64_t value);
+static bool read_varint(std::istream &in, uint64_t &value);
+static void write_intervals(std::ostream &out, const std::vector<std::pair<int, int>> &intervals);
+static bool read_intervals(std::istream &in, std::vector<std::pair<int, int>> &intervals);
+static void write_string(std::ostream &out, const std::string &value);
+
+
+/**
+ * @param output_path output directory. Empty or ending with '/'.
+ *
+ * @return path of the exported segments.
+ */
+std::string
+get_segment_export_file(const std::string &output_path)
+{
+    return output_path + "segments.bin";
+}
+
+
+/**
+ * @param output_path output directory. Empty or ending with '/'.
+ * @param chromosome name of the chromosome.
+ *
+ * @return path of the file the segments of the chromosome are spooled to.
+ */
+std::string
+get_segment_spool_file(const std::string &output_path, const std::string &chromosome)
+{
+    return output_path + "segments.chr" + chromosome + ".partial";
+}
+
+
+/**
+ * Constructor of SegmentSpoolWriter. Truncates the spool.
+ *
+ * @param path path of the spool of one chromosome.
+ */
+SegmentSpoolWriter::SegmentSpoolWriter(const std::string &path) :
+    path(path)
+{
+    file = std::make_unique<std::ofstream>(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!*file) {
+        throw std::runtime_error {"Failed to open " + path};
+    }
+    buffer = std::make_unique<boost::iostreams::filtering_streambuf<boost::iostreams::output>>();
+    buffer->push(boost::iostreams::gzip_compressor(boost::iostreams::gzip::best_speed));
+    buffer->push(*file);
+    out = std::make_unique<std::ostream>(buffer.get());
+}
+
+
+/**
+ * Write the merged segments of all pairs of one individual on this chromosome.
+ * Individuals must be written in increasing order of their indices.
+ *
+ * @param id1_index index of the individual.
+ * @param pairs merged segments of the pairs. Sorted by id2_index in place.
+ */
+void
+SegmentSpoolWriter::write(int id1_index, std::vector<struct pair_segments> &pairs)
+{
+    if (id1_index <= prev_id1_index) {
+        throw std::runtime_error {"RaPID output is not sorted by the first ID"};
+    }
+    prev_id1_index = id1_index;
+
+    std::sort(pairs.begin(), pairs.end(), [](const struct pair_segments &a, const struct pair_segments &b) {
+        return a.id2_index < b.id2_index;
+    });
+    for (const struct pair_segments &pair : pairs) {
+        write_varint(*out, pair.id1_index);
+        write_varint(*out, pair.id2_index);
+        write_intervals(*out, pair.ibd);
+        write_intervals(*out, pair.ibd2);
+    }
+    if (!*out) {
+        throw std::runtime_error {"Failed to write to " + path};
+    }
+}
+
+
+/**
+ * Finish writing the spool.
+ */
+void
+SegmentSpoolWriter::close()
+{
+    if (!out) {
+        return;
+    }
+    out.reset();
+    // Destroying the chain writes the gzip trailer
+    buffer.reset();
+    file->close();
+    if (!*file) {
+        throw std::runtime_error {"Failed to write to " + path};
+    }
+    file.reset();
+}
+
+
+/**
+ * Constructor of SegmentSpoolReader.
+ *
+ * @param path path of the spool of one chromosome.
+ */
+SegmentSpoolReader::SegmentSpoolReader(const std::string &path) :
+    path(path),
+    file(path, std::ios_base::in | std::ios_base::binary),
+    in(&buffer)
+{
+    if (!file) {
+        throw std::runtime_error {"Failed to open " + path};
+    }
+    buffer.push(boost::iostreams::gzip_decompressor());
+    buffer.push(file);
+}
+
+
+/**
+ * @param pair the next pair to be filled.
+ *
+ * @return false if there are no more pairs.
+ */
+bool
+SegmentSpoolReader::next(struct pair_segments &pair)
+{
+    uint64_t id1_index;
+    if (!read_varint(in, id1_index)) {
+        return false;
+    }
+    uint64_t id2_index;
+    if (!read_varint(in, id2_index) || !read_intervals(in, pair.ibd) || !read_intervals(in, pair.ibd2)) {
+        throw std::runtime_error {"Truncated segment spool " + path};
+    }
+    pair.id1_index = id1_index;
+    pair.id2_index = id2_index;
+    return true;
+}
+
+
+/**
+ * Constructor of SegmentExport.
+ *
+ * @param output_path output directory. Empty or ending with '/'. Spools are
+ *     read from and segments are written to it.
+ * @param min_kinship_coefficient pairs with kinship coefficients below this are
+ *     not exported.
+ */
+SegmentExport::SegmentExport(const std::string &output_path, double min_kinship_coefficient) :
+    output_path(output_path),
+    min_kinship_coefficient(min_kinship_coefficient) {}
+
+
+/**
+ * Select a pair for export if its kinship coefficient reaches the cutoff.
+ *
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param stats total IBD1 (excluding IBD2) and total IBD2 shared by the pair
+ *     across all chromosomes.
+ */
+void
+SegmentExport::select(int id1_index, int id2_index, const struct pair_stats &stats)
+{
+    if (compute_kinship_coefficient(stats.total_ibd1, stats.total_ibd2) >= min_kinship_coefficient) {
+        selected.emplace_back(id1_index, id2_index);
+    }
+}
+
+
+/**
+ * @return number of pairs selected so far.
+ */
+uint64_t
+SegmentExport::get_num_selected()
+{
+    return selected.size();
+}
+
+
+/**
+ * Merge the spools of all chromosomes, write the segments of the selected pairs
+ * to segments.bin and remove the spools. Only one pair per chromosome is held
+ * in memory besides the selection.
+ *
+ * @param order an Ordering whose IDs are embedded in the file.
+ */
+void
+SegmentExport::write(Ordering &order)
+{
+    std::sort(selected.begin(), selected.end());
+
+    std::string path = get_segment_export_file(output_path);
+    std::string partial_path = path + ".partial";
+    std::ofstream out(partial_path, std::ios::out | std::ios::trunc | std::ios::binary);
+
+    int num_ids = order.size();
+    out.write(SEGMENT_EXPORT_MAGIC, SEGMENT_EXPORT_MAGIC_LENGTH);
+    out.write(reinterpret_cast<const char *>(&num_ids), sizeof(int));
+    for (int index = 0; index < num_ids; ++index) {
+        write_string(out, order.get(index));
+    }
+    int num_chromosomes = get_num_chromosomes();
+    out.write(reinterpret_cast<const char *>(&num_chromosomes), sizeof(int));
+    for (int chrom = 1; chrom <= num_chromosomes; ++chrom) {
+        write_string(out, get_chromosome(chrom).name);
+    }
+
+    std::vector<std::unique_ptr<SegmentSpoolReader>> readers;
+    std::vector<struct pair_segments> heads(num_chromosomes);
+
+    // Min-heap of (id1_index, id2_index, chromosome number)
+    typedef std::tuple<int, int, int> key;
+    std::priority_queue<key, std::vector<key>, std::greater<key>> heap;
+
+    for (int chrom = 1; chrom <= num_chromosomes; ++chrom) {
+        readers.push_back(std::make_unique<SegmentSpoolReader>(
+            get_segment_spool_file(output_path, get_chromosome(chrom).name)));
+        if (readers.back()->next(heads[chrom - 1])) {
+            heap.emplace(heads[chrom - 1].id1_index, heads[chrom - 1].id2_index, chrom);
+        }
+    }
+
+    std::vector<struct segment_index_entry> index;
+    index.reserve(selected.size());
+    std::vector<int> shared;
+    auto next_selected = selected.begin();
+    while (!heap.empty()) {
+        std::pair<int, int> pair {std::get<0>(heap.top()), std::get<1>(heap.top())};
+
+        // Chromosomes this pair shares segments on
+        shared.clear();
+        while (!heap.empty() && std::get<0>(heap.top()) == pair.first && std::get<1>(heap.top()) == pair.second) {
+            shared.push_back(std::get<2>(heap.top()));
+            heap.pop();
+        }
+
+        while (next_selected != selected.end() && *next_selected < pair) {
+            ++next_selected;
+        }
+        if (next_selected != selected.end() && *next_selected == pair) {
+            index.push_back({pair.first, pair.second, (uint64_t) out.tellp()});
+            std::sort(shared.begin(), shared.end());
+            write_varint(out, shared.size());
+            for (int chrom : shared) {
+                write_varint(out, chrom);
+                write_intervals(out, heads[chrom - 1].ibd);
+                write_intervals(out, heads[chrom - 1].ibd2);
+            }
+        }
+
+        for (int chrom : shared) {
+            if (readers[chrom - 1]->next(heads[chrom - 1])) {
+                heap.emplace(heads[chrom - 1].id1_index, heads[chrom - 1].id2_index, chrom);
+            }
+        }
+    }
+
+    uint64_t index_offset = out.tellp();
+    uint64_t num_pairs = index.size();
+    out.write(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(struct segment_index_entry));
+    out.write(reinterpret_cast<const char *>(&index_offset), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(&num_pairs), sizeof(uint64_t));
+    out.write(SEGMENT_EXPORT_MAGIC, SEGMENT_EXPORT_MAGIC_LENGTH);
+    out.close();
+    if (!out) {
+        throw std::runtime_error {"Failed to write to " + partial_path};
+    }
+
+    readers.clear();
+    for (int chrom = 1; chrom <= num_chromosomes; ++chrom) {
+        std::remove(get_segment_spool_file(output_path, get_chromosome(chrom).name).c_str());
+    }
+    if (std::rename(partial_path.c_str(), path.c_str())) {
+        throw std::runtime_error {"Failed to write " + path};
+    }
+    std::vector<std::pair<int, int>>().swap(selected);
+}
+
+
+static void
+write_varint(std::ostream &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.put(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.put(static_cast<char>(value));
+}
+
+
+/**
+ * @return false if the stream ended before the varint.
+ */
+static bool
+read_varint(std::istream &in, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = in.get();
+        if (byte == std::char_traits<char>::eof()) {
+            return false;
+        }
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Write sorted, disjoint intervals delta-encoded.
+ */
+static void
+write_intervals(std::ostream &out, const std::vector<std::pair<int, int>> &intervals)
+{
+    write_varint(out, intervals.size());
+    int prev_end = 0;
+    for (const auto &interval : intervals) {
+        write_varint(out, interval.first - prev_end);
+        write_varint(out, interval.second - interval.first);
+        prev_end = interval.second;
+    }
+}
+
+
+static bool
+read_intervals(std::istream &in, std::vector<std::pair<int, int>> &intervals)
+{
+    uint64_t size;
+    if (!read_varint(in, size)) {
+        return false;
+    }
+    intervals.resize(size);
+    int prev_end = 0;
+    for (auto &interval : intervals) {
+        uint64_t gap;
+        uint64_t length;
+        if (!read_varint(in, gap) || !read_varint(in, length)) {
+            return false;
+        }
+        interval.first = prev_end + gap;
+        interval.second = interval.first + length;
+        prev_end = interval.second;
+    }
+    return true;
+}
+
+
+static void
+write_string(std::ostream &out, const std::string &value)
+{
+    int length = value.size();
+    out.write(reinterpret_cast<const char *>(&length), sizeof(int));
+    out.write(value.data(), length);
+}
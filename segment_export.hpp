@@ -0,0 +1,83 @@
+/**
+ * This file is responsible for exporting the merged IBD segments of related pairs:
+ * the intervals of sites a pair shares on any haplotype and on both haplotypes,
+ * indexed by the pair, for analyses that need more than the totals.
+ *
+ */
+
+#ifndef SEGMENT_EXPORT_HPP
+#define SEGMENT_EXPORT_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <utility>
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+
+#include "parser.hpp"
+#include "ordering.hpp"
+
+// Merged segments of a pair on one chromosome. Intervals are sorted, disjoint
+// and given as first and last sites, i.e. rows of the genetic map.
+struct pair_segments {
+    int id1_index;
+    int id2_index;
+    // Sites covered by segments on any haplotype combination, i.e. IBD1 or IBD2
+    std::vector<std::pair<int, int>> ibd;
+    // Sites covered by segments on complementary haplotype combinations, i.e. IBD2
+    std::vector<std::pair<int, int>> ibd2;
+};
+
+std::string get_segment_export_file(const std::string &output_path);
+
+std::string get_segment_spool_file(const std::string &output_path, const std::string &chromosome);
+
+class SegmentSpoolWriter {
+public:
+    SegmentSpoolWriter(const std::string &path);
+
+    void write(int id1_index, std::vector<struct pair_segments> &pairs);
+
+    void close();
+
+private:
+    std::string path;
+    int prev_id1_index = -1;
+    std::unique_ptr<std::ofstream> file;
+    std::unique_ptr<boost::iostreams::filtering_streambuf<boost::iostreams::output>> buffer;
+    std::unique_ptr<std::ostream> out;
+};
+
+class SegmentSpoolReader {
+public:
+    SegmentSpoolReader(const std::string &path);
+
+    bool next(struct pair_segments &pair);
+
+private:
+    std::string path;
+    std::ifstream file;
+    boost::iostreams::filtering_streambuf<boost::iostreams::input> buffer;
+    std::istream in;
+};
+
+class SegmentExport {
+public:
+    SegmentExport(const std::string &output_path, double min_kinship_coefficient);
+
+    void select(int id1_index, int id2_index, const struct pair_stats &stats);
+
+    uint64_t get_num_selected();
+
+    void write(Ordering &order);
+
+private:
+    std::string output_path;
+    double min_kinship_coefficient;
+    // Pairs whose segments are exported, in the order they were dumped
+    std::vector<std::pair<int, int>> selected;
+};
+
+#endif
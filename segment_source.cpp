@@ -0,0 +1,51 @@
+/**
+ * This file is responsible for the formats of IBD segments RAFFI reads.
+ *
+ */
+
+#include <string>
+
+#include "segment_source.hpp"
+
+
+/**
+ * @param name name of a format of IBD segments: rapid, hap-ibd or ilash.
+ * @param format filled with the format.
+ *
+ * @return whether name is a known format.
+ */
+bool
+parse_segment_format(const std::string &name, SegmentFormat &format)
+{
+    if (name == "rapid") {
+        format = SegmentFormat::RAPID;
+    } else if (name == "hap-ibd") {
+        format = SegmentFormat::HAP_IBD;
+    } else if (name == "ilash") {
+        format = SegmentFormat::ILASH;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @param format
+ * @param path folder that stores the segments of all chromosomes.
+ * @param chromosome name of the chromosome.
+ *
+ * @return gzipped file the segments of the chromosome are read from.
+ */
+std::string
+get_segment_file(SegmentFormat format, const std::string &path, const std::string &chromosome)
+{
+    switch (format) {
+        case SegmentFormat::HAP_IBD:
+            return path + "/chr" + chromosome + ".ibd.gz";
+        case SegmentFormat::ILASH:
+            return path + "/chr" + chromosome + ".match.gz";
+        default:
+            return path + "/" + chromosome + "/results.max.gz";
+    }
+}
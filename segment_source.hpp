@@ -0,0 +1,24 @@
+/**
+ * This file is responsible for the formats of IBD segments RAFFI reads.
+ *
+ */
+
+#ifndef SEGMENT_SOURCE_HPP
+#define SEGMENT_SOURCE_HPP
+
+#include <string>
+
+enum class SegmentFormat {
+    // RaPID, {path}/{chromosome}/results.max.gz with sites of the VCF
+    RAPID,
+    // hap-IBD, {path}/chr{chromosome}.ibd.gz with base-pair positions
+    HAP_IBD,
+    // iLASH, {path}/chr{chromosome}.match.gz with base-pair positions
+    ILASH
+};
+
+bool parse_segment_format(const std::string &name, SegmentFormat &format);
+
+std::string get_segment_file(SegmentFormat format, const std::string &path, const std::string &chromosome);
+
+#endif
@@ -0,0 +1,299 @@
+/**
+ * This file is responsible for answering relatedness queries about a finished
+ * result set over a local Unix domain socket.
+ *
+ * Requests are lines of whitespace-separated words:
+ *     RELATIVES {id}               all relatives of an individual, closest first
+ *     RELATIVES {id} {max degree}  relatives up to a degree, closest first
+ *     KINSHIP {id1} {id2}          the relationship of a pair, if related
+ *     QUIT                         close the connection
+ * A response is "OK {n}" followed by n rows in the format of predictions.txt,
+ * or "ERR {reason}". Every line ends with '\n'.
+ *
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "classifier.hpp"
+#include "dumpable.hpp"
+#include "relatedness_graph.hpp"
+#include "serve.hpp"
+
+// Sockets of the clients being served, so that they can be shut down on exit
+struct client_registry {
+    std::mutex mutex;
+    std::unordered_set<int> clients;
+    bool stopping = false;
+};
+
+static void serve_clients(int server, RelatednessGraph &graph, struct client_registry &registry);
+static void handle_client(int client, RelatednessGraph &graph);
+static std::string answer(const std::string &request, RelatednessGraph &graph);
+static void append_row(std::string &response, RelatednessGraph &graph, int index, const struct relative &pair);
+
+/**
+ * Load a result set and answer queries about it until SIGINT or SIGTERM. Up to
+ * num_threads clients are served at once, each by a thread of its own; further
+ * clients wait to be accepted. On exit, connected clients are disconnected and
+ * the socket is removed.
+ *
+ * @param results_path path of final output in any output format.
+ * @param samples_path IDs of all individuals in VCF order for text output, see
+ *     RelatednessGraph.
+ * @param socket_path path of the Unix domain socket to listen on. Replaced if it exists.
+ * @param num_threads number of clients served at once.
+ */
+void
+serve(
+    const std::string &results_path,
+    const std::string &samples_path,
+    const std::string &socket_path,
+    int num_threads)
+{
+    RelatednessGraph graph(results_path, samples_path);
+    std::cout << "Loaded " << graph.get_num_pairs() << " pairs of " << graph.size() << " individuals" << std::endl;
+
+    struct sockaddr_un address;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error {"Socket path is too long: " + socket_path};
+    }
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        throw std::runtime_error {"Failed to create socket"};
+    }
+    unlink(socket_path.c_str());
+    if (bind(server, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(server, SOMAXCONN) < 0) {
+        close(server);
+        throw std::runtime_error {"Failed to listen on " + socket_path};
+    }
+
+    // A client closing its end must not terminate the server
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Only this thread receives SIGINT and SIGTERM, the threads inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    struct client_registry registry;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(serve_clients, server, std::ref(graph), std::ref(registry));
+    }
+    std::cout << "Listening on " << socket_path << std::endl;
+
+    int signal;
+    sigwait(&signals, &signal);
+    std::cout << "Received " << (signal == SIGINT ? "SIGINT" : "SIGTERM") << ", shutting down" << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.stopping = true;
+        for (int client : registry.clients) {
+            shutdown(client, SHUT_RDWR);
+        }
+    }
+    // Wakes up the threads waiting in accept
+    shutdown(server, SHUT_RDWR);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    close(server);
+    unlink(socket_path.c_str());
+    pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+}
+
+
+/**
+ * Accept clients one at a time and answer their requests until the server stops.
+ *
+ * @param server listening socket.
+ * @param graph the result set.
+ * @param registry clients being served by all threads.
+ */
+static void
+serve_clients(int server, RelatednessGraph &graph, struct client_registry &registry)
+{
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // The listening socket has been shut down
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            if (registry.stopping) {
+                close(client);
+                return;
+            }
+            registry.clients.insert(client);
+        }
+
+        handle_client(client, graph);
+
+        // Unregistered before it is closed, so that a reused descriptor is never shut down
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.clients.erase(client);
+        }
+        close(client);
+    }
+}
+
+
+/**
+ * Answer the requests of one client until it quits or disconnects. The socket
+ * is left open.
+ *
+ * @param client socket of the client.
+ * @param graph the result set.
+ */
+static void
+handle_client(int client, RelatednessGraph &graph)
+{
+    std::string pending;
+    char buffer[4096];
+    bool quit = false;
+    while (!quit) {
+        ssize_t num_read = read(client, buffer, sizeof(buffer));
+        if (num_read <= 0) {
+            break;
+        }
+        pending.append(buffer, num_read);
+
+        // Answer every complete line
+        std::string response;
+        size_t start = 0;
+        size_t end;
+        while ((end = pending.find('\n', start)) != std::string::npos) {
+            std::string request = pending.substr(start, end - start);
+            start = end + 1;
+            if (!request.empty() && request.back() == '\r') {
+                request.pop_back();
+            }
+            if (request == "QUIT") {
+                quit = true;
+                break;
+            }
+            response += answer(request, graph);
+        }
+        pending.erase(0, start);
+
+        for (size_t written = 0; written < response.size(); ) {
+            ssize_t num_written = write(client, response.data() + written, response.size() - written);
+            if (num_written <= 0) {
+                quit = true;
+                break;
+            }
+            written += num_written;
+        }
+    }
+}
+
+
+/**
+ * @param request one line of request.
+ * @param graph the result set.
+ *
+ * @return the response.
+ */
+static std::string
+answer(const std::string &request, RelatednessGraph &graph)
+{
+    std::istringstream words(request);
+    std::string command, id1, id2;
+    words >> command >> id1;
+
+    int index1 = graph.get_index(id1);
+    if (command != "RELATIVES" && command != "KINSHIP") {
+        return "ERR unknown request\n";
+    } else if (index1 < 0) {
+        return "ERR unknown ID " + id1 + "\n";
+    }
+
+    std::string rows;
+    int num_rows = 0;
+    if (command == "RELATIVES") {
+        int max_degree = 4;
+        std::string degree;
+        if (words >> degree) {
+            char *end;
+            max_degree = std::strtol(degree.c_str(), &end, 10);
+            if (*end != '\0' || max_degree < 1) {
+                return "ERR degree must be a positive number\n";
+            }
+        }
+        std::pair<const struct relative *, const struct relative *> range = graph.get_relatives(index1);
+        for (const struct relative *it = range.first; it != range.second; ++it) {
+            if (is_encoding_less_than(it->encoding, max_degree)) {
+                append_row(rows, graph, index1, *it);
+                ++num_rows;
+            }
+        }
+    } else {
+        words >> id2;
+        int index2 = graph.get_index(id2);
+        if (index2 < 0) {
+            return "ERR unknown ID " + id2 + "\n";
+        }
+        const struct relative *pair = graph.find(index1, index2);
+        if (pair) {
+            struct relative oriented = *pair;
+            oriented.index = index2;
+            append_row(rows, graph, index1, oriented);
+            ++num_rows;
+        }
+    }
+
+    return "OK " + std::to_string(num_rows) + "\n" + rows;
+}
+
+
+/**
+ * Append a pair as a row in the format of predictions.txt.
+ *
+ * @param response
+ * @param graph the result set.
+ * @param index index of one individual.
+ * @param pair the other individual as a relative of the first.
+ */
+static void
+append_row(std::string &response, RelatednessGraph &graph, int index, const struct relative &pair)
+{
+    char values[128];
+    std::snprintf(values, sizeof(values), "\t%.4f\t%.4f\t%.4f\t%.4f\t",
+        pair.kinship_coefficient, pair.probability_ibd0, pair.probability_ibd1, pair.probability_ibd2);
+    response += graph.get(index);
+    response += '\t';
+    response += graph.get(pair.index);
+    response += values;
+    response += TYPES[pair.encoding];
+    response += '\n';
+}
@@ -0,0 +1,18 @@
+/**
+ * This file is responsible for answering relatedness queries about a finished
+ * result set over a local Unix domain socket.
+ *
+ */
+
+#ifndef SERVE_HPP
+#define SERVE_HPP
+
+#include <string>
+
+void serve(
+    const std::string &results_path,
+    const std::string &samples_path,
+    const std::string &socket_path,
+    int num_threads);
+
+#endif
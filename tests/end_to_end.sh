@@ -0,0 +1,128 @@
+#!/usr/bin/env bash
+#
+# Run RAFFI on a simulated cohort in every mode that produces predictions and
+# check that they agree with a plain run:
+#
+#   resume        killed after its first checkpoint and resumed, same rows
+#   shards        3 shards and --merge-shards
+#   map-reduce    --pair-store with --map-reduce
+#   reclassify    reclassify of the pairs.totals of a plain run
+#
+# On a second cohort with more than 1,000 pairs of full siblings, where the
+# thresholds keep moving while pairs are written, calibrating modes must change
+# the types of fewer pairs of the plain run than no calibration does:
+#
+#   recompute     reclassify --calibration recompute
+#   calibrate     --calibrate 3000
+#
+# Pairs held back until enough full-siblings are found get IBD1 and IBD0 derived
+# from their kinship coefficient, and modes hold back different pairs. Apart
+# from resume, modes are therefore compared on the IDs, kinship, IBD2 and type.
+#
+# Usage: end_to_end.sh {RAFFI} {simulate_cohort} {work directory}
+
+set -euo pipefail
+
+raffi=$1
+simulate=$2
+work=$3
+
+rm -rf "$work"
+mkdir -p "$work"
+"$simulate" -n 20000 -o "$work/cohort" -t 4 --seed 1 > /dev/null
+
+input=(-i "$work/cohort/vcf" -v chr -g "$work/cohort/maps" -O "$work/cohort/rapid" -t 4)
+
+# Rows of predictions without the header, sorted
+rows() {
+    tail -n +2 "$1/predictions.txt" | sort
+}
+
+# IDs, kinship, IBD2 and type of the rows
+columns() {
+    rows "$1" | cut -f 1,2,3,6,7
+}
+
+# Number of pairs of the run in $1 missing from the run in $2 or of another type
+type_changes() {
+    diff <(rows "$1" | cut -f 1,2,7) <(rows "$2" | cut -f 1,2,7) | grep -c '^<' || true
+}
+
+failed=0
+check() {
+    if [ "$2" == "$3" ]; then
+        echo "$1: same as the plain run"
+    else
+        echo "$1: differs from the plain run"
+        failed=1
+    fi
+}
+
+mkdir "$work/plain"
+"$raffi" "${input[@]}" -o "$work/plain/" --pair-totals > /dev/null
+if [ "$(rows "$work/plain" | wc -l)" -eq 0 ]; then
+    echo "plain run found no relatives"
+    exit 1
+fi
+
+# Checkpoints are taken every second. Kill the run once the first one is written.
+mkdir "$work/resume"
+"$raffi" "${input[@]}" -o "$work/resume/" --checkpoint-interval 0.0167 > /dev/null &
+pid=$!
+while [ ! -e "$work/resume/raffi.checkpoint" ] && kill -0 $pid 2> /dev/null; do
+    sleep 0.05
+done
+kill -9 $pid 2> /dev/null || true
+wait $pid 2> /dev/null || true
+if [ ! -e "$work/resume/raffi.checkpoint" ]; then
+    echo "resume: the run finished before its first checkpoint"
+    exit 1
+fi
+"$raffi" "${input[@]}" -o "$work/resume/" --resume > /dev/null
+check resume "$(rows "$work/plain")" "$(rows "$work/resume")"
+
+mkdir "$work/shards"
+for shard in 1 2 3; do
+    "$raffi" "${input[@]}" -o "$work/shards/" --shard $shard/3 > /dev/null
+done
+"$raffi" "${input[@]}" -o "$work/shards/" --merge-shards 3 > /dev/null
+check shards "$(columns "$work/plain")" "$(columns "$work/shards")"
+
+mkdir "$work/map-reduce"
+"$raffi" "${input[@]}" -o "$work/map-reduce/" --pair-store "$work/map-reduce/store/" --map-reduce > /dev/null
+check map-reduce "$(columns "$work/plain")" "$(columns "$work/map-reduce")"
+
+mkdir "$work/reclassify"
+"$raffi" reclassify -s "$work/plain/pairs.totals" -o "$work/reclassify/" > /dev/null
+check reclassify "$(columns "$work/plain")" "$(columns "$work/reclassify")"
+
+"$simulate" -n 20000 -o "$work/families" -t 4 --seed 1 --families 0.6 > /dev/null
+families=(-i "$work/families/vcf" -v chr -g "$work/families/maps" -O "$work/families/rapid" -t 4)
+
+mkdir "$work/families/plain"
+"$raffi" "${families[@]}" -o "$work/families/plain/" --pair-totals > /dev/null
+
+mkdir "$work/families/none"
+"$raffi" reclassify -s "$work/families/plain/pairs.totals" --calibration none -o "$work/families/none/" > /dev/null
+uncalibrated=$(type_changes "$work/families/plain" "$work/families/none")
+
+# Checks that a calibrating mode in $2 changes fewer types than no calibration
+check_calibrated() {
+    local changes
+    changes=$(type_changes "$work/families/plain" "$2")
+    echo "$1: $changes pairs change type, $uncalibrated without calibration"
+    if [ "$changes" -ge "$uncalibrated" ]; then
+        failed=1
+    fi
+}
+
+mkdir "$work/families/recompute"
+"$raffi" reclassify -s "$work/families/plain/pairs.totals" --calibration recompute \
+    -o "$work/families/recompute/" > /dev/null
+check_calibrated recompute "$work/families/recompute"
+
+mkdir "$work/families/calibrate"
+"$raffi" "${families[@]}" -o "$work/families/calibrate/" --calibrate 3000 > /dev/null
+check_calibrated calibrate "$work/families/calibrate"
+
+exit $failed
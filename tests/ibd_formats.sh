@@ -0,0 +1,66 @@
+#!/usr/bin/env bash
+#
+# Run RAFFI on the same segments of a small fixture as called by RaPID, hap-IBD
+# and iLASH, and check that the predictions agree. hap-IBD and iLASH segments
+# are located by base pairs between the sites of the VCF, so they are converted
+# to the sites of the RaPID segments. The hap-IBD segments also have a pair
+# with its samples swapped and a segment spanning a single site, which is
+# dropped. A hap-IBD segment of a sample missing from the VCF must fail the run.
+#
+# Usage: ibd_formats.sh {RAFFI} {fixture directory} {work directory}
+
+set -euo pipefail
+
+raffi=$1
+fixture=$2
+work=$3
+
+rm -rf "$work"
+mkdir -p "$work/vcf" "$work/maps" "$work/rapid/1" "$work/hap-ibd" "$work/ilash" "$work/unknown"
+gzip -c "$fixture/chr1.vcf" > "$work/vcf/chr1.vcf.gz"
+cp "$fixture/chr1.rMap" "$work/maps/"
+gzip -c "$fixture/results.max" > "$work/rapid/1/results.max.gz"
+gzip -c "$fixture/chr1.ibd" > "$work/hap-ibd/chr1.ibd.gz"
+gzip -c "$fixture/chr1.match" > "$work/ilash/chr1.match.gz"
+{ cat "$fixture/chr1.ibd"; printf 's5\t1\ts9\t1\t1\t7000\t213000\t100.000\n'; } | gzip -c > "$work/unknown/chr1.ibd.gz"
+
+input=(-i "$work/vcf" -v chr -g "$work/maps" --chromosomes 1 -t 1)
+
+# Rows of predictions without the header, sorted
+rows() {
+    tail -n +2 "$1/predictions.txt" | sort
+}
+
+mkdir "$work/rapid-output"
+"$raffi" "${input[@]}" -O "$work/rapid" -o "$work/rapid-output/" > /dev/null
+if [ "$(rows "$work/rapid-output" | wc -l)" -ne 5 ]; then
+    echo "RaPID run did not find the 5 related pairs"
+    exit 1
+fi
+
+failed=0
+for format in hap-ibd ilash; do
+    mkdir "$work/$format-output"
+    "$raffi" "${input[@]}" --ibd-format $format -O "$work/$format" -o "$work/$format-output/" > /dev/null
+    if [ "$(rows "$work/rapid-output")" == "$(rows "$work/$format-output")" ]; then
+        echo "$format: same as RaPID"
+    else
+        echo "$format: differs from RaPID"
+        failed=1
+    fi
+done
+
+mkdir "$work/unknown-output"
+if "$raffi" "${input[@]}" --ibd-format hap-ibd -O "$work/unknown" -o "$work/unknown-output/" \
+    > /dev/null 2> "$work/unknown-output/errors.txt"; then
+    echo "unknown sample: accepted"
+    failed=1
+elif grep -q "Sample s9 is not in the VCF" "$work/unknown-output/errors.txt"; then
+    echo "unknown sample: rejected"
+else
+    echo "unknown sample: failed without naming the sample"
+    cat "$work/unknown-output/errors.txt"
+    failed=1
+fi
+
+exit $failed
@@ -0,0 +1,143 @@
+/**
+ * This file checks that the AVX2 and scalar kernels of get_genetic_lengths give
+ * identical lengths and sums, both equal to adding get_genetic_length one
+ * interval at a time.
+ *
+ * Exits with 0 if they match, 1 if they do not and 77 (skipped) if the CPU has
+ * no AVX2.
+ *
+ */
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "../mapper.hpp"
+
+// Sites of the genetic map
+#define NUM_SITES 100000
+// Batches of intervals compared, of 0 to MAX_BATCH_SIZE intervals each
+#define NUM_BATCHES 2000
+#define MAX_BATCH_SIZE 67
+
+static void init_random_map(std::mt19937 &random);
+static double sum_lengths(
+    const std::vector<int> &starting_sites,
+    const std::vector<int> &ending_sites,
+    std::vector<double> &lengths,
+    double total);
+
+int
+main()
+{
+    if (!set_genetic_length_kernel("avx2")) {
+        std::cout << "No AVX2 on this CPU, nothing to compare" << std::endl;
+        return 77;
+    }
+
+    std::mt19937 random(1);
+    init_random_map(random);
+    std::uniform_int_distribution<int> batch_size(0, MAX_BATCH_SIZE);
+    std::uniform_int_distribution<int> site(0, NUM_SITES - 1);
+
+    int num_mismatches = 0;
+    for (int batch = 0; batch < NUM_BATCHES; ++batch) {
+        std::vector<int> starting_sites(batch_size(random));
+        std::vector<int> ending_sites(starting_sites.size());
+        for (size_t i = 0; i < starting_sites.size(); ++i) {
+            starting_sites[i] = site(random);
+            ending_sites[i] = site(random);
+            if (starting_sites[i] > ending_sites[i]) {
+                std::swap(starting_sites[i], ending_sites[i]);
+            }
+        }
+        // Sums start from a running total, as they do while segments are added
+        double total = batch * 0.1;
+
+        set_genetic_length_kernel("avx2");
+        std::vector<double> avx2_lengths;
+        double avx2_total = sum_lengths(starting_sites, ending_sites, avx2_lengths, total);
+
+        set_genetic_length_kernel("scalar");
+        std::vector<double> scalar_lengths;
+        double scalar_total = sum_lengths(starting_sites, ending_sites, scalar_lengths, total);
+
+        double expected = total;
+        for (size_t i = 0; i < starting_sites.size(); ++i) {
+            expected += get_genetic_length(starting_sites[i], ending_sites[i], 1);
+        }
+
+        bool lengths_match = avx2_lengths.empty() || std::memcmp(
+            avx2_lengths.data(), scalar_lengths.data(), avx2_lengths.size() * sizeof(double)) == 0;
+        if (!lengths_match || avx2_total != scalar_total || scalar_total != expected) {
+            std::cout << "Batch " << batch << " of " << starting_sites.size() << " intervals differs: avx2 "
+                << avx2_total << ", scalar " << scalar_total << ", one at a time " << expected << std::endl;
+            ++num_mismatches;
+        }
+    }
+
+    deinit_maps();
+    if (num_mismatches > 0) {
+        std::cout << num_mismatches << " of " << NUM_BATCHES << " batches differ" << std::endl;
+        return 1;
+    }
+    std::cout << "AVX2 and scalar kernels match on " << NUM_BATCHES << " batches" << std::endl;
+    return 0;
+}
+
+
+/**
+ * Write a genetic map of chromosome 1 with random distances between sites to a
+ * temporary directory, and load it as the only chromosome.
+ *
+ * @param random
+ */
+static void
+init_random_map(std::mt19937 &random)
+{
+    std::vector<struct chromosome_region> regions;
+    parse_chromosome_regions("1", regions);
+    set_chromosomes(regions);
+
+    std::string map_path = (boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("raffi-test-%%%%-%%%%")).string() + "/";
+    boost::filesystem::create_directories(map_path);
+
+    std::exponential_distribution<double> site_distance(400);
+    std::ofstream out(map_path + "chr1.rMap");
+    double distance = 0;
+    for (int site = 0; site < NUM_SITES; ++site) {
+        out << site << "\t" << distance << "\n";
+        distance += site_distance(random);
+    }
+    out.close();
+
+    init_maps(map_path);
+    boost::filesystem::remove_all(map_path);
+}
+
+
+/**
+ * @param starting_sites first site of each interval.
+ * @param ending_sites last site of each interval.
+ * @param lengths filled with the length of each interval.
+ * @param total sum the lengths are added to.
+ *
+ * @return total plus the lengths of all intervals, by get_genetic_lengths.
+ */
+static double
+sum_lengths(
+    const std::vector<int> &starting_sites,
+    const std::vector<int> &ending_sites,
+    std::vector<double> &lengths,
+    double total)
+{
+    lengths.resize(starting_sites.size());
+    return get_genetic_lengths(
+        starting_sites.data(), ending_sites.data(), starting_sites.size(), 1, lengths.data(), total);
+}
@@ -0,0 +1,624 @@
+/**
+ * This file is responsible for simulating a cohort for performance and accuracy
+ * work on RAFFI: the RaPID output of every chromosome, genetic maps, a VCF
+ * header with the sample IDs and the planted relationships.
+ *
+ * A fraction of the cohort is made of three-generation pedigrees. Haplotypes of
+ * pedigree members are mosaics of founder haplotypes, inherited through meioses
+ * with crossovers placed by genetic distance, so IBD1 and IBD2 between relatives
+ * are what inheritance produces. Every individual also shares short background
+ * segments with random others, as distant relatives do.
+ *
+ * Writes to the output directory:
+ *     vcf/chr22.vcf.gz           header only, the ordering of the samples
+ *     maps/chr{i}.rMap           site and genetic position in cM
+ *     rapid/{i}/results.max.gz   segments in RaPID format, grouped by id1
+ *     truth.txt                  planted pairs up to 4th degree
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+#define NUM_CHROMOSOMES 22
+
+// Sex-averaged genetic lengths of the autosomes in cM
+static const double CHROMOSOME_LENGTHS[NUM_CHROMOSOMES] {
+    278, 263, 224, 214, 209, 194, 187, 169, 167, 173, 161,
+    176, 128, 118, 128, 134, 129, 120, 109, 99, 63, 72
+};
+
+// Members of the pedigree planted in the cohort, parents before children.
+// 0, 1 grandparents; 2, 3 their children; 4, 5 spouses of 2 and 3; 6, 7 children
+// of 2 and 4; 8, 9 children of 3 and 5; 10 spouse of 6; 11 child of 6 and 10.
+// Founders have no parents (-1).
+#define FAMILY_SIZE 12
+static const int MOTHERS[FAMILY_SIZE] {-1, -1, 0, 0, -1, -1, 2, 2, 3, 3, -1, 6};
+static const int FATHERS[FAMILY_SIZE] {-1, -1, 1, 1, -1, -1, 4, 4, 5, 5, -1, 10};
+
+// Simulation parameters
+struct simulation_options {
+    int num_ids = 100000;
+    std::string output_path;
+    unsigned int num_threads = 1;
+    // Fraction of the cohort in pedigrees
+    double family_fraction = 0.1;
+    // Probability that a pedigree member is in the cohort
+    double sampled = 0.8;
+    // Mean number of background segments per individual and chromosome
+    double background = 2;
+    // Mean length of a background segment beyond min_length, in cM
+    double background_length = 1.5;
+    // Segments shorter than this are not reported, in cM
+    double min_length = 3;
+    // Sites per cM
+    double site_density = 20;
+    unsigned int seed = 1;
+};
+
+// A haplotype as a mosaic of founder haplotypes: pieces ending before a site,
+// with the founder haplotype they come from
+typedef std::vector<std::pair<int, int>> Mosaic;
+
+// A segment shared by two individuals
+struct segment {
+    int id1_index;
+    int id2_index;
+    int hap1;
+    int hap2;
+    // Inclusive range of sites
+    int starting_site;
+    int ending_site;
+};
+
+// Pedigrees planted in the cohort
+struct cohort {
+    int num_families;
+    // Index in the cohort of every pedigree member, family after family, or -1
+    // if the member is not sampled
+    std::vector<int> member_indices;
+};
+
+static bool parse_options(int args, char **argv, struct simulation_options &options);
+static struct cohort plant_families(const struct simulation_options &options);
+static std::vector<double> write_map(const struct simulation_options &options, int chromosome_number);
+static void simulate_chromosome(
+    const struct simulation_options &options,
+    const struct cohort &cohort,
+    int chromosome_number);
+static Mosaic meiosis(const Mosaic &hap0, const Mosaic &hap1, const std::vector<double> &map, std::mt19937 &random);
+static void append_range(Mosaic &child, const Mosaic &hap, int start, int end);
+static void add_ibd(
+    const Mosaic &hap1, const Mosaic &hap2,
+    int id1_index, int id2_index, int hap1_index, int hap2_index,
+    const std::vector<double> &map, double min_length,
+    std::vector<struct segment> &segments);
+static void write_segments(
+    const std::string &path,
+    int chromosome_number,
+    std::vector<struct segment> &segments,
+    const std::vector<double> &map);
+static void write_vcf_header(const struct simulation_options &options);
+static void write_truth(const struct simulation_options &options, const struct cohort &cohort);
+static std::vector<std::vector<double>> get_family_kinship();
+static std::string get_id(int index);
+
+int
+main(int args, char **argv)
+{
+    struct simulation_options options;
+    if (!parse_options(args, argv, options)) {
+        std::cerr << "Usage: simulate_cohort -n {number of individuals} -o {output directory}" << std::endl
+            << "\t[-t {threads}] [--families {fraction in pedigrees, 0.1}] [--sampled {probability, 0.8}]" << std::endl
+            << "\t[--background {segments per individual and chromosome, 2}] [--min-cm {3}]" << std::endl
+            << "\t[--sites-per-cm {20}] [--seed {1}]" << std::endl;
+        return -1;
+    }
+
+    for (const char *directory : {"vcf", "maps", "rapid"}) {
+        boost::filesystem::create_directories(options.output_path + "/" + directory);
+    }
+
+    struct cohort cohort = plant_families(options);
+    write_vcf_header(options);
+    write_truth(options, cohort);
+
+    // Chromosomes are simulated independently, largest first
+    std::atomic<int> next(0);
+    std::vector<std::future<void>> futures;
+    for (unsigned int thread = 0; thread < options.num_threads; ++thread) {
+        futures.push_back(std::async(std::launch::async, [&]() {
+            for (int i = next++; i < NUM_CHROMOSOMES; i = next++) {
+                simulate_chromosome(options, cohort, i + 1);
+            }
+        }));
+    }
+    for (std::future<void> &f : futures) {
+        f.get();
+    }
+
+    std::cout << "Simulated " << options.num_ids << " individuals, " << cohort.num_families
+        << " pedigrees in " << options.output_path << std::endl;
+    return 0;
+}
+
+
+/**
+ * Parse command line arguments.
+ *
+ * @param args number of command line arguments.
+ * @param argv command line arguments.
+ * @param options filled with the parsed options.
+ *
+ * @return whether the arguments are valid and the output directory is given.
+ */
+static bool
+parse_options(int args, char **argv, struct simulation_options &options)
+{
+    for (int i = 1; i < args; ++i) {
+        std::string option = argv[i];
+        if (i + 1 >= args) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (option == "-n") {
+            options.num_ids = std::stoi(value);
+        } else if (option == "-o") {
+            options.output_path = value;
+        } else if (option == "-t") {
+            options.num_threads = std::max(1, std::stoi(value));
+        } else if (option == "--families") {
+            options.family_fraction = std::stod(value);
+        } else if (option == "--sampled") {
+            options.sampled = std::stod(value);
+        } else if (option == "--background") {
+            options.background = std::stod(value);
+        } else if (option == "--min-cm") {
+            options.min_length = std::stod(value);
+        } else if (option == "--sites-per-cm") {
+            options.site_density = std::stod(value);
+        } else if (option == "--seed") {
+            options.seed = std::stoul(value);
+        } else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return false;
+        }
+    }
+    return !options.output_path.empty() && options.num_ids > 1;
+}
+
+
+/**
+ * Place pedigree members at random indices of the cohort. Individuals not in a
+ * pedigree, and the indices of members that are not sampled, are unrelated
+ * except for background sharing.
+ *
+ * @param options simulation parameters.
+ *
+ * @return the planted pedigrees.
+ */
+static struct cohort
+plant_families(const struct simulation_options &options)
+{
+    struct cohort cohort;
+    cohort.num_families = (int) (options.num_ids * options.family_fraction) / FAMILY_SIZE;
+
+    std::mt19937 random(options.seed);
+    std::vector<int> indices(options.num_ids);
+    for (int i = 0; i < options.num_ids; ++i) {
+        indices[i] = i;
+    }
+    std::shuffle(indices.begin(), indices.end(), random);
+
+    std::bernoulli_distribution is_sampled(options.sampled);
+    for (int i = 0; i < cohort.num_families * FAMILY_SIZE; ++i) {
+        cohort.member_indices.push_back(is_sampled(random) ? indices[i] : -1);
+    }
+    return cohort;
+}
+
+
+/**
+ * Write the genetic map of one chromosome. Sites are spaced at random.
+ *
+ * @param options simulation parameters.
+ * @param chromosome_number
+ *
+ * @return genetic position of every site in cM.
+ */
+static std::vector<double>
+write_map(const struct simulation_options &options, int chromosome_number)
+{
+    double length = CHROMOSOME_LENGTHS[chromosome_number - 1];
+    int num_sites = (int) (length * options.site_density);
+
+    std::mt19937 random(options.seed * 1000 + chromosome_number);
+    std::exponential_distribution<double> gap(1);
+    std::vector<double> map(num_sites, 0);
+    for (int site = 1; site < num_sites; ++site) {
+        map[site] = map[site - 1] + gap(random);
+    }
+    for (double &position : map) {
+        position *= length / map.back();
+    }
+
+    std::ofstream out(options.output_path + "/maps/chr" + std::to_string(chromosome_number) + ".rMap");
+    out.precision(6);
+    out << std::fixed;
+    for (int site = 0; site < num_sites; ++site) {
+        out << site << "\t" << map[site] << "\n";
+    }
+    if (!out) {
+        throw std::runtime_error {"Failed to write map of chromosome " + std::to_string(chromosome_number)};
+    }
+    return map;
+}
+
+
+/**
+ * Simulate and write the genetic map and RaPID output of one chromosome.
+ *
+ * @param options simulation parameters.
+ * @param cohort the planted pedigrees.
+ * @param chromosome_number
+ */
+static void
+simulate_chromosome(
+    const struct simulation_options &options,
+    const struct cohort &cohort,
+    int chromosome_number)
+{
+    std::vector<double> map = write_map(options, chromosome_number);
+    int num_sites = map.size();
+    std::mt19937 random(options.seed * 1000 + NUM_CHROMOSOMES + chromosome_number);
+    std::vector<struct segment> segments;
+
+    // Inherit haplotypes down each pedigree and report what relatives share
+    for (int family = 0; family < cohort.num_families; ++family) {
+        std::vector<Mosaic> haps(2 * FAMILY_SIZE);
+        for (int member = 0; member < FAMILY_SIZE; ++member) {
+            if (MOTHERS[member] < 0) {
+                int founder = family * FAMILY_SIZE + member;
+                haps[2 * member] = {{num_sites, 2 * founder}};
+                haps[2 * member + 1] = {{num_sites, 2 * founder + 1}};
+            } else {
+                int mother = MOTHERS[member];
+                int father = FATHERS[member];
+                haps[2 * member] = meiosis(haps[2 * mother], haps[2 * mother + 1], map, random);
+                haps[2 * member + 1] = meiosis(haps[2 * father], haps[2 * father + 1], map, random);
+            }
+        }
+
+        for (int member1 = 0; member1 < FAMILY_SIZE; ++member1) {
+            int id1_index = cohort.member_indices[family * FAMILY_SIZE + member1];
+            for (int member2 = member1 + 1; member2 < FAMILY_SIZE && id1_index >= 0; ++member2) {
+                int id2_index = cohort.member_indices[family * FAMILY_SIZE + member2];
+                if (id2_index < 0) {
+                    continue;
+                }
+                for (int hap1 = 0; hap1 < 2; ++hap1) {
+                    for (int hap2 = 0; hap2 < 2; ++hap2) {
+                        add_ibd(
+                            haps[2 * member1 + hap1], haps[2 * member2 + hap2],
+                            id1_index, id2_index, hap1, hap2,
+                            map, options.min_length, segments);
+                    }
+                }
+            }
+        }
+    }
+
+    // Background sharing with distant relatives
+    std::poisson_distribution<int> num_background(options.background);
+    std::exponential_distribution<double> background_length(1 / options.background_length);
+    std::uniform_int_distribution<int> other(0, options.num_ids - 1);
+    std::uniform_int_distribution<int> hap(0, 1);
+    double length = map.back();
+    for (int id1_index = 0; id1_index < options.num_ids; ++id1_index) {
+        for (int i = num_background(random); i > 0; --i) {
+            int id2_index = other(random);
+            double segment_length = options.min_length + background_length(random);
+            if (id2_index == id1_index || segment_length >= length) {
+                continue;
+            }
+            double start = std::uniform_real_distribution<double>(0, length - segment_length)(random);
+            int starting_site = std::lower_bound(map.begin(), map.end(), start) - map.begin();
+            int ending_site = std::lower_bound(map.begin(), map.end(), start + segment_length) - map.begin();
+            segments.push_back({
+                id1_index, id2_index, hap(random), hap(random),
+                starting_site, std::min(ending_site, num_sites - 1)
+            });
+        }
+    }
+
+    std::string rapid_path = options.output_path + "/rapid/" + std::to_string(chromosome_number);
+    boost::filesystem::create_directories(rapid_path);
+    write_segments(rapid_path + "/results.max.gz", chromosome_number, segments, map);
+}
+
+
+/**
+ * Simulate one meiosis. The number of crossovers follows the genetic length of
+ * the chromosome, one per Morgan on average.
+ *
+ * @param hap0 one haplotype of the parent.
+ * @param hap1 the other haplotype of the parent.
+ * @param map genetic position of every site.
+ * @param random random number generator.
+ *
+ * @return the haplotype passed on to the child.
+ */
+static Mosaic
+meiosis(const Mosaic &hap0, const Mosaic &hap1, const std::vector<double> &map, std::mt19937 &random)
+{
+    int num_sites = map.size();
+    std::poisson_distribution<int> num_crossovers(map.back() / 100);
+    std::uniform_real_distribution<double> position(0, map.back());
+
+    std::vector<int> crossovers;
+    for (int i = num_crossovers(random); i > 0; --i) {
+        crossovers.push_back(std::lower_bound(map.begin(), map.end(), position(random)) - map.begin());
+    }
+    std::sort(crossovers.begin(), crossovers.end());
+    crossovers.push_back(num_sites);
+
+    Mosaic child;
+    bool from_hap1 = std::bernoulli_distribution(0.5)(random);
+    int start = 0;
+    for (int end : crossovers) {
+        if (end > start) {
+            append_range(child, from_hap1 ? hap1 : hap0, start, end);
+            start = end;
+        }
+        from_hap1 = !from_hap1;
+    }
+    return child;
+}
+
+
+/**
+ * Copy the pieces of a haplotype between two sites to the end of another.
+ *
+ * @param child haplotype to append to.
+ * @param hap haplotype to copy from.
+ * @param start first site to copy.
+ * @param end site after the last site to copy.
+ */
+static void
+append_range(Mosaic &child, const Mosaic &hap, int start, int end)
+{
+    for (const auto &piece : hap) {
+        if (piece.first <= start) {
+            continue;
+        }
+        int piece_end = std::min(piece.first, end);
+        if (!child.empty() && child.back().second == piece.second) {
+            child.back().first = piece_end;
+        } else {
+            child.push_back({piece_end, piece.second});
+        }
+        if (piece.first >= end) {
+            break;
+        }
+    }
+}
+
+
+/**
+ * Report the stretches where two haplotypes come from the same founder haplotype.
+ *
+ * @param hap1 haplotype of one individual.
+ * @param hap2 haplotype of the other individual.
+ * @param id1_index index of one individual.
+ * @param id2_index index of the other individual.
+ * @param hap1_index which haplotype of id1.
+ * @param hap2_index which haplotype of id2.
+ * @param map genetic position of every site.
+ * @param min_length shorter stretches are not reported, in cM.
+ * @param segments the reported segments are appended to it.
+ */
+static void
+add_ibd(
+    const Mosaic &hap1, const Mosaic &hap2,
+    int id1_index, int id2_index, int hap1_index, int hap2_index,
+    const std::vector<double> &map, double min_length,
+    std::vector<struct segment> &segments)
+{
+    size_t i = 0;
+    size_t j = 0;
+    int start = 0;
+    // Start of the current shared stretch, -1 if none
+    int shared_start = -1;
+    while (i < hap1.size() && j < hap2.size()) {
+        int end = std::min(hap1[i].first, hap2[j].first);
+        bool shared = hap1[i].second == hap2[j].second;
+        if (shared && shared_start < 0) {
+            shared_start = start;
+        }
+        if (!shared && shared_start >= 0) {
+            if (map[start - 1] - map[shared_start] >= min_length) {
+                segments.push_back({id1_index, id2_index, hap1_index, hap2_index, shared_start, start - 1});
+            }
+            shared_start = -1;
+        }
+
+        start = end;
+        if (hap1[i].first == end) {
+            ++i;
+        }
+        if (hap2[j].first == end) {
+            ++j;
+        }
+    }
+    if (shared_start >= 0 && map[start - 1] - map[shared_start] >= min_length) {
+        segments.push_back({id1_index, id2_index, hap1_index, hap2_index, shared_start, start - 1});
+    }
+}
+
+
+/**
+ * Write segments in the format of RaPID, ordered by id1 and then by id2.
+ *
+ * @param path path of results.max.gz.
+ * @param chromosome_number
+ * @param segments the segments. id1 and id2 are swapped so that id1 is the
+ *     smaller index.
+ * @param map genetic position of every site.
+ */
+static void
+write_segments(
+    const std::string &path,
+    int chromosome_number,
+    std::vector<struct segment> &segments,
+    const std::vector<double> &map)
+{
+    for (struct segment &segment : segments) {
+        if (segment.id1_index > segment.id2_index) {
+            std::swap(segment.id1_index, segment.id2_index);
+            std::swap(segment.hap1, segment.hap2);
+        }
+    }
+    std::sort(segments.begin(), segments.end(), [](const struct segment &a, const struct segment &b) {
+        return a.id1_index != b.id1_index ? a.id1_index < b.id1_index :
+            a.id2_index != b.id2_index ? a.id2_index < b.id2_index : a.starting_site < b.starting_site;
+    });
+
+    std::ofstream file(path, std::ios_base::out | std::ios_base::binary);
+    boost::iostreams::filtering_ostream out;
+    out.push(boost::iostreams::gzip_compressor(boost::iostreams::gzip_params(1)));
+    out.push(file);
+
+    std::string line;
+    char length[32];
+    for (const struct segment &segment : segments) {
+        std::to_chars_result result = std::to_chars(
+            length, length + sizeof(length),
+            map[segment.ending_site] - map[segment.starting_site],
+            std::chars_format::fixed, 3);
+        line = std::to_string(chromosome_number);
+        line += "\t" + get_id(segment.id1_index) + "\t" + get_id(segment.id2_index);
+        line += "\t" + std::to_string(segment.hap1) + "\t" + std::to_string(segment.hap2);
+        line += "\t" + std::to_string(segment.starting_site * 1000LL) + "\t" + std::to_string(segment.ending_site * 1000LL);
+        line += "\t" + std::string(length, result.ptr);
+        line += "\t" + std::to_string(segment.starting_site) + "\t" + std::to_string(segment.ending_site) + "\n";
+        out << line;
+    }
+
+    out.reset();
+    if (!file) {
+        throw std::runtime_error {"Failed to write " + path};
+    }
+}
+
+
+/**
+ * Write a VCF without records. Its header gives RAFFI the ordering of the samples.
+ *
+ * @param options simulation parameters.
+ */
+static void
+write_vcf_header(const struct simulation_options &options)
+{
+    std::ofstream file(options.output_path + "/vcf/chr22.vcf.gz", std::ios_base::out | std::ios_base::binary);
+    boost::iostreams::filtering_ostream out;
+    out.push(boost::iostreams::gzip_compressor());
+    out.push(file);
+
+    out << "##fileformat=VCFv4.2\n#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+    for (int i = 0; i < options.num_ids; ++i) {
+        out << "\t" << get_id(i);
+    }
+    out << "\n";
+}
+
+
+/**
+ * Write the planted pairs up to 4th degree with their expected kinship
+ * coefficients and types in the format of predictions.txt.
+ *
+ * @param options simulation parameters.
+ * @param cohort the planted pedigrees.
+ */
+static void
+write_truth(const struct simulation_options &options, const struct cohort &cohort)
+{
+    std::vector<std::vector<double>> kinship = get_family_kinship();
+
+    std::ofstream out(options.output_path + "/truth.txt");
+    out << "ID1\tID2\tKINSHIP\tTYPE\n";
+    for (int family = 0; family < cohort.num_families; ++family) {
+        for (int member1 = 0; member1 < FAMILY_SIZE; ++member1) {
+            for (int member2 = member1 + 1; member2 < FAMILY_SIZE; ++member2) {
+                int id1_index = cohort.member_indices[family * FAMILY_SIZE + member1];
+                int id2_index = cohort.member_indices[family * FAMILY_SIZE + member2];
+                double coefficient = kinship[member1][member2];
+                if (id1_index < 0 || id2_index < 0 || coefficient == 0) {
+                    continue;
+                }
+
+                // 1/4 is 1st degree, 1/8 2nd degree and so on
+                int degree = (int) std::lround(-std::log2(coefficient)) - 1;
+                std::string type;
+                if (degree == 1) {
+                    bool parent = MOTHERS[member2] == member1 || FATHERS[member2] == member1;
+                    type = parent ? "PO" : "FS";
+                } else {
+                    type = degree == 2 ? "2nd" : degree == 3 ? "3rd" : "4th";
+                }
+                out << get_id(std::min(id1_index, id2_index)) << "\t" << get_id(std::max(id1_index, id2_index))
+                    << "\t" << coefficient << "\t" << type << "\n";
+            }
+        }
+    }
+    if (!out) {
+        throw std::runtime_error {"Failed to write truth to " + options.output_path};
+    }
+}
+
+
+/**
+ * @return kinship coefficients between all members of the pedigree.
+ */
+static std::vector<std::vector<double>>
+get_family_kinship()
+{
+    std::vector<std::vector<double>> kinship(FAMILY_SIZE, std::vector<double>(FAMILY_SIZE, 0));
+    for (int i = 0; i < FAMILY_SIZE; ++i) {
+        // Nobody is inbred
+        kinship[i][i] = 0.5;
+        if (MOTHERS[i] < 0) {
+            continue;
+        }
+        // Earlier members are never descendants of i
+        for (int j = 0; j < i; ++j) {
+            kinship[i][j] = kinship[j][i] = (kinship[MOTHERS[i]][j] + kinship[FATHERS[i]][j]) / 2;
+        }
+    }
+    return kinship;
+}
+
+
+/**
+ * @param index index of an individual in the cohort.
+ *
+ * @return ID of the individual.
+ */
+static std::string
+get_id(int index)
+{
+    return "s" + std::to_string(index);
+}